@@ -0,0 +1,37 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <cstddef>
+
+
+
+
+/**
+ * Minimal interface of a connected, reliable byte stream (in practice, a TCP connection), as needed by XmlFSocket for its framing and parsing.
+ *
+ * Implementations: FSocketByteStream wraps an engine FSocket; the headless tests and benchmarks (Test/XmlFSocket) have an in-memory loopback and a POSIX
+ * socket implementation, so that XmlFSocket can be exercised without the engine.
+ */
+class ByteStream
+{
+public:
+
+	virtual ~ByteStream() {}
+
+
+	/** Whether the stream is connected and all-ok. */
+	virtual bool IsGood() = 0;
+
+	/** Block until there is data to read, for at most timeoutMs milliseconds. Returns true if there is data to read. */
+	virtual bool WaitForData( int timeoutMs ) = 0;
+
+	/** Check how many bytes can be read without blocking. Returns false if none can, or on failure. */
+	virtual bool HasPendingData( std::size_t & bytesPending ) = 0;
+
+	/** Read up to size bytes without blocking. Returns false on failure. */
+	virtual bool Read( char * data, std::size_t size, std::size_t & bytesRead ) = 0;
+
+	/** Write all size bytes of data. Returns true on success, false on full or partial failure. */
+	virtual bool Write( const char * data, std::size_t size ) = 0;
+};
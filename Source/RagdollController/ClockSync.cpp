@@ -0,0 +1,78 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "ClockSync.h"
+
+#include <cmath>
+#include <algorithm>
+
+
+// controller gains: dilation per second of offset error (proportional), and per second of offset error per second (integral)
+#define CLOCK_SYNC_PROPORTIONAL_GAIN 0.5
+#define CLOCK_SYNC_INTEGRAL_GAIN 0.05
+
+// bounds for the dilation, and for its rate of change (per second of wall clock time)
+#define CLOCK_SYNC_MIN_DILATION 0.5
+#define CLOCK_SYNC_MAX_DILATION 2.0
+#define CLOCK_SYNC_MAX_DILATION_RATE 0.5
+
+// re-lock the reference offset if the offset error exceeds this (seconds)
+#define CLOCK_SYNC_RESYNC_THRESHOLD 1.0
+
+// limit for the time step between samples (seconds), so that a hitch does not kick the integral term
+#define CLOCK_SYNC_MAX_SAMPLE_INTERVAL 0.1
+
+
+
+
+float ClockSync::AddSample( double serverTime, double localTime, double wallTime, float nominalDilation )
+{
+	double offset = serverTime - localTime;
+	nominalDilation = FMath::Clamp( nominalDilation, float( CLOCK_SYNC_MIN_DILATION ), float( CLOCK_SYNC_MAX_DILATION ) );
+
+	// lock (or re-lock) the reference offset
+	if( !this->Locked || std::abs( offset - this->ReferenceOffset ) > CLOCK_SYNC_RESYNC_THRESHOLD )
+	{
+		if( this->Locked )
+		{
+			UE_LOG( LogRcSystem, Warning, TEXT( "(%s) Clock offset error %.3f s exceeds the resync threshold, re-locking." ), TEXT( __FUNCTION__ ),
+				offset - this->ReferenceOffset );
+		}
+
+		this->ReferenceOffset = offset;
+		this->Locked = true;
+		this->LastSampleTime = wallTime;
+		this->Integral = 0.0;
+		this->Error = 0.0;
+		this->Dilation = nominalDilation;
+		return this->Dilation;
+	}
+
+	double dt = std::min( wallTime - this->LastSampleTime, CLOCK_SYNC_MAX_SAMPLE_INTERVAL );
+	this->LastSampleTime = wallTime;
+	if( dt <= 0.0 ) return this->Dilation;
+
+	// PI control; integrate only while the output is within bounds, so that the integral term does not wind up during saturation
+	this->Error = offset - this->ReferenceOffset;
+	double integral = this->Integral + CLOCK_SYNC_INTEGRAL_GAIN * this->Error * dt;
+	double target = nominalDilation + CLOCK_SYNC_PROPORTIONAL_GAIN * this->Error + integral;
+	if( target >= CLOCK_SYNC_MIN_DILATION && target <= CLOCK_SYNC_MAX_DILATION )
+	{
+		this->Integral = integral;
+	}
+	target = FMath::Clamp( target, CLOCK_SYNC_MIN_DILATION, CLOCK_SYNC_MAX_DILATION );
+
+	// limit the rate of change
+	double maxStep = CLOCK_SYNC_MAX_DILATION_RATE * dt;
+	this->Dilation = float( FMath::Clamp( target, this->Dilation - maxStep, this->Dilation + maxStep ) );
+
+	return this->Dilation;
+}
+
+
+
+
+void ClockSync::Reset()
+{
+	*this = ClockSync();
+}
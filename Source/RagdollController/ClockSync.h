@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+
+
+
+/**
+ * Client-side controller that keeps the local simulation time aligned with the server's, by adjusting the local time dilation.
+ *
+ * The server timestamps its ticks with its simulation time. On the first sample, the offset between the server and local simulation times (which includes
+ * the network delay) is locked as the reference. Each further sample measures the deviation from that reference, and a PI controller steers the dilation:
+ * the proportional term removes offset errors, the integral term learns the residual rate difference that the nominal dilation (the ratio of the tick
+ * rates) does not account for. The dilation is bounded, and so is its rate of change, so that corrections are not visible as speed jumps. If the offset
+ * error grows beyond a threshold (e.g. after a hitch or a server restart), then the reference is re-locked instead.
+ */
+class ClockSync
+{
+	/** Reference (server time - local time), locked on the first sample. */
+	double ReferenceOffset = 0.0;
+	bool Locked = false;
+
+	/** Wall clock time of the previous sample. */
+	double LastSampleTime = 0.0;
+
+	/** Integral term of the controller. */
+	double Integral = 0.0;
+
+	/** Offset error at the previous sample (seconds, positive if the local simulation is behind). */
+	double Error = 0.0;
+
+	float Dilation = 1.f;
+
+
+public:
+
+	/**
+	 * Update the controller with a new server timestamp.
+	 *
+	 * @param serverTime Simulation time of the server when it sent the timestamp.
+	 * @param localTime Local simulation time when the timestamp was received.
+	 * @param wallTime Local wall clock time when the timestamp was received (seconds, monotonic).
+	 * @param nominalDilation Feed-forward estimate of the required dilation, e.g. the ratio of the server and local tick rates.
+	 * @return The new time dilation.
+	 */
+	float AddSample( double serverTime, double localTime, double wallTime, float nominalDilation );
+
+	/** Forget the reference offset and the controller state. The next sample re-locks. */
+	void Reset();
+
+
+	float GetDilation() const { return this->Dilation; }
+
+	/** Offset error at the latest sample (seconds, positive if the local simulation is behind the server). */
+	double GetError() const { return this->Error; }
+};
@@ -4,10 +4,11 @@
 #include "ControlledRagdoll.h"
 
 #include "RCLevelScriptActor.h"
+#include "ParallelPhysicsScenes.h"
 #include "XmlFSocket.h"
 #include "ScopeGuard.h"
 #include "Utility.h"
-#include "Mbml.h"
+#include "TickProfiler.h"
 
 #include <pugixml.hpp>
 
@@ -20,13 +21,40 @@
 #include <PxRigidDynamic.h>
 #include <PxTransform.h>
 
-#include <cstring>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+// pose replication, multicast channel: interval (wall clock seconds) for re-sending an unchanged pose
+#define POSE_IDLE_RESEND_INTERVAL 1.0
+
+// initial arena size of each delayed remote controller document (as the arena of the received document, @see XmlFSocket)
+#define DELAYED_COMMANDS_ARENA_SIZE (64 * 1024)
+
+
+
+// tick phase timings (@see TickProfiler)
+DECLARE_CYCLE_STAT( TEXT( "NetworkWait" ), STAT_RcNetworkWait, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "ReadFromRemoteController" ), STAT_RcReadFromRemoteController, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "Replay" ), STAT_RcReplay, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "ReadFromSimulation" ), STAT_RcReadFromSimulation, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "TickHook" ), STAT_RcTickHook, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "Blueprint" ), STAT_RcBlueprint, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "ComputeTorques" ), STAT_RcComputeTorques, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "ApplyTorques" ), STAT_RcApplyTorques, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "WriteToRemoteController" ), STAT_RcWriteToRemoteController, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "SendToRemoteController" ), STAT_RcSendToRemoteController, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "SendPose" ), STAT_RcSendPose, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "RecordTrajectory" ), STAT_RcRecordTrajectory, STATGROUP_RagdollController );
+DECLARE_CYCLE_STAT( TEXT( "ReceivePose" ), STAT_RcReceivePose, STATGROUP_RagdollController );
 
 
 
 
-AControlledRagdoll::AControlledRagdoll()
+AControlledRagdoll::AControlledRagdoll() :
+	DelayedRemoteControllerCommands( DELAYED_COMMANDS_ARENA_SIZE )
 {
 }
 
@@ -37,8 +65,9 @@ void AControlledRagdoll::GetLifetimeReplicatedProps( TArray<FLifetimeProperty> &
 {
 	Super::GetLifetimeReplicatedProps( OutLifetimeProps );
 
-	DOREPLIFETIME( AControlledRagdoll, BoneStates );
-	DOREPLIFETIME( AControlledRagdoll, ServerInterpretationOfDeadbeef );
+	DOREPLIFETIME( AControlledRagdoll, ReplicatedPose );
+	DOREPLIFETIME( AControlledRagdoll, ReplicatedPoseOrigin );
+	DOREPLIFETIME( AControlledRagdoll, ReplicatedPoseTimestamp );
 }
 
 
@@ -77,9 +106,6 @@ void AControlledRagdoll::PostInitializeComponents()
 	{
 
 		/* We are standalone or a server */
-		
-		// Store server's interpretation of 0xdeadbeef to a replicated float
-		std::memcpy( &this->ServerInterpretationOfDeadbeef, "\xde\xad\xbe\xef", sizeof(this->ServerInterpretationOfDeadbeef) );
 
 		// make sure that physics simulation is enabled also on a dedicated server
 		this->SkeletalMeshComponent->bEnablePhysicsOnDedicatedServer = true;
@@ -118,6 +144,90 @@ void AControlledRagdoll::BeginPlay()
 
 	// Register for automatic NetUpdateFrequency management
 	this->LevelScriptActor->RegisterManagedNetUpdateFrequency( this );
+
+	// Let the LevelScriptActor tick us together with all other ragdolls if requested, otherwise register our own post-physics tick (simulation happens
+	// only on authority)
+	if( HasAuthority() && this->LevelScriptActor->BatchTickRagdolls )
+	{
+		SetActorTickEnabled( false );
+		this->LevelScriptActor->RegisterBatchTickedRagdoll( this );
+		this->BatchTicked = true;
+	}
+	else if( HasAuthority() )
+	{
+		this->LevelScriptActor->RegisterSelfTickedRagdoll( this );
+
+		this->PostPhysicsTickFunction.TickGroup = TG_PostPhysics;
+		this->PostPhysicsTickFunction.bCanEverTick = true;
+		this->PostPhysicsTickFunction.Target = this;
+		this->PostPhysicsTickFunction.RegisterTickFunction( GetLevel() );
+
+		if( this->LevelScriptActor->PipelineRemoteControllers )
+		{
+			this->DuringPhysicsTickFunction.TickGroup = TG_DuringPhysics;
+			this->DuringPhysicsTickFunction.bCanEverTick = true;
+			this->DuringPhysicsTickFunction.Target = this;
+			this->DuringPhysicsTickFunction.RegisterTickFunction( GetLevel() );
+		}
+	}
+
+	// The pre-physics half of the tick works on the simulation state read by the post-physics half of the previous tick: read the initial state here
+	if( HasAuthority() )
+	{
+		ReadFromSimulation();
+	}
+
+	// Move into a private physics scene if requested (simulation happens only on authority)
+	if( HasAuthority() )
+	{
+		if( ParallelPhysicsScenes * physicsScenes = this->LevelScriptActor->GetParallelPhysicsScenes() )
+		{
+			this->InPrivatePhysicsScene = physicsScenes->AddRagdoll( this, this->PhysicsSceneGroup );
+		}
+	}
+}
+
+
+
+
+void AControlledRagdoll::EndPlay( const EEndPlayReason::Type EndPlayReason )
+{
+	// Close the trajectory files. Closing does not wait for the file to be written out; unless only this ragdoll goes away, the session is ending, so wait
+	// for all closed files to be complete.
+	StopRecording();
+	StopReplay();
+	if( EndPlayReason != EEndPlayReason::Destroyed )
+	{
+		TrajectoryWriter::WaitForClosedFiles();
+	}
+
+	// Stop batch ticking, or our own post-physics tick
+	if( this->BatchTicked )
+	{
+		this->LevelScriptActor->UnregisterBatchTickedRagdoll( this );
+		this->BatchTicked = false;
+	}
+	if( this->PostPhysicsTickFunction.IsTickFunctionRegistered() )
+	{
+		this->PostPhysicsTickFunction.UnRegisterTickFunction();
+		this->LevelScriptActor->UnregisterSelfTickedRagdoll( this );
+	}
+	if( this->DuringPhysicsTickFunction.IsTickFunctionRegistered() )
+	{
+		this->DuringPhysicsTickFunction.UnRegisterTickFunction();
+	}
+
+	// Return to the world physics scene before our bodies are destroyed. The private scenes might have already been torn down by the LevelScriptActor.
+	if( this->InPrivatePhysicsScene )
+	{
+		if( ParallelPhysicsScenes * physicsScenes = this->LevelScriptActor->GetParallelPhysicsScenes() )
+		{
+			physicsScenes->RemoveRagdoll( this );
+		}
+		this->InPrivatePhysicsScene = false;
+	}
+
+	Super::EndPlay( EndPlayReason );
 }
 
 
@@ -128,8 +238,8 @@ void AControlledRagdoll::Tick( float deltaSeconds )
 	// If network client, then we are just visualizing the ragdoll that is being simulated on the server
 	if( !HasAuthority() )
 	{
-		// If client-side prediction is off, then update the pose here on each tick, effectively freezing the skelmesh between bone state replications.
-		// Otherwise update it in HandleBoneStatesReplicationEvent(). @see HandleBoneStatesReplicationEvent()
+		// If client-side prediction is off, then update the pose here on each tick: either play out the jitter buffer, or apply the latest pose, effectively
+		// freezing the skelmesh between bone state replications. Otherwise update it in HandleReplicatedPoseEvent(). @see HandleReplicatedPoseEvent()
 		check( this->LevelScriptActor );   // LevelScriptActor is null during an editor session, but Tick() should not be called in that case
 		if( !this->LevelScriptActor->PoseReplicationDoClientsidePrediction )
 		{
@@ -137,59 +247,141 @@ void AControlledRagdoll::Tick( float deltaSeconds )
 		}
 
 		// Call the tick hook (available for inherited C++ classes), then Super::Tick(), which runs this actor's Blueprint
-		TickHook( deltaSeconds );
-		Super::Tick( deltaSeconds );
+		{
+			RC_SCOPE_TICK_PHASE( STAT_RcTickHook, "TickHook" );
+			TickHook( deltaSeconds );
+		}
+		{
+			RC_SCOPE_TICK_PHASE( STAT_RcBlueprint, "Blueprint" );
+			Super::Tick( deltaSeconds );
+		}
 
 		return;
 	}
 
 
-	/* We are standalone or a server */
+	/* We are standalone or a server: run the pre-physics batch tick stages in order (@see ARCLevelScriptActor::BatchTickRagdolls, TickPostPhysics()) */
 	
+	TickStageInbound( deltaSeconds );
+	TickStageUpdate( deltaSeconds );
+	TickStageComputeTorques();
+	TickStageApplyTorques();
+}
+
+
+
+
+void AControlledRagdoll::TickPostPhysics( float deltaSeconds )
+{
+	TickStageReadSimulation();
+	TickStageOutbound();
+}
+
 
-	/* Relay data between the game engine and the remote controller, while calling additional tick functionality in between. */
 
-	// Read inbound data
-	PrepareRemoteControllerCommunication();
-	ReadFromRemoteController();
-	ReadFromSimulation();
 
+void AControlledRagdoll::TickDuringPhysics( float deltaSeconds )
+{
+	TickStageSendObservations();
+	TickStageReceiveCommands();
+}
+
+
+
+
+void AControlledRagdoll::TickStageInbound( float deltaSeconds )
+{
+	// Read inbound data from the remote controller, unless pipelined, in which case it has been received during the previous physics step. When replaying
+	// a trajectory, the physics step moves the kinematic bodies to the replayed pose, so that it is read back as if it had been simulated.
+	if( !this->LevelScriptActor->PipelineRemoteControllers )
+	{
+		PrepareRemoteControllerCommunication();
+	}
+	ApplyRemoteControllerCommands();
+	if( IsReplaying() ) TickReplay( deltaSeconds );
+}
+
+
+
+
+void AControlledRagdoll::TickStageUpdate( float deltaSeconds )
+{
 	// Call the tick hook (available for inherited C++ classes), then Super::Tick(), which runs this actor's Blueprint
-	TickHook( deltaSeconds );
-	Super::Tick( deltaSeconds );
-	ValidateBlueprintWritables();
+	{
+		RC_SCOPE_TICK_PHASE( STAT_RcTickHook, "TickHook" );
+		TickHook( deltaSeconds );
+	}
+	{
+		RC_SCOPE_TICK_PHASE( STAT_RcBlueprint, "Blueprint" );
+		Super::Tick( deltaSeconds );
+		ValidateBlueprintWritables();
+	}
+}
 
-	// Write outbound data
-	WriteToSimulation();
-	WriteToRemoteController();
-	FinalizeRemoteControllerCommunication();
 
 
-	/* Handle client-server pose replication */
 
-	// Store pose so that it can be replicated to client(s)
-	SendPose();
+void AControlledRagdoll::TickStageComputeTorques()
+{
+	// motor commands are not applied during replay
+	if( !IsReplaying() ) ComputeBodyTorques();
+}
+
+
+
 
+void AControlledRagdoll::TickStageApplyTorques()
+{
+	// motor commands are not applied during replay
+	if( !IsReplaying() ) ApplyBodyTorques();
+}
+
+
+
+
+void AControlledRagdoll::TickStageReadSimulation()
+{
+	ReadFromSimulation();
+}
+
+
+
+
+void AControlledRagdoll::TickStageOutbound()
+{
+	// Write outbound data, unless pipelined, in which case it is sent during the next physics step
+	if( !this->LevelScriptActor->PipelineRemoteControllers )
+	{
+		WriteToRemoteController();
+		FinalizeRemoteControllerCommunication();
+	}
 
 
+	/* Handle client-server pose replication */
+
+	// Store pose so that it can be replicated to client(s)
+	SendPose();
 
+	// Record the trajectory, if recording
+	RecordTrajectory();
+}
 
 
 
 
-	/* temporary test code */
+void AControlledRagdoll::TickStageSendObservations()
+{
+	// JointStates are not modified while the physics step is running: they are read after it, and only read before it
+	WriteToRemoteController();
+	FinalizeRemoteControllerCommunication();
+}
 
-	++tickCounter;
 
-	int32 jointInd = this->JointNames.Find( FName( "upperarm_l" ) );
 
-    // multiplication order verified (using joint upperarm_l, bone 2)
-	FQuat rf1global = this->JointStates[jointInd].BoneGlobalRotations[0] * this->JointStates[jointInd].RefFrameRotations[0];
-	FQuat rf2global = this->JointStates[jointInd].BoneGlobalRotations[1] * this->JointStates[jointInd].RefFrameRotations[1];
 
-	//this->JointStates[jointInd].Bodies[0]->AddTorque( 200000.f * sin( float( tickCounter ) / 20.f ) * rf1global.RotateVector( FVector( 0.f, 0.f, 1.f ) ) );
-	//this->JointStates[jointInd].Bodies[1]->AddTorque( -200000.f * sin( float( tickCounter ) / 20.f ) * rf1global.RotateVector( FVector( 0.f, 0.f, 1.f ) ) );
-	this->JointStates[jointInd].Bodies[0]->AddForce( FVector( 0.f, 0.f, 10.f ) );
+void AControlledRagdoll::TickStageReceiveCommands()
+{
+	PrepareRemoteControllerCommunication();
 }
 
 
@@ -269,6 +461,8 @@ void AControlledRagdoll::ValidateBlueprintWritables()
 
 void AControlledRagdoll::ReadFromSimulation()
 {
+	RC_SCOPE_TICK_PHASE( STAT_RcReadFromSimulation, "ReadFromSimulation" );
+
 	// init the error cleanup scope guard
 	auto sgError = MakeScopeGuard( [this](){
 		UE_LOG( LogRcCr, Error, TEXT( "(%s) Internal error! (scope guard 'sgError' was triggered)" ), TEXT( __FUNCTION__ ) );
@@ -319,8 +513,10 @@ void AControlledRagdoll::ReadFromSimulation()
 
 
 
-void AControlledRagdoll::WriteToSimulation()
+void AControlledRagdoll::ComputeBodyTorques()
 {
+	RC_SCOPE_TICK_PHASE( STAT_RcComputeTorques, "ComputeTorques" );
+
 	// init the error cleanup scope guard
 	auto sgError = MakeScopeGuard( [this](){
 		UE_LOG( LogRcCr, Error, TEXT( "(%s) Internal error! (scope guard 'sgError' was triggered)" ), TEXT( __FUNCTION__ ) );
@@ -333,6 +529,9 @@ void AControlledRagdoll::WriteToSimulation()
 	// check that the array size matches the skeleton's joint count
 	if( this->JointStates.Num() != this->SkeletalMeshComponent->Constraints.Num() ) return;
 
+	// torques are accumulated per body here, and applied by ApplyBodyTorques() or, if in a private physics scene, by ApplyPrivateSceneTorques()
+	this->BodyTorques.SetNumZeroed( this->SkeletalMeshComponent->Bodies.Num() );
+
 	// loop through joints
 	for( auto & jointState : this->JointStates )
 	{
@@ -346,8 +545,8 @@ void AControlledRagdoll::WriteToSimulation()
 		FVector torque0Global = referenceFrame0Global.RotateVector( jointState.MotorCommand );
 
 		// apply the torque to both bodies
-		jointState.Bodies[0]->AddTorque( torque0Global );
-		jointState.Bodies[1]->AddTorque( -torque0Global );
+		this->BodyTorques[jointState.Bodies[0]->InstanceBodyIndex] += torque0Global;
+		this->BodyTorques[jointState.Bodies[1]->InstanceBodyIndex] -= torque0Global;
 	}
 
 	// all good, release the error cleanup scope guard and return
@@ -358,13 +557,64 @@ void AControlledRagdoll::WriteToSimulation()
 
 
 
-void AControlledRagdoll::HandleNetworkError( const std::string & description )
+void AControlledRagdoll::ApplyBodyTorques()
 {
-	// drop the connection
-	RemoteControlSocket.reset();
+	RC_SCOPE_TICK_PHASE( STAT_RcApplyTorques, "ApplyTorques" );
 
-	// set InXmlStatus.status to pugi::status_no_document_element
+	// private scenes apply the torques on each substep, @see ApplyPrivateSceneTorques()
+	if( this->InPrivatePhysicsScene ) return;
+
+	// the bodies might have changed since the torques were computed
+	if( this->BodyTorques.Num() != this->SkeletalMeshComponent->Bodies.Num() ) return;
+
+	for( int body = 0; body < this->BodyTorques.Num(); ++body )
+	{
+		FVector & torque = this->BodyTorques[body];
+		if( torque.IsZero() ) continue;
+
+		this->SkeletalMeshComponent->Bodies[body]->AddTorque( torque );
+		torque = FVector::ZeroVector;
+	}
+}
+
+
+
+
+void AControlledRagdoll::ApplyPrivateSceneTorques()
+{
+	for( int body = 0; body < this->BodyTorques.Num(); ++body )
+	{
+		const FVector & torque = this->BodyTorques[body];
+		if( torque.IsZero() ) continue;
+
+		if( physx::PxRigidDynamic * pxBody = this->SkeletalMeshComponent->Bodies[body]->GetPxRigidDynamic() )
+		{
+			pxBody->addTorque( physx::PxVec3( torque.X, torque.Y, torque.Z ) );
+		}
+	}
+}
+
+
+
+
+void AControlledRagdoll::ClearPrivateSceneTorques()
+{
+	for( FVector & torque : this->BodyTorques )
+	{
+		torque = FVector::ZeroVector;
+	}
+}
+
+
+
+
+void AControlledRagdoll::HandleNetworkError( const std::string & description )
+{
+	// set InXmlStatus.status to pugi::status_no_document_element, then drop the connection
 	RemoteControlSocket->InXmlStatus.status = pugi::status_no_document_element;
+	RemoteControlSocket.reset();
+	this->RemoteControllerInputGathered = false;
+	this->DelayedRemoteControllerCommands.Clear();
 
 	// log
 	UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Remote controller connection failed: %s! Dropping the connection." ),
@@ -376,9 +626,24 @@ void AControlledRagdoll::HandleNetworkError( const std::string & description )
 
 void AControlledRagdoll::PrepareRemoteControllerCommunication()
 {
+	RC_SCOPE_TICK_PHASE( STAT_RcNetworkWait, "NetworkWait" );
+
 	// no-op if no remote controller
 	if( !this->RemoteControlSocket ) return;
 
+	// self-ticked and not pipelined: the first ragdoll to get here on this tick waits for the remote controllers of all self-ticked ragdolls at once
+	if( !this->BatchTicked && !this->LevelScriptActor->PipelineRemoteControllers )
+	{
+		this->LevelScriptActor->GatherSelfTickedRemoteControllerInputs();
+	}
+
+	// no-op if the document has already been received by PollRemoteController()
+	if( this->RemoteControllerInputGathered )
+	{
+		this->RemoteControllerInputGathered = false;
+		return;
+	}
+
 	// check that the connection is good
 	if( !RemoteControlSocket->IsGood() )
 	{
@@ -402,138 +667,851 @@ void AControlledRagdoll::PrepareRemoteControllerCommunication()
 
 
 
-void AControlledRagdoll::FinalizeRemoteControllerCommunication()
+bool AControlledRagdoll::PollRemoteController()
 {
-	// no-op if no remote controller or no inbound data is available (latter test is redundant, because PrepareRemoteControllerCommunication() drops the
-	// connection in such cases)
-	if( !RemoteControlSocket || RemoteControlSocket->InXmlStatus.status != pugi::status_ok ) return;
+	// done if no remote controller, or if already received
+	if( !this->RemoteControlSocket || this->RemoteControllerInputGathered ) return true;
 
-	// send OutXml
-	if( !RemoteControlSocket->PutXml() )
+	// check that the connection is good
+	if( !RemoteControlSocket->IsGood() )
 	{
-		// send failed
-		HandleNetworkError( "failed to send the xml response document" );
+		HandleNetworkError( "network level failure" );
+		return true;
+	}
+
+	// read whatever data is available, without blocking
+	RemoteControlSocket->SetBlocking( false );
+	if( RemoteControlSocket->GetXml() )
+	{
+		this->RemoteControllerInputGathered = true;
+		return true;
+	}
+
+	// a complete but malformed document will not get any better by waiting
+	if( RemoteControlSocket->InXmlStatus.status != pugi::status_no_document_element )
+	{
+		HandleNetworkError( "failed to read xml data from the socket (" + std::string( RemoteControlSocket->InXmlStatus.description() ) + ")" );
+		return true;
 	}
+
+	return false;
 }
 
 
 
 
-void AControlledRagdoll::ReadFromRemoteController()
+ByteStream * AControlledRagdoll::GetRemoteControllerStream() const
 {
-	// no-op if we have no valid data from remote
+	return this->RemoteControlSocket ? this->RemoteControlSocket->Stream.get() : nullptr;
+}
+
+
+
+
+void AControlledRagdoll::FinalizeRemoteControllerCommunication()
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcSendToRemoteController, "SendToRemoteController" );
+
+	// no-op if no remote controller or no inbound data is available (latter test is redundant, because PrepareRemoteControllerCommunication() drops the
+	// connection in such cases)
 	if( !RemoteControlSocket || RemoteControlSocket->InXmlStatus.status != pugi::status_ok ) return;
-	
-	UE_LOG( LogTemp, Log, TEXT( "GOT XML DATA" ) );
 
-	// handle all setter commands here and postpone getter handling to WriteToRemoteController()
-	if( pugi::xml_node node = RemoteControlSocket->InXml.child( "setActuators" ) )
+	// send the response written by WriteToRemoteController()
+	if( !RemoteControlSocket->PutOutText() )
 	{
-		//...
+		// send failed
+		HandleNetworkError( "failed to send the xml response document" );
 	}
 }
 
 
 
 
-void AControlledRagdoll::WriteToRemoteController()
+void AControlledRagdoll::ConnectWith( std::unique_ptr<XmlFSocket> socket )
 {
-	// no-op if we have no valid data from remote
-	if( !RemoteControlSocket || RemoteControlSocket->InXmlStatus.status != pugi::status_ok ) return;
+	this->DelayedRemoteControllerCommands.Clear();
+	this->RemoteControllerInputGathered = false;
+	this->ResponseNumJoints = INDEX_NONE;
 
-	// handle all getter commands here; getters were handled in ReadFromRemoteController()
-	if( RemoteControlSocket->InXml.child( "getSensors" ) )
-	{
-		//...
-	}
-	if( RemoteControlSocket->InXml.child( "getActuators" ) )
-	{
-		//...
-	}
+	IRemoteControllable::ConnectWith( std::move( socket ) );
 }
 
 
 
 
-void AControlledRagdoll::SendPose()
+void AControlledRagdoll::ApplyRemoteControllerCommands()
 {
-	// no-op if no remote players (i.e., if num_all_players - num_local_players <= 0)
-	check( GetWorld() && GetWorld()->GetGameState() && GetGameInstance() );
-	if( GetWorld()->GetGameState()->PlayerArray.Num() - GetGameInstance()->GetNumLocalPlayers() <= 0 ) return;
+	// no-op if no remote controller
+	if( !RemoteControlSocket ) return;
 
-	// cap update rate by 2 * RealtimeNetUpdateFrequency (UE level replication intervals are not accurate, have a safety margin so as to not miss any replications)
-	check( this->LevelScriptActor );
-	double currentTime = FPlatformTime::Seconds();
-	if( currentTime - this->lastSendPoseWallclockTime < 1.f / (2.f * this->LevelScriptActor->RealtimeNetUpdateFrequency) ) return;
-	this->lastSendPoseWallclockTime = currentTime;
+	bool received = RemoteControlSocket->InXmlStatus.status == pugi::status_ok;
 
-	// check the number of bones and resize the BoneStates array
-	int numBodies = this->SkeletalMeshComponent->Bodies.Num();
-	this->BoneStates.SetNum( numBodies );
+	// number of ticks the commands have to wait on top of the delay that the communication itself causes (ActionDelayTicks has been validated by the
+	// LevelScriptActor to be at least the latter)
+	int32 queueLength = this->LevelScriptActor->ActionDelayTicks - (this->LevelScriptActor->PipelineRemoteControllers ? 1 : 0);
+	check( queueLength >= 0 );
 
-	// loop through bones and write out state data
-	for( int body = 0; body < numBodies; ++body )
+	// not delayed: handle the received document right away
+	if( queueLength == 0 )
 	{
-		physx::PxRigidDynamic * pxBody = this->SkeletalMeshComponent->Bodies[body]->GetPxRigidDynamic();
-		if( !pxBody )
-		{
-			UE_LOG( LogRcCr, Error, TEXT( "(%s) GetPxRididDynamic() failed for body %d!" ), TEXT( __FUNCTION__ ), body );
-			return;
-		}
+		if( received ) ReadFromRemoteController( RemoteControlSocket->InXml );
+		return;
+	}
 
-		// Replicate pose
-		this->BoneStates[body].GetPxTransform() = pxBody->getGlobalPose();
-		this->BoneStates[body].GetPxLinearVelocity() = pxBody->getLinearVelocity();
-		this->BoneStates[body].GetPxAngularVelocity() = pxBody->getAngularVelocity();
+	// delayed: queue a copy of the latest document (a place in the queue even if none was received, so that each document waits for exactly queueLength
+	// ticks), and handle the one that has become due, if any
+	if( const pugi::xml_document * due = this->DelayedRemoteControllerCommands.Push( received ? &RemoteControlSocket->InXml : nullptr, queueLength ) )
+	{
+		ReadFromRemoteController( *due );
 	}
 }
 
 
 
 
-void AControlledRagdoll::ReceivePose()
+void AControlledRagdoll::ReadFromRemoteController( const pugi::xml_document & inXml )
 {
-	int numBodies = this->BoneStates.Num();
+	RC_SCOPE_TICK_PHASE( STAT_RcReadFromRemoteController, "ReadFromRemoteController" );
 
-	// Verify that the skeletal meshes have the same number of bones (for example, one might not be initialized yet, or replication might have not yet started).
-	if( numBodies != this->SkeletalMeshComponent->Bodies.Num() )
+	// the commands are the fields of the root struct (<RemoteCall> from mat2xml)
+	pugi::xml_node commands = inXml.document_element();
+
+	// handle all setter commands here and postpone getter handling to WriteToRemoteController()
+	if( pugi::xml_node node = commands.child( "setActuators" ) )
 	{
-		UE_LOG( LogRcCr, Error, TEXT( "(%s) Number of bones do not match. Cannot replicate pose!" ), TEXT( __FUNCTION__ ) );
-		return;
+		// motor commands as an MbML matrix [numJoints 3], one row per joint, in column-major order
+		int32 numJoints = this->JointStates.Num();
+		int rows = 0, cols = 0;
+		if( std::sscanf( node.attribute( "size" ).value(), "%d %d", &rows, &cols ) != 2 || rows != numJoints || cols != 3 )
+		{
+			UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) setActuators: expected a matrix of size '%d 3', got '%s'!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName(),
+				numJoints, UTF8_TO_TCHAR( node.attribute( "size" ).value() ) );
+		}
+		else
+		{
+			const char * text = node.text().get();
+			for( int col = 0; col < cols && text; ++col )
+			{
+				for( int row = 0; row < rows && text; ++row )
+				{
+					char * end;
+					float value = std::strtof( text, &end );
+					if( end == text )
+					{
+						UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) setActuators: too few values!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName() );
+						text = nullptr;
+						break;
+					}
+					this->JointStates[row].MotorCommand[col] = value;
+					text = end;
+				}
+			}
+		}
 	}
 
-	// Check for float binary compatibility (eg endianness) and that the PhysX data sizes match. Assume that UE replicates floats always correctly.
-	float ourInterpretationOfDeadbeef;
-	std::memcpy( &ourInterpretationOfDeadbeef, "\xde\xad\xbe\xef", sizeof(ourInterpretationOfDeadbeef) );
-	if( std::abs( (this->ServerInterpretationOfDeadbeef / ourInterpretationOfDeadbeef) - 1.f ) > 1e-6f
-		|| (this->BoneStates.Num() > 0 && !this->BoneStates[0].DoDataSizesMatch()) )
+	// snapshot commands: the content is the slot name. Save before restoring, so that both can be combined in a single document.
+	if( pugi::xml_node node = commands.child( "snapshot" ) )
 	{
-		UE_LOG( LogRcCr, Error, TEXT( "(%s) Floats are not binary compatible or bone state data sizes do not match. Cannot replicate pose!" ), TEXT( __FUNCTION__ ) );
-		return;
+		if( !SaveSnapshot( FName( node.text().get() ) ) )
+		{
+			UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Failed to save snapshot '%s'!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName(), UTF8_TO_TCHAR( node.text().get() ) );
+		}
 	}
-
-	// Loop through bones and apply received replication data to each
-	for( int body = 0; body < numBodies; ++body )
+	if( pugi::xml_node node = commands.child( "restore" ) )
 	{
-		physx::PxRigidDynamic * pxBody = this->SkeletalMeshComponent->Bodies[body]->GetPxRigidDynamic();
-		if( !pxBody )
+		if( !RestoreSnapshot( FName( node.text().get() ) ) )
 		{
-			UE_LOG( LogRcCr, Error, TEXT( "(%s) GetPxRididDynamic() failed for body %d!" ), TEXT( __FUNCTION__ ), body );
-			return;
+			UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Failed to restore snapshot '%s'!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName(), UTF8_TO_TCHAR( node.text().get() ) );
 		}
+	}
+
+	// trajectory recording commands: the content of startRecording is the file name
+	if( commands.child( "stopRecording" ) )
+	{
+		StopRecording();
+	}
+	if( pugi::xml_node node = commands.child( "startRecording" ) )
+	{
+		StartRecording( UTF8_TO_TCHAR( node.text().get() ) );
+	}
 
-		// Replicate pose
-		pxBody->setGlobalPose( this->BoneStates[body].GetPxTransform() );
-		pxBody->setLinearVelocity( this->BoneStates[body].GetPxLinearVelocity() );
-		pxBody->setAngularVelocity( this->BoneStates[body].GetPxAngularVelocity() );
+	// trajectory replay commands: the content of startReplay is the file name, with optional speed and loop attributes
+	if( commands.child( "stopReplay" ) )
+	{
+		StopReplay();
+	}
+	if( pugi::xml_node node = commands.child( "startReplay" ) )
+	{
+		StartReplay( UTF8_TO_TCHAR( node.text().get() ), node.attribute( "speed" ).as_float( 1.f ), node.attribute( "loop" ).as_bool( false ) );
+	}
+	if( pugi::xml_node node = commands.child( "seekReplay" ) )
+	{
+		SeekReplay( node.text().as_double() );
+	}
+	if( pugi::xml_node node = commands.child( "replaySpeed" ) )
+	{
+		SetReplaySpeed( node.text().as_float( 1.f ) );
 	}
 }
 
 
 
 
-void AControlledRagdoll::HandleBoneStatesReplicationEvent()
+void AControlledRagdoll::WriteToRemoteController()
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcWriteToRemoteController, "WriteToRemoteController" );
+
+	// no-op if we have no valid data from remote
+	if( !RemoteControlSocket || RemoteControlSocket->InXmlStatus.status != pugi::status_ok ) return;
+
+	// handle all getter commands here; setters were handled in ReadFromRemoteController()
+	pugi::xml_node commands = RemoteControlSocket->InXml.document_element();
+	bool getSensors = !commands.child( "getSensors" ).empty();
+	bool getActuators = !commands.child( "getActuators" ).empty();
+	int32 numJoints = this->JointStates.Num();
+
+	// matrices are written as text unless the remote controller asks for base64 (@see MbmlEncoding)
+	MbmlEncoding encoding = std::strcmp( commands.child_value( "responseEncoding" ), "base64" ) == 0 ? MbmlBase64Encoding : MbmlTextEncoding;
+
+	// (re)build the response template if the structure of the response has changed; usually only for the first document of a connection
+	if( getSensors != this->ResponseHasSensors || getActuators != this->ResponseHasActuators || encoding != this->ResponseEncoding ||
+		numJoints != this->ResponseNumJoints )
+	{
+		this->ResponseTemplate.Text.clear();
+		MbmlWriter writer( this->ResponseTemplate.Text );
+		writer.BeginStruct( "RemoteResponse" );
+		if( getSensors )
+		{
+			writer.BeginStruct( "sensors" );
+			this->ResponseJointAngles = writer.AddMatrixSlot( "jointAngles", numJoints, 3, encoding );
+			writer.EndStruct();
+		}
+		if( getActuators )
+		{
+			writer.BeginStruct( "actuators" );
+			this->ResponseMotorCommands = writer.AddMatrixSlot( "motorCommands", numJoints, 3, encoding );
+			writer.EndStruct();
+		}
+		writer.EndStruct();
+		check( writer.IsComplete() );
+
+		this->ResponseHasSensors = getSensors;
+		this->ResponseHasActuators = getActuators;
+		this->ResponseEncoding = encoding;
+		this->ResponseNumJoints = numJoints;
+	}
+
+	// update the values in place
+	if( getSensors )
+	{
+		this->ResponseTemplate.SetMatrix( this->ResponseJointAngles, [this]( int row, int col ) { return this->JointStates[row].JointAngles[col]; } );
+	}
+	if( getActuators )
+	{
+		this->ResponseTemplate.SetMatrix( this->ResponseMotorCommands, [this]( int row, int col ) { return this->JointStates[row].MotorCommand[col]; } );
+	}
+
+	// copy into the socket's outbound buffer
+	RemoteControlSocket->BeginOutText() += this->ResponseTemplate.Text;
+}
+
+
+
+
+bool AControlledRagdoll::SaveSnapshot( FName slot )
+{
+	// find or create the slot. Existing arrays keep their allocations, so repeated saves into the same slot do not allocate.
+	FRagdollSnapshot & snapshot = this->Snapshots.FindOrAdd( slot );
+
+	// store the body states
+	if( !ReadBodyStates( snapshot.Bodies ) ) return false;
+
+	// store the joint controller state
+	int numJoints = this->JointStates.Num();
+	snapshot.MotorCommands.SetNum( numJoints, false );
+	for( int joint = 0; joint < numJoints; ++joint )
+	{
+		snapshot.MotorCommands[joint] = this->JointStates[joint].MotorCommand;
+	}
+
+	return true;
+}
+
+
+
+
+bool AControlledRagdoll::RestoreSnapshot( FName slot )
+{
+	// find the slot
+	const FRagdollSnapshot * snapshot = this->Snapshots.Find( slot );
+	if( !snapshot ) return false;
+
+	// verify that the snapshot matches the current skeleton (JointStates might have been emptied due to errors since the snapshot was taken)
+	if( snapshot->MotorCommands.Num() != this->JointStates.Num() )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s) Snapshot '%s' does not match the current skeleton!" ), TEXT( __FUNCTION__ ), *slot.ToString() );
+		return false;
+	}
+
+	// a restored state is simulated from: stop replaying first, so that the bodies are dynamic again
+	StopReplay();
+
+	// restore the body states (checks the body count)
+	if( !WriteBodyStates( snapshot->Bodies ) ) return false;
+
+	// restore the joint controller state
+	for( int joint = 0; joint < this->JointStates.Num(); ++joint )
+	{
+		this->JointStates[joint].MotorCommand = snapshot->MotorCommands[joint];
+	}
+
+	return true;
+}
+
+
+
+
+bool AControlledRagdoll::DeleteSnapshot( FName slot )
+{
+	return this->Snapshots.Remove( slot ) > 0;
+}
+
+
+
+
+bool AControlledRagdoll::StartRecording( const FString & fileName )
+{
+	StopRecording();
+
+	// only plain file names are accepted (the name might come from a remote controller)
+	FString cleanFileName = FPaths::GetCleanFilename( fileName );
+	if( cleanFileName.IsEmpty() || cleanFileName != fileName )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Invalid trajectory file name '%s'!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName(), *fileName );
+		return false;
+	}
+
+	FString directory = FPaths::Combine( *FPaths::GameSavedDir(), TEXT( "Trajectories" ) );
+	IFileManager::Get().MakeDirectory( *directory, true );
+	FString path = FPaths::Combine( *directory, *cleanFileName );
+
+	this->Recorder = TrajectoryWriter::Create( path, this->JointNames, this->SkeletalMeshComponent->Bodies.Num() );
+	if( !this->Recorder ) return false;
+
+	UE_LOG( LogRcCr, Log, TEXT( "(%s, %s) Recording trajectory into '%s'." ), TEXT( __FUNCTION__ ), *GetHumanReadableName(), *path );
+	return true;
+}
+
+
+
+
+void AControlledRagdoll::StopRecording()
+{
+	// the writer flushes and closes the file on destruction
+	this->Recorder.reset();
+}
+
+
+
+
+void AControlledRagdoll::RecordTrajectory()
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcRecordTrajectory, "RecordTrajectory" );
+
+	if( !this->Recorder ) return;
+
+	// stop if the skeleton does not match the file anymore (JointStates is emptied on errors)
+	const TrajectoryRecordLayout & layout = this->Recorder->GetLayout();
+	if( this->JointStates.Num() != layout.NumJoints || this->SkeletalMeshComponent->Bodies.Num() != layout.NumBodies )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Skeleton does not match the trajectory file anymore! Recording stopped." ), TEXT( __FUNCTION__ ),
+			*GetHumanReadableName() );
+		StopRecording();
+		return;
+	}
+
+	// refresh the body states, unless SendPose() already did so during this tick
+	if( this->BodyStatesBufferFrame != GFrameCounter && ReadAwakeBodyStates( this->BodyStatesBuffer ) == INDEX_NONE ) return;
+
+	uint8 * record = this->Recorder->AppendRecord();
+	if( !record )
+	{
+		StopRecording();
+		return;
+	}
+
+	// fill the record. @see TrajectoryRecordLayout
+	uint64 frame = GFrameCounter;
+	double time = GetWorld()->GetTimeSeconds();
+	FMemory::Memcpy( record + TrajectoryRecordLayout::FrameOffset, &frame, sizeof( frame ) );
+	FMemory::Memcpy( record + TrajectoryRecordLayout::TimeOffset, &time, sizeof( time ) );
+
+	float * jointAngles = (float *)(record + TrajectoryRecordLayout::JointAnglesOffset);
+	float * motorCommands = (float *)(record + layout.GetMotorCommandsOffset());
+	for( const FJointState & jointState : this->JointStates )
+	{
+		for( int32 i = 0; i < 3; ++i )
+		{
+			*jointAngles++ = jointState.JointAngles[i];
+			*motorCommands++ = jointState.MotorCommand[i];
+		}
+	}
+
+	float * bodies = (float *)(record + layout.GetBodiesOffset());
+	for( int32 body = 0; body < layout.NumBodies; ++body )
+	{
+		const physx::PxTransform & pose = this->BodyStatesBuffer.Poses[body];
+		const physx::PxVec3 & linearVelocity = this->BodyStatesBuffer.LinearVelocities[body];
+		const physx::PxVec3 & angularVelocity = this->BodyStatesBuffer.AngularVelocities[body];
+		const float values[TrajectoryRecordLayout::FloatsPerBody] = {
+			pose.p.x, pose.p.y, pose.p.z, pose.q.x, pose.q.y, pose.q.z, pose.q.w,
+			linearVelocity.x, linearVelocity.y, linearVelocity.z, angularVelocity.x, angularVelocity.y, angularVelocity.z };
+		FMemory::Memcpy( bodies, values, sizeof( values ) );
+		bodies += TrajectoryRecordLayout::FloatsPerBody;
+	}
+}
+
+
+
+
+bool AControlledRagdoll::StartReplay( const FString & fileName, float speed, bool loop )
+{
+	StopReplay();
+
+	// only plain file names are accepted (the name might come from a remote controller)
+	FString cleanFileName = FPaths::GetCleanFilename( fileName );
+	if( cleanFileName.IsEmpty() || cleanFileName != fileName )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Invalid trajectory file name '%s'!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName(), *fileName );
+		return false;
+	}
+	FString path = FPaths::Combine( *FPaths::GameSavedDir(), TEXT( "Trajectories" ), *cleanFileName );
+
+	std::unique_ptr<TrajectoryReader> replay = TrajectoryReader::Open( path );
+	if( !replay ) return false;
+
+	// the recording must match our skeleton
+	if( replay->GetJointNames() != this->JointNames || replay->GetLayout().NumBodies != this->SkeletalMeshComponent->Bodies.Num() )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s, %s) Trajectory file '%s' was recorded with a different skeleton!" ), TEXT( __FUNCTION__ ), *GetHumanReadableName(),
+			*path );
+		return false;
+	}
+
+	// make the bodies kinematic, so that they follow the recorded poses instead of being simulated
+	TArray<physx::PxRigidDynamic *, TInlineAllocator<64>> pxBodies;
+	if( !GetPxBodies( pxBodies ) ) return false;
+	this->ReplayBodyWasKinematic.SetNum( pxBodies.Num() );
+	for( int body = 0; body < pxBodies.Num(); ++body )
+	{
+		this->ReplayBodyWasKinematic[body] = pxBodies[body]->getRigidBodyFlags().isSet( physx::PxRigidBodyFlag::eKINEMATIC );
+		pxBodies[body]->setRigidBodyFlag( physx::PxRigidBodyFlag::eKINEMATIC, true );
+	}
+
+	this->Replay = std::move( replay );
+	this->ReplayTime = 0.0;
+	this->ReplaySpeed = speed;
+	this->ReplayLooping = loop;
+	this->ReplayTeleport = true;
+	this->ReplayFinished = false;
+	this->ReplayBodyStates[0].SetNum( 0 );   // nothing replayed yet
+
+	UE_LOG( LogRcCr, Log, TEXT( "(%s, %s) Replaying trajectory '%s' (%llu records)." ), TEXT( __FUNCTION__ ), *GetHumanReadableName(), *path,
+		this->Replay->GetNumRecords() );
+	return true;
+}
+
+
+
+
+void AControlledRagdoll::StopReplay()
+{
+	if( !this->Replay ) return;
+	this->Replay.reset();
+
+	// restore the simulation state of the bodies, and let them continue with the velocities of the last replayed state (the bodies might be gone already
+	// at EndPlay(), in which case there is nothing to restore)
+	TArray<physx::PxRigidDynamic *, TInlineAllocator<64>> pxBodies;
+	if( !GetPxBodies( pxBodies ) || pxBodies.Num() != this->ReplayBodyWasKinematic.Num() ) return;
+	bool hasVelocities = this->ReplayBodyStates[0].Num() == pxBodies.Num();
+	for( int body = 0; body < pxBodies.Num(); ++body )
+	{
+		if( this->ReplayBodyWasKinematic[body] ) continue;
+
+		pxBodies[body]->setRigidBodyFlag( physx::PxRigidBodyFlag::eKINEMATIC, false );
+		if( hasVelocities )
+		{
+			pxBodies[body]->setLinearVelocity( this->ReplayBodyStates[0].LinearVelocities[body] );
+			pxBodies[body]->setAngularVelocity( this->ReplayBodyStates[0].AngularVelocities[body] );
+		}
+	}
+}
+
+
+
+
+void AControlledRagdoll::SeekReplay( double time )
+{
+	if( !this->Replay ) return;
+
+	double duration = this->Replay->GetTime( this->Replay->GetNumRecords() - 1 ) - this->Replay->GetTime( 0 );
+	this->ReplayTime = FMath::Clamp( time, 0.0, duration );
+	this->ReplayTeleport = true;
+	this->ReplayFinished = false;
+}
+
+
+
+
+void AControlledRagdoll::TickReplay( float deltaSeconds )
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcReplay, "Replay" );
+
+	check( this->Replay );
+
+	// the last record has been played on the previous tick: stop, and let the ragdoll continue from there
+	if( this->ReplayFinished )
+	{
+		UE_LOG( LogRcCr, Log, TEXT( "(%s, %s) Trajectory replay finished." ), TEXT( __FUNCTION__ ), *GetHumanReadableName() );
+		StopReplay();
+		return;
+	}
+
+	const TrajectoryReader & replay = *this->Replay;
+	uint64 lastRecord = replay.GetNumRecords() - 1;
+	double startTime = replay.GetTime( 0 );
+	double duration = replay.GetTime( lastRecord ) - startTime;
+
+	// interpolate between the bracketing records
+	uint64 record = replay.FindRecord( startTime + this->ReplayTime );
+	replay.ReadBodyStates( record, this->ReplayBodyStates[0] );
+	if( record < lastRecord )
+	{
+		double recordTime = replay.GetTime( record );
+		double nextRecordTime = replay.GetTime( record + 1 );
+		if( nextRecordTime > recordTime )
+		{
+			replay.ReadBodyStates( record + 1, this->ReplayBodyStates[1] );
+			float t = float( (startTime + this->ReplayTime - recordTime) / (nextRecordTime - recordTime) );
+			FBodyStates::Lerp( this->ReplayBodyStates[0], this->ReplayBodyStates[1], FMath::Clamp( t, 0.f, 1.f ), this->ReplayBodyStates[0] );
+		}
+	}
+
+	// move to the pose during the coming physics step (or jump there), and expose the recorded motor commands
+	WriteKinematicTargets( this->ReplayBodyStates[0], this->ReplayTeleport );
+	this->ReplayTeleport = false;
+	for( int32 joint = 0; joint < this->JointStates.Num(); ++joint )
+	{
+		this->JointStates[joint].MotorCommand = replay.GetMotorCommand( record, joint );
+	}
+
+	// advance for the next tick, and wrap around or finish at the ends
+	double playedTime = this->ReplayTime;
+	this->ReplayTime += double( deltaSeconds ) * this->ReplaySpeed;
+	if( this->ReplayTime < 0.0 || this->ReplayTime > duration )
+	{
+		if( this->ReplayLooping && duration > 0.0 )
+		{
+			this->ReplayTime = std::fmod( this->ReplayTime, duration );
+			if( this->ReplayTime < 0.0 ) this->ReplayTime += duration;
+			this->ReplayTeleport = true;
+		}
+		else
+		{
+			// play the end itself on the next tick, then finish
+			this->ReplayTime = FMath::Clamp( this->ReplayTime, 0.0, duration );
+			this->ReplayFinished = this->ReplayTime == playedTime;
+		}
+	}
+}
+
+
+
+
+bool AControlledRagdoll::ReadBodyStates( FBodyStates & bodyStates )
+{
+	int numBodies = this->SkeletalMeshComponent->Bodies.Num();
+	bodyStates.SetNum( numBodies );
+
+	// loop through bodies and read their state
+	for( int body = 0; body < numBodies; ++body )
+	{
+		physx::PxRigidDynamic * pxBody = this->SkeletalMeshComponent->Bodies[body]->GetPxRigidDynamic();
+		if( !pxBody )
+		{
+			UE_LOG( LogRcCr, Error, TEXT( "(%s) GetPxRididDynamic() failed for body %d!" ), TEXT( __FUNCTION__ ), body );
+			return false;
+		}
+
+		bodyStates.Poses[body] = pxBody->getGlobalPose();
+		bodyStates.LinearVelocities[body] = pxBody->getLinearVelocity();
+		bodyStates.AngularVelocities[body] = pxBody->getAngularVelocity();
+	}
+
+	return true;
+}
+
+
+
+
+int32 AControlledRagdoll::ReadAwakeBodyStates( FBodyStates & bodyStates )
+{
+	int numBodies = this->SkeletalMeshComponent->Bodies.Num();
+
+	// the skeleton changed (or this is the first call): everything has to be read
+	if( bodyStates.Num() != numBodies || this->SendPoseSleepingBodies.Num() != numBodies )
+	{
+		bodyStates.SetNum( numBodies );
+		this->SendPoseSleepingBodies.Init( false, numBodies );
+	}
+
+	// loop through bodies and read the state of those that are awake, or that have fallen asleep since the last call
+	int32 numRead = 0;
+	for( int body = 0; body < numBodies; ++body )
+	{
+		physx::PxRigidDynamic * pxBody = this->SkeletalMeshComponent->Bodies[body]->GetPxRigidDynamic();
+		if( !pxBody )
+		{
+			UE_LOG( LogRcCr, Error, TEXT( "(%s) GetPxRididDynamic() failed for body %d!" ), TEXT( __FUNCTION__ ), body );
+			this->SendPoseSleepingBodies.Reset();
+			return INDEX_NONE;
+		}
+
+		bool sleeping = pxBody->isSleeping();
+		if( sleeping && this->SendPoseSleepingBodies[body] ) continue;
+		this->SendPoseSleepingBodies[body] = sleeping;
+
+		bodyStates.Poses[body] = pxBody->getGlobalPose();
+		bodyStates.LinearVelocities[body] = pxBody->getLinearVelocity();
+		bodyStates.AngularVelocities[body] = pxBody->getAngularVelocity();
+		++numRead;
+	}
+
+	this->BodyStatesBufferFrame = GFrameCounter;
+	return numRead;
+}
+
+
+
+
+bool AControlledRagdoll::GetPxBodies( TArray<physx::PxRigidDynamic *, TInlineAllocator<64>> & pxBodies )
+{
+	int numBodies = this->SkeletalMeshComponent->Bodies.Num();
+	pxBodies.SetNum( numBodies );
+	for( int body = 0; body < numBodies; ++body )
+	{
+		pxBodies[body] = this->SkeletalMeshComponent->Bodies[body]->GetPxRigidDynamic();
+		if( !pxBodies[body] )
+		{
+			UE_LOG( LogRcCr, Error, TEXT( "(%s) GetPxRididDynamic() failed for body %d!" ), TEXT( __FUNCTION__ ), body );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+
+bool AControlledRagdoll::WriteBodyStates( const FBodyStates & bodyStates )
+{
+	int numBodies = bodyStates.Num();
+
+	// Verify that the skeletal meshes have the same number of bones (for example, one might not be initialized yet, or replication might have not yet started).
+	if( numBodies != this->SkeletalMeshComponent->Bodies.Num() )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s) Number of bones do not match. Cannot apply body states!" ), TEXT( __FUNCTION__ ) );
+		return false;
+	}
+
+	// fetch all PhysX bodies first, so that we either write everything or nothing
+	TArray<physx::PxRigidDynamic *, TInlineAllocator<64>> pxBodies;
+	if( !GetPxBodies( pxBodies ) ) return false;
+
+	// write body states. Set the pose first: setting the global pose causes PhysX to ignore velocities set before it during the same tick.
+	for( int body = 0; body < numBodies; ++body )
+	{
+		pxBodies[body]->setGlobalPose( bodyStates.Poses[body] );
+		pxBodies[body]->setLinearVelocity( bodyStates.LinearVelocities[body] );
+		pxBodies[body]->setAngularVelocity( bodyStates.AngularVelocities[body] );
+	}
+
+	return true;
+}
+
+
+
+
+bool AControlledRagdoll::WriteKinematicTargets( const FBodyStates & bodyStates, bool teleport )
+{
+	// Verify that the skeletal meshes have the same number of bones
+	if( bodyStates.Num() != this->SkeletalMeshComponent->Bodies.Num() )
+	{
+		UE_LOG( LogRcCr, Error, TEXT( "(%s) Number of bones do not match. Cannot apply body states!" ), TEXT( __FUNCTION__ ) );
+		return false;
+	}
+
+	// fetch all PhysX bodies first, so that we either write everything or nothing
+	TArray<physx::PxRigidDynamic *, TInlineAllocator<64>> pxBodies;
+	if( !GetPxBodies( pxBodies ) ) return false;
+
+	// velocities cannot be set on kinematic bodies: moving to a target gives them the velocities of the motion, teleporting leaves them at rest
+	for( int body = 0; body < pxBodies.Num(); ++body )
+	{
+		if( teleport )
+		{
+			pxBodies[body]->setGlobalPose( bodyStates.Poses[body] );
+		}
+		else
+		{
+			pxBodies[body]->setKinematicTarget( bodyStates.Poses[body] );
+		}
+	}
+
+	return true;
+}
+
+
+
+
+void AControlledRagdoll::SendPose()
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcSendPose, "SendPose" );
+
+	// no-op if no remote players (i.e., if num_all_players - num_local_players <= 0)
+	check( GetWorld() && GetWorld()->GetGameState() && GetGameInstance() );
+	if( GetWorld()->GetGameState()->PlayerArray.Num() - GetGameInstance()->GetNumLocalPlayers() <= 0 ) return;
+
+	// Cap update rate. With property replication, cap by 2 * RealtimeNetUpdateFrequency (UE level replication intervals are not accurate, have a safety
+	// margin so as to not miss any replications). RPCs are sent as they are called, so cap those by RealtimeNetUpdateFrequency.
+	check( this->LevelScriptActor );
+	bool useMulticast = this->LevelScriptActor->PoseReplicationMode == EPoseReplicationMode::UnreliableMulticast;
+	float maxSendRate = useMulticast ? this->LevelScriptActor->RealtimeNetUpdateFrequency : 2.f * this->LevelScriptActor->RealtimeNetUpdateFrequency;
+	double currentTime = FPlatformTime::Seconds();
+	if( currentTime - this->lastSendPoseWallclockTime < 1.f / maxSendRate ) return;
+	this->lastSendPoseWallclockTime = currentTime;
+
+	// read the states of the bodies that are awake. If the whole ragdoll sleeps, then nothing can have changed since the last call.
+	int32 numRead = ReadAwakeBodyStates( this->BodyStatesBuffer );
+	if( numRead == INDEX_NONE ) return;
+
+	if( useMulticast )
+	{
+		// Skip the packet if no body has changed beyond the thresholds since the last packet. Packets are unreliable, so keep re-sending an unchanged
+		// pose at a low rate, so that clients that missed the last packet still converge to the resting pose.
+		int32 numBodies = this->BodyStatesBuffer.Num();
+		bool changed = this->SentPosePacketStates.Num() != numBodies;
+		for( int32 body = 0; body < numBodies && numRead > 0 && !changed; ++body )
+		{
+			changed = this->BodyStatesBuffer.HasChanged( body, this->SentPosePacketStates, this->LevelScriptActor->PoseReplicationPositionThreshold,
+				this->LevelScriptActor->PoseReplicationRotationThreshold, this->LevelScriptActor->RealtimeNetUpdateFrequency );
+		}
+		if( !changed && currentTime - this->lastPosePacketWallclockTime < POSE_IDLE_RESEND_INTERVAL ) return;
+		this->lastPosePacketWallclockTime = currentTime;
+		this->SentPosePacketStates = this->BodyStatesBuffer;
+
+		// pack a full, timestamped pose relative to the actor root and send it out
+		FPosePacket packet;
+		packet.Pack( ++this->PosePacketSequence, GetWorld()->GetTimeSeconds(), GetActorLocation(), this->BodyStatesBuffer );
+		MulticastPose( packet );
+	}
+	else if( numRead > 0 )
+	{
+		// mark the bones that have changed enough for replication, and timestamp the update
+		int32 numDirty = this->ReplicatedPose.Update( this->ReplicatedPoseOrigin, GetActorLocation(), this->BodyStatesBuffer,
+			this->LevelScriptActor->PoseReplicationPositionThreshold, this->LevelScriptActor->PoseReplicationRotationThreshold,
+			this->LevelScriptActor->RealtimeNetUpdateFrequency );
+		if( numDirty > 0 ) this->ReplicatedPoseTimestamp = GetWorld()->GetTimeSeconds();
+	}
+}
+
+
+
+
+void AControlledRagdoll::ReceivePose()
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcReceivePose, "ReceivePose" );
+
+	check( this->LevelScriptActor );
+
+	if( UsePoseJitterBuffer() )
+	{
+		// play out the buffered poses at the current time. Sampling fails if the buffer is empty or if the output would not change: PhysX is not touched then.
+		if( !this->ReceivedPoses.Sample( GetWorld()->GetTimeSeconds(), this->LevelScriptActor->PoseJitterBufferDelay,
+			this->LevelScriptActor->PoseMaxExtrapolationTime, this->BodyStatesBuffer ) ) return;
+	}
+	else
+	{
+		float serverTimestamp;
+		if( !UnpackReceivedPose( serverTimestamp ) ) return;
+	}
+
+	// apply
+	WriteBodyStates( this->BodyStatesBuffer );
+}
+
+
+
+
+bool AControlledRagdoll::UnpackReceivedPose( float & serverTimestamp )
+{
+	// dequantize the latest pose from the active channel. Unpacking fails until a complete pose has been received.
+	check( this->LevelScriptActor );
+	if( this->LevelScriptActor->PoseReplicationMode == EPoseReplicationMode::UnreliableMulticast )
+	{
+		serverTimestamp = this->ReceivedPosePacket.Timestamp;
+		return this->ReceivedPosePacket.Unpack( this->BodyStatesBuffer );
+	}
+	else
+	{
+		serverTimestamp = this->ReplicatedPoseTimestamp;
+		return this->ReplicatedPose.Unpack( this->ReplicatedPoseOrigin, this->SkeletalMeshComponent->Bodies.Num(), this->BodyStatesBuffer );
+	}
+}
+
+
+
+
+bool AControlledRagdoll::UsePoseJitterBuffer() const
+{
+	check( this->LevelScriptActor );
+	return this->LevelScriptActor->PoseJitterBufferDelay > 0.f && !this->LevelScriptActor->PoseReplicationDoClientsidePrediction;
+}
+
+
+
+
+void AControlledRagdoll::MulticastPose_Implementation( const FPosePacket & packet )
 {
+	// the server sends to itself too if it is a listen server, ignore that
+	if( HasAuthority() ) return;
+
+	// drop stale and duplicate packets (the first packet is always accepted)
+	if( this->ReceivedPosePacket.Bones.Num() > 0 && !packet.IsNewerThan( this->PosePacketSequence ) ) return;
+	this->PosePacketSequence = packet.Sequence;
+	this->ReceivedPosePacket = packet;
+
+	// handle like a property replication event
+	HandleReplicatedPoseEvent();
+}
+
+
+
+
+void AControlledRagdoll::HandleReplicatedPoseEvent()
+{
+	// if the jitter buffer is in use, then just buffer the new pose; it is played out in Tick()
+	if( UsePoseJitterBuffer() )
+	{
+		float serverTimestamp;
+		if( UnpackReceivedPose( serverTimestamp ) )
+		{
+			this->ReceivedPoses.Push( serverTimestamp, GetWorld()->GetTimeSeconds(), this->BodyStatesBuffer );
+		}
+		return;
+	}
+
 	// if client-side prediction is on, then update the pose here, so as to do it only when a new pose has been received. Otherwise update it in Tick().
 	// @see Tick()
 	check( this->LevelScriptActor );
@@ -542,3 +1520,43 @@ void AControlledRagdoll::HandleBoneStatesReplicationEvent()
 		ReceivePose();
 	}
 }
+
+
+
+
+void FControlledRagdollPostPhysicsTickFunction::ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	const FGraphEventRef & MyCompletionGraphEvent )
+{
+	if( this->Target && !this->Target->IsPendingKill() )
+	{
+		this->Target->TickPostPhysics( DeltaTime );
+	}
+}
+
+
+
+
+FString FControlledRagdollPostPhysicsTickFunction::DiagnosticMessage()
+{
+	return TEXT( "AControlledRagdoll[TickPostPhysics]" );
+}
+
+
+
+
+void FControlledRagdollDuringPhysicsTickFunction::ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	const FGraphEventRef & MyCompletionGraphEvent )
+{
+	if( this->Target && !this->Target->IsPendingKill() )
+	{
+		this->Target->TickDuringPhysics( DeltaTime );
+	}
+}
+
+
+
+
+FString FControlledRagdollDuringPhysicsTickFunction::DiagnosticMessage()
+{
+	return TEXT( "AControlledRagdoll[TickDuringPhysics]" );
+}
@@ -5,11 +5,17 @@
 #include "GameFramework/Actor.h"
 #include "RCLevelScriptActor.h"
 #include "RemoteControllable.h"
+#include "PoseReplication.h"
+#include "PoseJitterBuffer.h"
+#include "TrajectoryFile.h"
+#include "MbmlWriter.h"
+#include "XmlDelayQueue.h"
 
 #include <PxTransform.h>
 #include <PxVec3.h>
 
 #include <array>
+#include <memory>
 
 #include "ControlledRagdoll.generated.h"
 
@@ -59,60 +65,54 @@ struct FJointState
 
 
 
-/** Replication-ready struct for holding the state of a single bone. */
-USTRUCT( Blueprintable )
-struct FBoneState {
-	GENERATED_USTRUCT_BODY()
+/** In-memory snapshot of the physical state of a ragdoll. @see AControlledRagdoll::SaveSnapshot() */
+struct FRagdollSnapshot
+{
+	/** Global poses and velocities of all bodies. */
+	FBodyStates Bodies;
 
+	/** Joint motor commands, in the order of JointStates. */
+	TArray<FVector> MotorCommands;
+};
 
-private:
 
-	UPROPERTY()
-	TArray<int8> TransformData;
 
-	UPROPERTY()
-	TArray<int8> LinearVelocityData;
 
-	UPROPERTY()
-	TArray<int8> AngularVelocityData;
+class AControlledRagdoll;
+
 
 
-public:
 
-	FBoneState()
-	{
-		TransformData.SetNumZeroed( sizeof(physx::PxTransform) );
-		LinearVelocityData.SetNumZeroed( sizeof(physx::PxVec3) );
-		AngularVelocityData.SetNumZeroed( sizeof(physx::PxVec3) );
-	}
+/** Tick function for remote controller communication while the physics step is running, if ARCLevelScriptActor::PipelineRemoteControllers is set. Ticks
+ ** during TG_DuringPhysics, that is, after the world's physics scene has been kicked off and before its results are fetched.
+ ** @see AControlledRagdoll::TickDuringPhysics */
+USTRUCT()
+struct FControlledRagdollDuringPhysicsTickFunction : public FTickFunction
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** The ragdoll to be ticked. */
+	AControlledRagdoll * Target;
 
+	virtual void ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef & MyCompletionGraphEvent ) override;
+	virtual FString DiagnosticMessage() override;
+};
 
-	/** Verifies that the size of the data fields match the size of the local PhysX objects. In general, word size of the platform might affect this, although
-	 ** the current contents of this struct probably aren't affected. */
-	bool DoDataSizesMatch()
-	{
-		return
-			TransformData.Num() == sizeof(physx::PxTransform); // &&
-			LinearVelocityData.Num() == sizeof(physx::PxVec3) &&
-			AngularVelocityData.Num() == sizeof(physx::PxVec3);
-	}
 
 
-	physx::PxTransform & GetPxTransform()
-	{
-		return reinterpret_cast<physx::PxTransform &>(TransformData[0]);
-	}
 
-	physx::PxVec3 & GetPxLinearVelocity()
-	{
-		return reinterpret_cast<physx::PxVec3 &>(LinearVelocityData[0]);
-	}
+/** Tick function for the post-physics half of AControlledRagdoll's tick. Ticks during TG_PostPhysics, that is, after the physics step and after the
+ ** skeletal meshes have been synced to their bodies. @see AControlledRagdoll::TickPostPhysics */
+USTRUCT()
+struct FControlledRagdollPostPhysicsTickFunction : public FTickFunction
+{
+	GENERATED_USTRUCT_BODY()
 
-	physx::PxVec3 & GetPxAngularVelocity()
-	{
-		return reinterpret_cast<physx::PxVec3 &>(AngularVelocityData[0]);
-	}
+	/** The ragdoll to be ticked. */
+	AControlledRagdoll * Target;
 
+	virtual void ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef & MyCompletionGraphEvent ) override;
+	virtual FString DiagnosticMessage() override;
 };
 
 
@@ -132,6 +132,84 @@ class RAGDOLLCONTROLLER_API AControlledRagdoll :
 	/** Last time (wall clock time) that the pose was sent using SendPose(). */
 	double lastSendPoseWallclockTime{ -INFINITY };
 
+	/** Last time (wall clock time) that a pose packet was sent using MulticastPose(). */
+	double lastPosePacketWallclockTime{ -INFINITY };
+
+	/** Server: whether each body was asleep when SendPose() last read it. The state of such bodies in BodyStatesBuffer stays current while they sleep. */
+	TArray<bool> SendPoseSleepingBodies;
+
+	/** Server: the body states in the last pose packet sent, for skipping packets when nothing has changed. */
+	FBodyStates SentPosePacketStates;
+
+	/** Engine frame (GFrameCounter) during which BodyStatesBuffer was last refreshed by ReadAwakeBodyStates(). */
+	uint64 BodyStatesBufferFrame = 0;
+
+	/** Trajectory recorder, null if not recording. @see StartRecording() */
+	std::unique_ptr<TrajectoryWriter> Recorder;
+
+	/** Trajectory being replayed, null if not replaying. @see StartReplay() */
+	std::unique_ptr<TrajectoryReader> Replay;
+
+	/** Replay position, in seconds since the first record. */
+	double ReplayTime = 0.0;
+
+	/** Replay speed multiplier and looping. */
+	float ReplaySpeed = 1.f;
+	bool ReplayLooping = false;
+
+	/** Scratch buffers for interpolating between two replayed records. ReplayBodyStates[0] holds the last replayed state. */
+	FBodyStates ReplayBodyStates[2];
+
+	/** Whether each body was kinematic before the replay made it kinematic, for restoring its simulation state when the replay stops. */
+	TArray<bool> ReplayBodyWasKinematic;
+
+	/** Whether the next replayed pose is a jump (start, seek or wrap-around), to be teleported to instead of moved to. */
+	bool ReplayTeleport = false;
+
+	/** Whether the last record has been played (when not looping), so that the replay stops on the next tick. */
+	bool ReplayFinished = false;
+
+	/** Whether we are ticked by the LevelScriptActor instead of our own tick function. @see ARCLevelScriptActor::BatchTickRagdolls */
+	bool BatchTicked = false;
+
+	/** Whether PollRemoteController() has received the remote controller's document for the current tick. */
+	bool RemoteControllerInputGathered = false;
+
+	/** Tick function for TickPostPhysics(), registered on authority unless batch ticked. */
+	FControlledRagdollPostPhysicsTickFunction PostPhysicsTickFunction;
+
+	/** Tick function for TickDuringPhysics(), registered on authority if remote controller communication is pipelined, unless batch ticked. */
+	FControlledRagdollDuringPhysicsTickFunction DuringPhysicsTickFunction;
+
+	/** Copies of received remote controller documents whose setter commands are not due yet, one per tick (none for ticks without a document). Used only
+	 ** if ARCLevelScriptActor::ActionDelayTicks exceeds the delay that pipelining implies. @see ApplyRemoteControllerCommands */
+	XmlDelayQueue DelayedRemoteControllerCommands;
+
+	/** Response document for the remote controller, built once per connection and combination of getter commands, and updated in place on each tick.
+	 ** @see WriteToRemoteController */
+	MbmlTemplate ResponseTemplate;
+
+	/** The structure ResponseTemplate was built for: the getter commands, the encoding and the number of joints (INDEX_NONE if not built for the current
+	 ** connection). */
+	bool ResponseHasSensors = false;
+	bool ResponseHasActuators = false;
+	MbmlEncoding ResponseEncoding = MbmlTextEncoding;
+	int32 ResponseNumJoints = INDEX_NONE;
+
+	/** Slots of the data in ResponseTemplate. */
+	MbmlTemplate::MatrixSlot ResponseJointAngles;
+	MbmlTemplate::MatrixSlot ResponseMotorCommands;
+
+	/** Whether our bodies have been moved into a private physics scene. @see ParallelPhysicsScenes */
+	bool InPrivatePhysicsScene = false;
+
+	/** Torques to be applied to each body (in the order of SkeletalMeshComponent->Bodies), accumulated by ComputeBodyTorques(). Applied and cleared by
+	 ** ApplyBodyTorques(), or if in a private physics scene, applied on each substep and cleared after the step. */
+	TArray<FVector> BodyTorques;
+
+	/** Named in-memory snapshot slots. Slot contents are reused in place, so that re-saving into an existing slot does not allocate. @see SaveSnapshot() */
+	TMap<FName, FRagdollSnapshot> Snapshots;
+
 
 protected:
 
@@ -141,10 +219,14 @@ protected:
 	/** Our LevelScriptActor. Note that this is always null during an editor session! */
 	ARCLevelScriptActor * LevelScriptActor{};
 
-	/** Server's float interpretation of 0xdeadbeef, for checking float representation compatibility (eg, float endianness). Assume that UE replicates
-	 ** floats always correctly. */
-	UPROPERTY( Replicated )
-	float ServerInterpretationOfDeadbeef;
+	/** Scratch buffer for body states on their way to or from PhysX, re-used on every tick. */
+	FBodyStates BodyStatesBuffer;
+
+
+	/** Scene group for ARCLevelScriptActor::UseParallelPhysicsScenes. Ragdolls with the same group name share a private physics scene and can interact;
+	 ** ragdolls with no group name (None) get a private scene of their own. */
+	UPROPERTY( EditAnywhere, BlueprintReadOnly, Category = RagdollController )
+	FName PhysicsSceneGroup;
 
 
 	/* State data */
@@ -158,9 +240,26 @@ protected:
 	UPROPERTY( EditAnywhere, BlueprintReadWrite, Category = RagdollController )
 	TArray<FJointState> JointStates;
 
-	/** Data for all bodies of the SkeletalMeshComponent, mainly for server-to-client pose replication. */
-	UPROPERTY( EditAnywhere, BlueprintReadWrite, ReplicatedUsing = HandleBoneStatesReplicationEvent, Category = RagdollController )
-	TArray<FBoneState> BoneStates;
+	/** Quantized pose of all bodies of the SkeletalMeshComponent, for server-to-client pose replication. Delta-replicated per bone. */
+	UPROPERTY( ReplicatedUsing = HandleReplicatedPoseEvent )
+	FBoneStateArray ReplicatedPose;
+
+	/** Origin for the positions in ReplicatedPose. Updated by the server only when the actor drifts far from it. */
+	UPROPERTY( Replicated )
+	FVector ReplicatedPoseOrigin = FVector::ZeroVector;
+
+	/** Server's game time when ReplicatedPose was last updated. */
+	UPROPERTY( Replicated )
+	float ReplicatedPoseTimestamp = 0.f;
+
+	/** Client: received poses waiting to be played out. @see ARCLevelScriptActor::PoseJitterBufferDelay */
+	PoseJitterBuffer ReceivedPoses;
+
+	/** Server: sequence number of the last pose packet sent. Client: sequence number of the last pose packet accepted. @see MulticastPose() */
+	uint32 PosePacketSequence = 0;
+
+	/** Client: the latest pose packet received via MulticastPose(). Empty until the first packet arrives. */
+	FPosePacket ReceivedPosePacket;
 
 
 	/** Initialize the state data structs (read static data from the game engine, etc.) */
@@ -179,41 +278,91 @@ protected:
 	/** Handle network errors with remote controllers. Currently drops the connection, logs, and sets InXmlStatus.status to pugi::status_no_document_element. */
 	void HandleNetworkError( const std::string & description );
 
-	/** If a remote controller is connected, then read in one xml document and prepare the response document. If success, then RemoteControlSocket->InXml
-	 ** contains the received xml document, RemoteControlSocket->InXmlStatus.status is set to pugi::status_ok, and RemoteControlSocket->OutXml is cleared.
+	/** If a remote controller is connected, then read in one xml document (unless PollRemoteController() already has), blocking until it arrives, and
+	 ** prepare the response document. If success, then RemoteControlSocket->InXml
+	 ** contains the received xml document and RemoteControlSocket->InXmlStatus.status is set to pugi::status_ok.
 	 ** On failure, RemoteControlSocket->InXmlStatus.status is set to pugi::status_no_document_element. */
 	void PrepareRemoteControllerCommunication();
 
-	/** If xml data was received from a remote controller, then handle all commands with inbound data (setters). */
-	void ReadFromRemoteController();
+	/** Handle the setter commands that are due on this tick (@see ARCLevelScriptActor::ActionDelayTicks): those of the latest received document if they are
+	 ** not delayed, otherwise queue the latest document and handle the oldest queued one once it has waited long enough. */
+	void ApplyRemoteControllerCommands();
 
-	/** Read data from the game engine (PhysX etc). Called during the first half of each tick. */
+	/** Handle all commands with inbound data (setters) in the provided document received from the remote controller. The snapshot and restore commands
+	 ** are handled here too, so that a restored state is stepped together with the motor commands of the same document. */
+	void ReadFromRemoteController( const pugi::xml_document & inXml );
+
+	/** Read data from the game engine (PhysX etc). Called after the physics step, during the post-physics half of each tick. */
 	void ReadFromSimulation();
 
 
-	/* Outbound data flow, 2nd half of Tick() */
+	/* Outbound data flow */
+
+	/** Compute the motor torques of all joints into BodyTorques. Touches no engine state, and can thereby run concurrently for different ragdolls. */
+	void ComputeBodyTorques();
 
-	/** Write data to the game engine (PhysX etc). Called during the second half of each tick. */
-	void WriteToSimulation();
+	/** Write BodyTorques to the game engine (PhysX). No-op if in a private physics scene, where the torques are applied on each substep instead. */
+	void ApplyBodyTorques();
 
-	/** If xml data was received from a remote controller, then handle all commands that request outbound data (getters). */
+	/** If xml data was received from a remote controller, then handle all commands that request outbound data (getters): update the response document
+	 ** in ResponseTemplate, (re)building it first if its structure has changed, and copy it into RemoteControlSocket->OutText. */
 	void WriteToRemoteController();
 
 	/** If xml data was received from a remote controller, then send out the response document. */
 	void FinalizeRemoteControllerCommunication();
 
 
+	/** Read the global poses and velocities of all bodies from PhysX. Returns false on failure. */
+	bool ReadBodyStates( FBodyStates & bodyStates );
+
+	/** Read the states of awake bodies from PhysX into bodyStates, for SendPose() and RecordTrajectory(). Sleeping bodies are read once when they fall
+	 ** asleep and skipped afterwards (bodyStates must not be modified elsewhere in between). Returns the number of bodies read, or INDEX_NONE on failure. */
+	int32 ReadAwakeBodyStates( FBodyStates & bodyStates );
+
+	/** Append the current joint angles, motor commands and body states to the trajectory file, if recording. Called at the end of Tick(). */
+	void RecordTrajectory();
+
+	/** Move the kinematic bodies to the recorded pose at the current replay position during the next physics step, then advance the replay by deltaSeconds
+	 ** times the replay speed. Motor commands are set from the nearest preceding record for observers, but are not applied. Stops the replay on the tick
+	 ** after the last record has been played (when not looping). */
+	void TickReplay( float deltaSeconds );
+
+	/** Fetch the PhysX bodies of all bodies of the skeletal mesh. Returns false if any of them is unavailable. */
+	bool GetPxBodies( TArray<physx::PxRigidDynamic *, TInlineAllocator<64>> & pxBodies );
+
+	/** Write the global poses and velocities of all bodies to PhysX. Nothing is written if the body count does not match or if any PhysX body is
+	 ** unavailable. Returns false on failure. */
+	bool WriteBodyStates( const FBodyStates & bodyStates );
+
+	/** Set the poses of bodyStates as the kinematic targets of the (kinematic) bodies, so that the next physics step moves them there and derives their
+	 ** velocities from the motion; or, if teleport is set, put them there right away. Nothing is written if the body count does not match or if any PhysX
+	 ** body is unavailable. Returns false on failure. */
+	bool WriteKinematicTargets( const FBodyStates & bodyStates, bool teleport );
+
+
 	/* Client-server replication */
 
-	/** Store pose into the replicated BoneStates array. */
+	/** Publish the pose to clients, either by storing it into ReplicatedPose or by sending it with MulticastPose(), depending on
+	 ** ARCLevelScriptActor::PoseReplicationMode. */
 	void SendPose();
 
-	/** Apply replicated pose from the BoneStates array. */
+	/** Apply the received pose: sample the jitter buffer if it is in use, otherwise apply the latest received pose as is. */
 	void ReceivePose();
 
-	/** Handle pose replication events. */
+	/** Dequantize the latest received pose, from ReplicatedPose or from ReceivedPosePacket depending on ARCLevelScriptActor::PoseReplicationMode, into
+	 ** BodyStatesBuffer. Returns false if no complete pose has been received yet. */
+	bool UnpackReceivedPose( float & serverTimestamp );
+
+	/** Whether received poses are played out through the ReceivedPoses jitter buffer. */
+	bool UsePoseJitterBuffer() const;
+
+	/** Unreliable pose stream from the server. Out-of-order and duplicate packets are dropped. */
+	UFUNCTION( NetMulticast, Unreliable )
+	void MulticastPose( const FPosePacket & packet );
+
+	/** Handle pose replication events: feed the jitter buffer, or apply the pose right away if client-side prediction is on. */
 	UFUNCTION()
-	void HandleBoneStatesReplicationEvent();
+	void HandleReplicatedPoseEvent();
 
 
 public:
@@ -222,12 +371,122 @@ public:
 
 	virtual void PostInitializeComponents() override;
 	virtual void BeginPlay() override;
-
-	/** Ticking is performed in two stages. During the first stage, inbound data from the game engine and the remote controller is read and stored to internal
-	 ** data structs. During the second stage, outbound data is sent back to the game engine and to the remote controller. TickHook() and the actor's Blueprint
-	 ** are called between these stages. TickHook() is called just before the Blueprint. */
+	virtual void EndPlay( const EEndPlayReason::Type EndPlayReason ) override;
+
+	/** Ticking is split around the physics step. Before the step (TG_PrePhysics, this function), inbound data from the remote controller is read, TickHook()
+	 ** and the actor's Blueprint are called, and the motor torques are applied. After the step (TG_PostPhysics, TickPostPhysics()), the simulation state is
+	 ** read, and outbound data is sent to the remote controller and to clients. The remote controller thereby observes the result of its commands within
+	 ** the same tick, and computes the next commands while the game thread is idle. If ARCLevelScriptActor::PipelineRemoteControllers is set, then the
+	 ** remote controller communication happens during the physics step instead (@see TickDuringPhysics()). On clients, only the pose is updated, and the
+	 ** Blueprint is run. */
 	virtual void Tick( float deltaSeconds ) override;
-	// Temporary, remove when done testing
-	int tickCounter = -1;
+
+	/** The post-physics half of the tick (standalone / server only). Called by PostPhysicsTickFunction. @see Tick() */
+	void TickPostPhysics( float deltaSeconds );
+
+	/** Remote controller communication while the physics step is running, if ARCLevelScriptActor::PipelineRemoteControllers is set (standalone / server
+	 ** only): the response with the observations of the previous tick is sent, and the commands for the next tick are received. Called by
+	 ** DuringPhysicsTickFunction. */
+	void TickDuringPhysics( float deltaSeconds );
+
+	/** Drops the setter commands still queued from a previous remote controller. */
+	virtual void ConnectWith( std::unique_ptr<XmlFSocket> socket ) override;
+
+	/** Get the SkeletalMeshComponent of the actor to be controlled. This is guaranteed to be always valid after PostInitializeComponents(). */
+	USkeletalMeshComponent * GetSkeletalMeshComponent() const { return this->SkeletalMeshComponent; }
+
+
+	/* Batch tick stages (standalone / server only). Tick() runs the pre-physics stages in order, TickDuringPhysics() the during-physics stages, and
+	 ** TickPostPhysics() the post-physics stages. ARCLevelScriptActor::BatchTickRagdolls runs each stage for all ragdolls before moving to the next one; the
+	 ** ComputeTorques and ReadSimulation stages run concurrently for different ragdolls, the others on the game thread. */
+
+	/** Pre-physics: receive the remote controller's document (unless pipelined), handle the setter commands that are due, and advance the replay. */
+	void TickStageInbound( float deltaSeconds );
+
+	/** Pre-physics: run TickHook() and the actor's Blueprint. */
+	void TickStageUpdate( float deltaSeconds );
+
+	/** Pre-physics: compute the motor torques. Only modifies the state of this actor, safe to run concurrently for different ragdolls. */
+	void TickStageComputeTorques();
+
+	/** Pre-physics: apply the motor torques. */
+	void TickStageApplyTorques();
+
+	/** Post-physics: read joint states from PhysX. Only reads engine state, safe to run concurrently for different ragdolls. */
+	void TickStageReadSimulation();
+
+	/** Post-physics: reply to the remote controller (unless pipelined), publish the pose to clients, and record the trajectory. */
+	void TickStageOutbound();
+
+	/** During physics, if pipelined: reply to the remote controller with the observations of the previous tick. */
+	void TickStageSendObservations();
+
+	/** During physics, if pipelined: receive the remote controller's next document (unless PollRemoteController() already has), blocking until it arrives. */
+	void TickStageReceiveCommands();
+
+	/** Try to receive the remote controller's document for the current tick without blocking, so that the LevelScriptActor can wait on all remote
+	 ** controllers at once before TickStageInbound() or TickStageReceiveCommands(), which then do not block. Returns true when done: the document has been received, the connection has
+	 ** failed and has been dropped, or there is no remote controller. */
+	bool PollRemoteController();
+
+	/** The connection of the remote controller, for waiting on it while PollRemoteController() is not done. Null if no remote controller. */
+	ByteStream * GetRemoteControllerStream() const;
+
+
+	/* Private physics scene support, called by ParallelPhysicsScenes (possibly from a worker thread) */
+
+	/** Apply the torques computed by ComputeBodyTorques() directly to our PhysX bodies. Called before each substep of our private physics scene. */
+	void ApplyPrivateSceneTorques();
+
+	/** Clear the torques computed by ComputeBodyTorques(). Called after our private physics scene has been stepped. */
+	void ClearPrivateSceneTorques();
+
+
+	/* Snapshots */
+
+	/** Store the current body poses, body velocities and joint motor commands into the named in-memory slot, overwriting any previous snapshot in that
+	 ** slot. Cheap enough to be called on every tick: no memory is allocated when re-saving into an existing slot. Returns false on failure, in which case
+	 ** the slot contents are undefined. */
+	bool SaveSnapshot( FName slot );
+
+	/** Restore body poses, body velocities and joint motor commands from the named in-memory slot. Returns false if the slot does not exist or does not
+	 ** match the current skeleton, in which case nothing is modified. Note that BoneGlobalRotations in JointStates are refreshed from the engine's bone
+	 ** transforms, which lag behind a restore until the next physics sync. */
+	bool RestoreSnapshot( FName slot );
+
+	/** Drop the named in-memory slot. Returns false if the slot does not exist. */
+	bool DeleteSnapshot( FName slot );
+
+
+	/* Trajectory recording */
+
+	/** Start recording joint angles, motor commands and body states on every tick into the named trajectory file in Saved/Trajectories. A running
+	 ** recording is stopped first. Returns false on failure. @see TrajectoryFile.h */
+	bool StartRecording( const FString & fileName );
+
+	/** Stop recording and close the trajectory file. No-op if not recording. */
+	void StopRecording();
+
+	bool IsRecording() const { return this->Recorder != nullptr; }
+
+
+	/* Trajectory replay */
+
+	/** Start replaying the named trajectory file from Saved/Trajectories. While replaying, the bodies are kinematic and follow the recorded poses, and
+	 ** motor commands are not applied. The file must have been recorded with the same joints. Returns false on failure. */
+	bool StartReplay( const FString & fileName, float speed = 1.f, bool loop = false );
+
+	/** Stop replaying. The bodies get back their simulation state from before the replay and continue from the last replayed state, with its recorded
+	 ** velocities. No-op if not replaying. */
+	void StopReplay();
+
+	/** Jump to the provided replay position (seconds since the first record, clamped to the recording). */
+	void SeekReplay( double time );
+
+	/** Set the replay speed multiplier (negative plays backwards) and looping. */
+	void SetReplaySpeed( float speed ) { this->ReplaySpeed = speed; }
+	void SetReplayLooping( bool loop ) { this->ReplayLooping = loop; }
+
+	bool IsReplaying() const { return this->Replay != nullptr; }
 
 };
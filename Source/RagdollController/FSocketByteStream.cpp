@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "FSocketByteStream.h"
+
+#include <Sockets.h>
+
+
+
+
+bool FSocketByteStream::IsGood()
+{
+	return this->Socket && this->Socket->GetConnectionState() == ESocketConnectionState::SCS_Connected;
+}
+
+
+
+
+bool FSocketByteStream::WaitForData( int timeoutMs )
+{
+	return this->Socket && this->Socket->Wait( ESocketWaitConditions::WaitForRead, FTimespan( 0, 0, 0, 0, timeoutMs ) );
+}
+
+
+
+
+bool FSocketByteStream::HasPendingData( std::size_t & bytesPending )
+{
+	uint32 pending = 0;
+	bool hasPendingData = this->Socket && this->Socket->HasPendingData( pending );
+	bytesPending = pending;
+	return hasPendingData;
+}
+
+
+
+
+bool FSocketByteStream::Read( char * data, std::size_t size, std::size_t & bytesRead )
+{
+	int32 read = 0;
+	bool success = this->Socket && this->Socket->Recv( (uint8 *)data, int32( size ), read, ESocketReceiveFlags::None );
+	bytesRead = success ? std::size_t( read ) : 0;
+	return success;
+}
+
+
+
+
+bool FSocketByteStream::Write( const char * data, std::size_t size )
+{
+	if( !this->Socket ) return false;
+
+	int32 bytesSent;
+	this->Socket->Send( (const uint8 *)data, int32( size ), bytesSent );
+	return bytesSent == int32( size );
+}
@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "ByteStream.h"
+
+#include <memory>
+
+#include <Networking.h>
+
+
+
+
+/**
+ * ByteStream over an engine FSocket, which it owns.
+ */
+class FSocketByteStream : public ByteStream
+{
+public:
+
+	/** The UE FSocket. */
+	std::unique_ptr<FSocket> Socket;
+
+
+	explicit FSocketByteStream( std::unique_ptr<FSocket> socket ) : Socket( std::move( socket ) ) {}
+
+
+	virtual bool IsGood() override;
+	virtual bool WaitForData( int timeoutMs ) override;
+	virtual bool HasPendingData( std::size_t & bytesPending ) override;
+	virtual bool Read( char * data, std::size_t size, std::size_t & bytesRead ) override;
+	virtual bool Write( const char * data, std::size_t size ) override;
+};
@@ -0,0 +1,359 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "FloatFormat.h"
+
+#include <cstdint>
+#include <cstring>
+
+
+// IEEE 754 single precision layout
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BITS 8
+#define FLOAT_BIAS 127
+
+// precision of the tables below: 5^-q scaled to FLOAT_POW5_INV_BITCOUNT bits, 5^i scaled to FLOAT_POW5_BITCOUNT bits
+#define FLOAT_POW5_INV_BITCOUNT 59
+#define FLOAT_POW5_BITCOUNT 61
+
+// decimal exponent range for fixed notation, @see FloatFormat
+#define FIXED_NOTATION_MIN_EXPONENT -4
+#define FIXED_NOTATION_MAX_EXPONENT 8
+
+
+
+
+/** floor( 2^(pow5bits(q) - 1 + FLOAT_POW5_INV_BITCOUNT) / 5^q ) + 1 */
+static const std::uint64_t FLOAT_POW5_INV_SPLIT[31] = {
+	576460752303423489u, 461168601842738791u, 368934881474191033u, 295147905179352826u,
+	472236648286964522u, 377789318629571618u, 302231454903657294u, 483570327845851670u,
+	386856262276681336u, 309485009821345069u, 495176015714152110u, 396140812571321688u,
+	316912650057057351u, 507060240091291761u, 405648192073033409u, 324518553658426727u,
+	519229685853482763u, 415383748682786211u, 332306998946228969u, 531691198313966350u,
+	425352958651173080u, 340282366920938464u, 544451787073501542u, 435561429658801234u,
+	348449143727040987u, 557518629963265579u, 446014903970612463u, 356811923176489971u,
+	570899077082383953u, 456719261665907162u, 365375409332725730u
+};
+
+/** 5^i, normalized to FLOAT_POW5_BITCOUNT bits. */
+static const std::uint64_t FLOAT_POW5_SPLIT[47] = {
+	1152921504606846976u, 1441151880758558720u, 1801439850948198400u, 2251799813685248000u,
+	1407374883553280000u, 1759218604441600000u, 2199023255552000000u, 1374389534720000000u,
+	1717986918400000000u, 2147483648000000000u, 1342177280000000000u, 1677721600000000000u,
+	2097152000000000000u, 1310720000000000000u, 1638400000000000000u, 2048000000000000000u,
+	1280000000000000000u, 1600000000000000000u, 2000000000000000000u, 1250000000000000000u,
+	1562500000000000000u, 1953125000000000000u, 1220703125000000000u, 1525878906250000000u,
+	1907348632812500000u, 1192092895507812500u, 1490116119384765625u, 1862645149230957031u,
+	1164153218269348144u, 1455191522836685180u, 1818989403545856475u, 2273736754432320594u,
+	1421085471520200371u, 1776356839400250464u, 2220446049250313080u, 1387778780781445675u,
+	1734723475976807094u, 2168404344971008868u, 1355252715606880542u, 1694065894508600678u,
+	2117582368135750847u, 1323488980084844279u, 1654361225106055349u, 2067951531382569187u,
+	1292469707114105741u, 1615587133892632177u, 2019483917365790221u
+};
+
+
+
+
+/** The number of bits of 5^e for e >= 1 (ceil( log2( 5^e ) )); 1 for e == 0. Exact for 0 <= e <= 3528. */
+static inline std::int32_t Pow5Bits( std::int32_t e )
+{
+	return std::int32_t( (std::uint32_t( e ) * 1217359) >> 19 ) + 1;
+}
+
+/** floor( log10( 2^e ) ) for 0 <= e <= 1650. */
+static inline std::int32_t Log10Pow2( std::int32_t e )
+{
+	return std::int32_t( (std::uint32_t( e ) * 78913) >> 18 );
+}
+
+/** floor( log10( 5^e ) ) for 0 <= e <= 2620. */
+static inline std::int32_t Log10Pow5( std::int32_t e )
+{
+	return std::int32_t( (std::uint32_t( e ) * 732923) >> 20 );
+}
+
+static inline std::uint32_t Pow5Factor( std::uint32_t value )
+{
+	std::uint32_t count = 0;
+	while( value % 5 == 0 )
+	{
+		value /= 5;
+		++count;
+	}
+	return count;
+}
+
+static inline bool MultipleOfPowerOf5( std::uint32_t value, std::uint32_t p )
+{
+	return Pow5Factor( value ) >= p;
+}
+
+static inline bool MultipleOfPowerOf2( std::uint32_t value, std::uint32_t p )
+{
+	return (value & ((1u << p) - 1)) == 0;
+}
+
+/** (m * factor) >> shift, for shift > 32, without a 128-bit intermediate. */
+static inline std::uint32_t MulShift( std::uint32_t m, std::uint64_t factor, std::int32_t shift )
+{
+	std::uint64_t bits0 = std::uint64_t( m ) * std::uint32_t( factor );
+	std::uint64_t bits1 = std::uint64_t( m ) * std::uint32_t( factor >> 32 );
+	std::uint64_t sum = (bits0 >> 32) + bits1;
+	return std::uint32_t( sum >> (shift - 32) );
+}
+
+static inline std::uint32_t DecimalLength( std::uint32_t value )
+{
+	std::uint32_t length = 1;
+	for( std::uint32_t limit = 10; length < 10 && value >= limit; limit *= 10 )
+	{
+		++length;
+	}
+	return length;
+}
+
+
+
+
+/** Shortest decimal representation of a finite, non-zero float: value == digits * 10^exponent. */
+static void ShortestDecimal( std::uint32_t ieeeMantissa, std::uint32_t ieeeExponent, std::uint32_t & digits, std::int32_t & exponent )
+{
+	// the value is m2 * 2^e2; the two extra bits make room for the halfway points to the neighbouring floats
+	std::int32_t e2;
+	std::uint32_t m2;
+	if( ieeeExponent == 0 )
+	{
+		e2 = 1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = ieeeMantissa;
+	}
+	else
+	{
+		e2 = std::int32_t( ieeeExponent ) - FLOAT_BIAS - FLOAT_MANTISSA_BITS - 2;
+		m2 = (1u << FLOAT_MANTISSA_BITS) | ieeeMantissa;
+	}
+	bool even = (m2 & 1) == 0;
+	bool acceptBounds = even;
+
+	// the interval of decimals that round to this float is (mm, mp) * 2^e2, or [mm, mp] for even mantissas (round half to even)
+	std::uint32_t mv = 4 * m2;
+	std::uint32_t mp = 4 * m2 + 2;
+	std::uint32_t mmShift = (ieeeMantissa != 0 || ieeeExponent <= 1) ? 1 : 0;
+	std::uint32_t mm = 4 * m2 - 1 - mmShift;
+
+	// convert the interval to decimal: vr, vp, vm are mv, mp, mm times 2^e2 / 10^e10
+	std::uint32_t vr, vp, vm;
+	std::int32_t e10;
+	bool vmIsTrailingZeros = false;
+	bool vrIsTrailingZeros = false;
+	std::uint8_t lastRemovedDigit = 0;
+	if( e2 >= 0 )
+	{
+		std::int32_t q = Log10Pow2( e2 );
+		e10 = q;
+		std::int32_t k = FLOAT_POW5_INV_BITCOUNT + Pow5Bits( q ) - 1;
+		std::int32_t i = -e2 + q + k;
+		vr = MulShift( mv, FLOAT_POW5_INV_SPLIT[q], i );
+		vp = MulShift( mp, FLOAT_POW5_INV_SPLIT[q], i );
+		vm = MulShift( mm, FLOAT_POW5_INV_SPLIT[q], i );
+		if( q != 0 && (vp - 1) / 10 <= vm / 10 )
+		{
+			// the digit removed by the q - 1 step is needed for rounding
+			std::int32_t l = FLOAT_POW5_INV_BITCOUNT + Pow5Bits( q - 1 ) - 1;
+			lastRemovedDigit = std::uint8_t( MulShift( mv, FLOAT_POW5_INV_SPLIT[q - 1], -e2 + q - 1 + l ) % 10 );
+		}
+		if( q <= 9 )
+		{
+			// only one of mp, mv and mm can be a multiple of 5, if any
+			if( mv % 5 == 0 )
+			{
+				vrIsTrailingZeros = MultipleOfPowerOf5( mv, q );
+			}
+			else if( acceptBounds )
+			{
+				vmIsTrailingZeros = MultipleOfPowerOf5( mm, q );
+			}
+			else
+			{
+				vp -= MultipleOfPowerOf5( mp, q ) ? 1 : 0;
+			}
+		}
+	}
+	else
+	{
+		std::int32_t q = Log10Pow5( -e2 );
+		e10 = q + e2;
+		std::int32_t i = -e2 - q;
+		std::int32_t k = Pow5Bits( i ) - FLOAT_POW5_BITCOUNT;
+		std::int32_t j = q - k;
+		vr = MulShift( mv, FLOAT_POW5_SPLIT[i], j );
+		vp = MulShift( mp, FLOAT_POW5_SPLIT[i], j );
+		vm = MulShift( mm, FLOAT_POW5_SPLIT[i], j );
+		if( q != 0 && (vp - 1) / 10 <= vm / 10 )
+		{
+			j = q - 1 - (Pow5Bits( i + 1 ) - FLOAT_POW5_BITCOUNT);
+			lastRemovedDigit = std::uint8_t( MulShift( mv, FLOAT_POW5_SPLIT[i + 1], j ) % 10 );
+		}
+		if( q <= 1 )
+		{
+			// mv has at least q trailing zero bits, so vr is exact
+			vrIsTrailingZeros = true;
+			if( acceptBounds )
+			{
+				vmIsTrailingZeros = mmShift == 1;
+			}
+			else
+			{
+				--vp;
+			}
+		}
+		else if( q < 31 )
+		{
+			vrIsTrailingZeros = MultipleOfPowerOf2( mv, q - 1 );
+		}
+	}
+
+	// remove digits while the interval still contains a shorter representation
+	std::int32_t removed = 0;
+	std::uint32_t output;
+	if( vmIsTrailingZeros || vrIsTrailingZeros )
+	{
+		// rare general case: the bounds and the exact value need tracking
+		while( vp / 10 > vm / 10 )
+		{
+			vmIsTrailingZeros &= vm % 10 == 0;
+			vrIsTrailingZeros &= lastRemovedDigit == 0;
+			lastRemovedDigit = std::uint8_t( vr % 10 );
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			++removed;
+		}
+		if( vmIsTrailingZeros )
+		{
+			while( vm % 10 == 0 )
+			{
+				vrIsTrailingZeros &= lastRemovedDigit == 0;
+				lastRemovedDigit = std::uint8_t( vr % 10 );
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				++removed;
+			}
+		}
+		if( vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0 )
+		{
+			// exactly halfway: round to even
+			lastRemovedDigit = 4;
+		}
+		output = vr + (((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5) ? 1 : 0);
+	}
+	else
+	{
+		// common case
+		while( vp / 10 > vm / 10 )
+		{
+			lastRemovedDigit = std::uint8_t( vr % 10 );
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			++removed;
+		}
+		output = vr + ((vr == vm || lastRemovedDigit >= 5) ? 1 : 0);
+	}
+
+	digits = output;
+	exponent = e10 + removed;
+}
+
+
+
+
+int FloatFormat::Write( char * buffer, float value )
+{
+	std::uint32_t bits;
+	std::memcpy( &bits, &value, sizeof( bits ) );
+	bool sign = (bits >> (FLOAT_MANTISSA_BITS + FLOAT_EXPONENT_BITS)) != 0;
+	std::uint32_t ieeeMantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+	std::uint32_t ieeeExponent = (bits >> FLOAT_MANTISSA_BITS) & ((1u << FLOAT_EXPONENT_BITS) - 1);
+
+	char * out = buffer;
+
+	// special values
+	if( ieeeExponent == (1u << FLOAT_EXPONENT_BITS) - 1 )
+	{
+		const char * text = ieeeMantissa != 0 ? "NaN" : (sign ? "-Inf" : "Inf");
+		std::size_t length = std::strlen( text );
+		std::memcpy( out, text, length );
+		return int( length );
+	}
+	if( sign ) *out++ = '-';
+	if( ieeeExponent == 0 && ieeeMantissa == 0 )
+	{
+		*out++ = '0';
+		return int( out - buffer );
+	}
+
+	std::uint32_t digits;
+	std::int32_t exponent;
+	ShortestDecimal( ieeeMantissa, ieeeExponent, digits, exponent );
+
+	// render the digits backwards into a scratch buffer
+	char digitChars[10];
+	std::int32_t numDigits = std::int32_t( DecimalLength( digits ) );
+	for( std::int32_t ind = numDigits - 1; ind >= 0; --ind )
+	{
+		digitChars[ind] = char( '0' + digits % 10 );
+		digits /= 10;
+	}
+
+	// exponent of the leading digit
+	std::int32_t scientificExponent = exponent + numDigits - 1;
+
+	if( scientificExponent >= FIXED_NOTATION_MIN_EXPONENT && scientificExponent <= FIXED_NOTATION_MAX_EXPONENT )
+	{
+		if( exponent >= 0 )
+		{
+			// integer: digits followed by zeros
+			std::memcpy( out, digitChars, numDigits );
+			out += numDigits;
+			for( std::int32_t ind = 0; ind < exponent; ++ind ) *out++ = '0';
+		}
+		else if( scientificExponent >= 0 )
+		{
+			// decimal point within the digits
+			std::int32_t integerDigits = scientificExponent + 1;
+			std::memcpy( out, digitChars, integerDigits );
+			out += integerDigits;
+			*out++ = '.';
+			std::memcpy( out, digitChars + integerDigits, numDigits - integerDigits );
+			out += numDigits - integerDigits;
+		}
+		else
+		{
+			// leading zeros
+			*out++ = '0';
+			*out++ = '.';
+			for( std::int32_t ind = -1; ind > scientificExponent; --ind ) *out++ = '0';
+			std::memcpy( out, digitChars, numDigits );
+			out += numDigits;
+		}
+	}
+	else
+	{
+		// scientific: d[.ddd]e[+-]x[x]
+		*out++ = digitChars[0];
+		if( numDigits > 1 )
+		{
+			*out++ = '.';
+			std::memcpy( out, digitChars + 1, numDigits - 1 );
+			out += numDigits - 1;
+		}
+		*out++ = 'e';
+		*out++ = scientificExponent < 0 ? '-' : '+';
+		std::uint32_t absExponent = std::uint32_t( scientificExponent < 0 ? -scientificExponent : scientificExponent );
+		if( absExponent >= 10 ) *out++ = char( '0' + absExponent / 10 );
+		*out++ = char( '0' + absExponent % 10 );
+	}
+
+	return int( out - buffer );
+}
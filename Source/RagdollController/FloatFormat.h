@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+
+
+
+/**
+ * Shortest round-trip formatting of single precision floats, in the spirit of C++17's std::to_chars.
+ *
+ * Produces the shortest decimal string that parses back (strtof, Matlab's str2num followed by a cast to single) to exactly the same float, using the Ryu
+ * algorithm (Adams, 2018): integer arithmetic only, no locale, no allocation, and several times faster than printf("%.9g"). Values with a decimal exponent in
+ * [-4, 8] are written in fixed notation ("0.001", "12.5", "123456"), others in scientific notation ("1.5e-7", "3e+12"). Non-finite values are written as
+ * Matlab reads them: "NaN", "Inf" and "-Inf".
+ *
+ * Free of engine dependencies, so that it can be tested headless (Test/MbmlWriter).
+ *
+ * Reference: Adams, U. (2018). Ryu: fast float-to-string conversion. PLDI 2018, 270-282.
+ */
+class FloatFormat
+{
+public:
+
+	/** Upper limit for the length of a formatted float ("-1.17549435e-38" is the longest). */
+	static const int MaxLength = 16;
+
+	/** Write the value into buffer, which must have room for MaxLength characters. Returns the number of characters written; no null terminator is added. */
+	static int Write( char * buffer, float value );
+};
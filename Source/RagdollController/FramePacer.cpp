@@ -0,0 +1,134 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "FramePacer.h"
+
+#if PLATFORM_LINUX
+#include <time.h>
+#include <errno.h>
+#endif
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define PACER_SPIN_PAUSE() _mm_pause()
+#else
+#define PACER_SPIN_PAUSE()
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+
+// busy wait margin before each deadline: initial value, and the bounds for calibration (seconds)
+#define PACER_INITIAL_SPIN_MARGIN 0.002
+#define PACER_MIN_SPIN_MARGIN 0.00005
+#define PACER_MAX_SPIN_MARGIN 0.002
+
+// recalibrate the busy wait margin after this many sleeps, to the given percentile of the wake-up latencies plus a safety margin (seconds)
+#define PACER_CALIBRATION_SAMPLES 128
+#define PACER_CALIBRATION_PERCENTILE 99.0
+#define PACER_CALIBRATION_SAFETY 0.00005
+
+// interval for logging the overshoot statistics (seconds)
+#define PACER_REPORT_INTERVAL 30.0
+
+
+
+
+FramePacer::FramePacer() :
+	SpinMargin( PACER_INITIAL_SPIN_MARGIN )
+{
+}
+
+
+
+
+double FramePacer::Now()
+{
+#if PLATFORM_LINUX
+	timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return double( now.tv_sec ) + double( now.tv_nsec ) * 1e-9;
+#else
+	return FPlatformTime::Seconds();
+#endif
+}
+
+
+
+
+void FramePacer::SleepUntil( double time )
+{
+#if PLATFORM_LINUX
+	// absolute sleep: no drift from computing a relative duration, and no early wake-up on EINTR
+	timespec deadline;
+	deadline.tv_sec = time_t( std::floor( time ) );
+	deadline.tv_nsec = long( (time - std::floor( time )) * 1e9 );
+	while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr ) == EINTR ) {}
+#else
+	double duration = time - Now();
+	if( duration > 0.0 )
+	{
+		FPlatformProcess::Sleep( float( duration ) );
+	}
+#endif
+}
+
+
+
+
+void FramePacer::Calibrate()
+{
+	double latency = this->SleepLatencies.GetPercentile( PACER_CALIBRATION_PERCENTILE ) * 1e-6;
+	this->SpinMargin = FMath::Clamp( latency + PACER_CALIBRATION_SAFETY, PACER_MIN_SPIN_MARGIN, PACER_MAX_SPIN_MARGIN );
+	this->SleepLatencies.Reset();
+}
+
+
+
+
+void FramePacer::Wait( double period )
+{
+	double now = Now();
+
+	// start the schedule, or restart it if we have fallen behind by more than a whole period (catching up would just cause a burst of short frames)
+	if( this->NextDeadline == 0.0 || now > this->NextDeadline + period )
+	{
+		if( this->NextDeadline != 0.0 ) ++this->NumResyncs;
+		this->NextDeadline = now + period;
+		if( this->LastReportTime == 0.0 ) this->LastReportTime = now;
+		return;
+	}
+
+	double deadline = this->NextDeadline;
+
+	// sleep until shortly before the deadline, and record how late the OS woke us up
+	double sleepTarget = deadline - this->SpinMargin;
+	if( now < sleepTarget )
+	{
+		SleepUntil( sleepTarget );
+		this->SleepLatencies.Record( uint64( std::max( Now() - sleepTarget, 0.0 ) * 1e6 ) );
+		if( this->SleepLatencies.GetCount() >= PACER_CALIBRATION_SAMPLES ) Calibrate();
+	}
+
+	// busy wait for the rest
+	while( (now = Now()) < deadline )
+	{
+		PACER_SPIN_PAUSE();
+	}
+
+	// schedule the next deadline relative to this one, not relative to the actual wake-up time, so that overshoots do not accumulate
+	this->Overshoots.Record( uint64( (now - deadline) * 1e6 ) );
+	this->NextDeadline = deadline + period;
+
+	// report
+	if( now - this->LastReportTime >= PACER_REPORT_INTERVAL )
+	{
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s) Frame pacing overshoot: p50 %llu us, p99 %llu us, max %llu us over %llu frames; %d resyncs; spin margin %.0f us" ),
+			TEXT( __FUNCTION__ ), this->Overshoots.GetPercentile( 50.0 ), this->Overshoots.GetPercentile( 99.0 ), this->Overshoots.GetMax(),
+			this->Overshoots.GetCount(), this->NumResyncs, this->SpinMargin * 1e6 );
+		this->Overshoots.Reset();
+		this->NumResyncs = 0;
+		this->LastReportTime = now;
+	}
+}
@@ -0,0 +1,61 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "Histogram.h"
+
+
+
+
+/**
+ * Paces a loop to a fixed period against absolute deadlines.
+ *
+ * Each deadline is the previous deadline plus the period, so that sleep overshoots do not accumulate into drift. The wait is an OS sleep until shortly before
+ * the deadline (an absolute clock_nanosleep() where available), followed by a short busy wait. The busy wait margin is calibrated from the observed sleep
+ * wake-up latencies, so that the CPU is mostly idle while waiting. If the loop falls behind by more than a whole period, then the schedule is restarted from
+ * the current time instead of trying to catch up.
+ */
+class FramePacer
+{
+	/** The next deadline, on the Now() time line. Zero before the first call to Wait(). */
+	double NextDeadline = 0.0;
+
+	/** Busy wait margin before each deadline (seconds). */
+	double SpinMargin;
+
+	/** Wake-up latencies of the OS sleeps since the last calibration (microseconds). */
+	Histogram SleepLatencies;
+
+	/** Deadline overshoots since the last report (microseconds). */
+	Histogram Overshoots;
+
+	/** Number of schedule restarts since the last report. */
+	int32 NumResyncs = 0;
+
+	double LastReportTime = 0.0;
+
+
+	/** Sleep until shortly before the provided time. */
+	static void SleepUntil( double time );
+
+	/** Recompute SpinMargin from SleepLatencies. */
+	void Calibrate();
+
+
+public:
+
+	FramePacer();
+
+
+	/** Monotonic clock used for deadlines (seconds). */
+	static double Now();
+
+	/** Wait until the next deadline, which is then advanced by period. The first call only starts the schedule. */
+	void Wait( double period );
+
+	/** Forget the schedule, e.g. after the period has changed or after pacing was paused. */
+	void Restart() { this->NextDeadline = 0.0; }
+
+	/** Deadline overshoots since the last report (microseconds). */
+	const Histogram & GetOvershoots() const { return this->Overshoots; }
+};
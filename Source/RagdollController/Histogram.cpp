@@ -0,0 +1,174 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+
+
+Histogram::Histogram()
+{
+	Reset();
+}
+
+
+
+
+int32 Histogram::GetBucketIndex( uint64 value )
+{
+	// values below SubBucketCount get exact buckets in the first group
+	if( value < SubBucketCount ) return int32( value );
+
+	// group by the highest set bit, then split the group linearly by the next SubBucketBits bits
+	uint32 high = uint32( value >> 32 );
+	int32 highestBit = high ? 32 + int32( FMath::FloorLog2( high ) ) : int32( FMath::FloorLog2( uint32( value ) ) );
+	if( highestBit >= MaxValueBits ) return BucketCount - 1;
+
+	int32 shift = highestBit - SubBucketBits;
+	int32 group = shift + 1;
+	int32 subBucket = int32( (value >> shift) & (SubBucketCount - 1) );
+	return group * SubBucketCount + subBucket;
+}
+
+
+
+
+uint64 Histogram::GetBucketUpperBound( int32 index )
+{
+	int32 group = index / SubBucketCount;
+	int32 subBucket = index % SubBucketCount;
+	if( group == 0 ) return uint64( subBucket );
+
+	int32 shift = group - 1;
+	uint64 lowerBound = (uint64( SubBucketCount + subBucket )) << shift;
+	return lowerBound + (uint64( 1 ) << shift) - 1;
+}
+
+
+
+
+void Histogram::Record( uint64 value )
+{
+	this->Counts[GetBucketIndex( value )].fetch_add( 1, std::memory_order_relaxed );
+	this->TotalCount.fetch_add( 1, std::memory_order_relaxed );
+	this->Sum.fetch_add( value, std::memory_order_relaxed );
+
+	uint64 max = this->MaxValue.load( std::memory_order_relaxed );
+	while( value > max && !this->MaxValue.compare_exchange_weak( max, value, std::memory_order_relaxed ) ) {}
+}
+
+
+
+
+void Histogram::Add( const Histogram & other )
+{
+	for( int32 bucket = 0; bucket < BucketCount; ++bucket )
+	{
+		this->Counts[bucket].fetch_add( other.Counts[bucket].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+	}
+	this->TotalCount.fetch_add( other.GetCount(), std::memory_order_relaxed );
+	this->Sum.fetch_add( other.Sum.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+
+	uint64 otherMax = other.GetMax();
+	uint64 max = this->MaxValue.load( std::memory_order_relaxed );
+	while( otherMax > max && !this->MaxValue.compare_exchange_weak( max, otherMax, std::memory_order_relaxed ) ) {}
+}
+
+
+
+
+void Histogram::Reset()
+{
+	for( std::atomic<uint64> & count : this->Counts )
+	{
+		count.store( 0, std::memory_order_relaxed );
+	}
+	this->TotalCount.store( 0, std::memory_order_relaxed );
+	this->Sum.store( 0, std::memory_order_relaxed );
+	this->MaxValue.store( 0, std::memory_order_relaxed );
+}
+
+
+
+
+double Histogram::GetMean() const
+{
+	uint64 count = GetCount();
+	return count > 0 ? double( this->Sum.load( std::memory_order_relaxed ) ) / count : 0.0;
+}
+
+
+
+
+uint64 Histogram::GetPercentile( double percentile ) const
+{
+	uint64 totalCount = GetCount();
+	uint64 max = GetMax();
+	if( totalCount == 0 ) return 0;
+
+	// the rank of the requested value (1-based), then find its bucket
+	uint64 rank = std::max<uint64>( uint64( std::ceil( FMath::Clamp( percentile, 0.0, 100.0 ) / 100.0 * totalCount ) ), 1 );
+	uint64 cumulative = 0;
+	for( int32 bucket = 0; bucket < BucketCount; ++bucket )
+	{
+		cumulative += this->Counts[bucket].load( std::memory_order_relaxed );
+		if( cumulative >= rank ) return bucket == BucketCount - 1 ? max : std::min( GetBucketUpperBound( bucket ), max );
+	}
+
+	return max;
+}
+
+
+
+
+SlidingWindowHistogram::SlidingWindowHistogram( int32 numSlots, double slotDuration ) :
+	Slots( new Histogram[numSlots] ),
+	NumSlots( numSlots ),
+	SlotDuration( slotDuration ),
+	CurrentSlot( 0 )
+{
+	check( numSlots > 0 && slotDuration > 0.0 );
+}
+
+
+
+
+void SlidingWindowHistogram::Record( uint64 value, double time )
+{
+	// advance to the slot of the provided time, clearing the slots that are reused (all of them at most, after a long gap)
+	int64 slot = int64( std::floor( time / this->SlotDuration ) );
+	int64 currentSlot = this->CurrentSlot.load( std::memory_order_relaxed );
+	if( slot > currentSlot )
+	{
+		for( int64 newSlot = std::max( currentSlot + 1, slot - this->NumSlots + 1 ); newSlot <= slot; ++newSlot )
+		{
+			this->Slots[newSlot % this->NumSlots].Reset();
+		}
+		this->CurrentSlot.store( slot, std::memory_order_release );
+		currentSlot = slot;
+	}
+
+	this->Slots[currentSlot % this->NumSlots].Record( value );
+}
+
+
+
+
+void SlidingWindowHistogram::GetWindow( double window, double time, Histogram & result ) const
+{
+	result.Reset();
+
+	// slots past the current one have not been recorded into yet, and slots more than NumSlots behind it have been reused
+	int64 slot = int64( std::floor( time / this->SlotDuration ) );
+	int64 currentSlot = this->CurrentSlot.load( std::memory_order_acquire );
+	int32 numSlots = FMath::Clamp( int32( std::ceil( window / this->SlotDuration ) ), 1, this->NumSlots );
+
+	for( int64 windowSlot = std::max( slot - numSlots + 1, currentSlot - this->NumSlots + 1 ); windowSlot <= std::min( slot, currentSlot ); ++windowSlot )
+	{
+		if( windowSlot < 0 ) continue;
+		result.Add( this->Slots[windowSlot % this->NumSlots] );
+	}
+}
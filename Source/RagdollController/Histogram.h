@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+
+
+
+/**
+ * Fixed-size histogram of non-negative integer values (e.g. microseconds) with a bounded relative error, in the style of HdrHistogram.
+ *
+ * Values are grouped by their highest set bit, and each group is split linearly into 2^HISTOGRAM_SUB_BUCKET_BITS sub-buckets, so that the relative width of
+ * a bucket (and thereby the error of a reported percentile) is at most 2^-HISTOGRAM_SUB_BUCKET_BITS. Recording is O(1) and never allocates. The exact
+ * maximum and the sum are tracked separately.
+ *
+ * All counters are atomic, so a thread may record while other threads read, without locks. Readers may observe a record partially (e.g. the count updated
+ * but not the sum yet), which is acceptable for telemetry.
+ */
+class Histogram
+{
+public:
+
+	/** log2 of the number of linear sub-buckets per power of two. 5 gives a relative error of at most ~3%. */
+	static const int32 SubBucketBits = 5;
+
+	/** Values up to 2^MaxValueBits - 1 are distinguished, larger values are counted in the last bucket. */
+	static const int32 MaxValueBits = 40;
+
+	static const int32 SubBucketCount = 1 << SubBucketBits;
+	static const int32 BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBucketCount;
+
+
+private:
+
+	std::array<std::atomic<uint64>, BucketCount> Counts;
+	std::atomic<uint64> TotalCount;
+	std::atomic<uint64> Sum;
+	std::atomic<uint64> MaxValue;
+
+
+	static int32 GetBucketIndex( uint64 value );
+
+	/** The largest value that maps to the bucket. */
+	static uint64 GetBucketUpperBound( int32 index );
+
+
+public:
+
+	Histogram();
+
+	Histogram( const Histogram & ) = delete;
+	Histogram & operator=( const Histogram & ) = delete;
+
+
+	void Record( uint64 value );
+
+	/** Add all values recorded in other. */
+	void Add( const Histogram & other );
+
+	void Reset();
+
+
+	uint64 GetCount() const { return this->TotalCount.load( std::memory_order_relaxed ); }
+	uint64 GetMax() const { return this->MaxValue.load( std::memory_order_relaxed ); }
+
+	/** Mean of the recorded values. Returns 0 if empty. */
+	double GetMean() const;
+
+	/** The value at the provided percentile (0..100), to within the bucket resolution. Returns 0 if empty. */
+	uint64 GetPercentile( double percentile ) const;
+};
+
+
+
+
+/**
+ * Histogram of the values recorded during a sliding time window, made of a ring of fixed-duration slots. Recording touches only the current slot; queries
+ * merge the slots that cover the requested window. Records must come from a single thread, queries may come from any thread.
+ */
+class SlidingWindowHistogram
+{
+	std::unique_ptr<Histogram[]> Slots;
+	int32 NumSlots;
+	double SlotDuration;
+
+	/** Absolute index (time / SlotDuration) of the slot that is currently being recorded into. */
+	std::atomic<int64> CurrentSlot;
+
+
+public:
+
+	SlidingWindowHistogram( int32 numSlots, double slotDuration );
+
+
+	/** Record a value at the provided time. Times must not decrease. */
+	void Record( uint64 value, double time );
+
+	/** Merge the slots that cover the last window seconds before the provided time into result (which is reset first). The window is rounded up to whole
+	 ** slots and includes the current, partially filled slot. At most numSlots * slotDuration seconds are covered. */
+	void GetWindow( double window, double time, Histogram & result ) const;
+};
@@ -31,6 +31,9 @@ namespace pugi
  * On success, all element adder methods return a pugi reference to the added child node.
  * On failure, all element adder methods return the pugi null reference and nothing is added to the document.
  * 
+ * For documents that are written on every tick, prefer MbmlWriter, which streams the elements as text without building a document tree, or MbmlTemplate,
+ * which updates the values of a pre-built document in place.
+ * 
  * 
  * References:
  * 
@@ -0,0 +1,171 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "MbmlWriter.h"
+
+#include <cassert>
+#include <cstring>
+
+
+
+
+const char MbmlBase64Encoder::Alphabet[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+
+
+char * MbmlBase64Encoder::Finish()
+{
+	if( this->GroupBytes > 0 )
+	{
+		this->Out[0] = Alphabet[(this->Group >> 18) & 63];
+		this->Out[1] = Alphabet[(this->Group >> 12) & 63];
+		this->Out[2] = this->GroupBytes > 1 ? Alphabet[(this->Group >> 6) & 63] : '=';
+		this->Out[3] = '=';
+		this->Out += 4;
+		this->Group = 0;
+		this->GroupBytes = 0;
+	}
+
+	return this->Out;
+}
+
+
+
+
+void MbmlWriter::WriteStartTag( const char * name, const char * type, int rows, int cols, MbmlEncoding encoding /*= MbmlTextEncoding*/ )
+{
+	this->Out += '<';
+	this->Out += name;
+	this->Out += " class=\"";
+	this->Out += type;
+	this->Out += "\" size=\"";
+	WriteInt( rows );
+	this->Out += ' ';
+	WriteInt( cols );
+	if( encoding == MbmlBase64Encoding ) this->Out += "\" encoding=\"base64";
+	this->Out += "\">";
+}
+
+
+
+
+void MbmlWriter::WriteEndTag( const char * name )
+{
+	this->Out += "</";
+	this->Out += name;
+	this->Out += '>';
+}
+
+
+
+
+void MbmlWriter::WriteInt( int value )
+{
+	char buffer[12];
+	char * end = buffer + sizeof( buffer );
+	char * begin = end;
+	unsigned int magnitude = value < 0 ? 0u - unsigned( value ) : unsigned( value );
+	do
+	{
+		*--begin = char( '0' + magnitude % 10 );
+		magnitude /= 10;
+	} while( magnitude > 0 );
+	if( value < 0 ) *--begin = '-';
+
+	this->Out.append( begin, end - begin );
+}
+
+
+
+
+void MbmlWriter::BeginStruct( const char * name, int rows /*= 1*/, int cols /*= 1*/ )
+{
+	assert( this->Depth < MaxDepth );
+
+	WriteStartTag( name, "struct", rows, cols );
+	this->OpenStructs[this->Depth++] = name;
+}
+
+
+
+
+void MbmlWriter::EndStruct()
+{
+	assert( this->Depth > 0 );
+
+	WriteEndTag( this->OpenStructs[--this->Depth] );
+}
+
+
+
+
+void MbmlWriter::AddCharArray( const char * name, const char * content )
+{
+	int length = int( std::strlen( content ) );
+	WriteStartTag( name, "char", 1, length );
+
+	// xml4mat encoding (spcharin.m): letters and digits as they are, everything else as #<ascii code>;
+	for( const char * character = content; *character; ++character )
+	{
+		unsigned char code = (unsigned char)*character;
+		if( (code >= '0' && code <= '9') || (code >= 'a' && code <= 'z') || (code >= 'A' && code <= 'Z') )
+		{
+			this->Out += char( code );
+		}
+		else
+		{
+			this->Out += '#';
+			WriteInt( code );
+			this->Out += ';';
+		}
+	}
+
+	WriteEndTag( name );
+}
+
+
+
+
+void MbmlWriter::AddMatrix( const char * name, const float * data, int rows, int cols, MbmlEncoding encoding /*= MbmlTextEncoding*/ )
+{
+	AddMatrix( name, rows, cols, [data, rows]( int row, int col ) { return data[col * rows + row]; }, encoding );
+}
+
+
+
+
+MbmlTemplate::MatrixSlot MbmlWriter::AddMatrixSlot( const char * name, int rows, int cols, MbmlEncoding encoding /*= MbmlTextEncoding*/ )
+{
+	WriteStartTag( name, "single", rows, cols, encoding );
+
+	MbmlTemplate::MatrixSlot slot;
+	slot.Offset = this->Out.size();
+	slot.Rows = rows;
+	slot.Cols = cols;
+	slot.Encoding = encoding;
+
+	if( encoding == MbmlBase64Encoding )
+	{
+		// base64: the encoding of the zeros, which has the length of any encoding of the same number of values
+		this->Out.resize( slot.Offset + MbmlBase64Encoder::GetEncodedLength( std::size_t( rows ) * cols * sizeof( float ) ) );
+		MbmlBase64Encoder encoder( &this->Out[slot.Offset] );
+		for( int value = 0; value < rows * cols; ++value )
+		{
+			encoder.WriteSingle( 0.f );
+		}
+		encoder.Finish();
+	}
+	else
+	{
+		// text: one field per value, "0" padded with spaces
+		for( int value = 0; value < rows * cols; ++value )
+		{
+			this->Out += '0';
+			this->Out.append( MbmlTemplate::FieldWidth - 1, ' ' );
+		}
+	}
+
+	WriteEndTag( name );
+	return slot;
+}
@@ -0,0 +1,251 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "FloatFormat.h"
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+
+
+
+/**
+ * Encodings of the values of MbML matrices.
+ *
+ * MbmlBase64Encoding is an extension of MbML, understood by the patched xml2mat in Test/RemoteControlHub_Matlab: the element has an encoding="base64"
+ * attribute, and its content is the base64 encoding (RFC 4648, padded) of the values as little-endian IEEE 754 numbers of the element's class (4 bytes for
+ * single), in column-major order. Takes 5.3 characters per single instead of up to 16, encodes at close to memcpy speed, and reads back bit-exact.
+ */
+enum MbmlEncoding { MbmlTextEncoding, MbmlBase64Encoding };
+
+
+
+
+/** Streaming base64 encoder for the values of base64-encoded MbML matrices. Writes into a buffer of GetEncodedLength() characters. */
+class MbmlBase64Encoder
+{
+	static const char Alphabet[65];
+
+	char * Out;
+
+	/** The bytes of the current group of three, in the most significant bytes. */
+	std::uint32_t Group = 0;
+	int GroupBytes = 0;
+
+
+	void WriteByte( std::uint32_t byte )
+	{
+		this->Group |= byte << (16 - 8 * this->GroupBytes);
+		if( ++this->GroupBytes == 3 )
+		{
+			this->Out[0] = Alphabet[(this->Group >> 18) & 63];
+			this->Out[1] = Alphabet[(this->Group >> 12) & 63];
+			this->Out[2] = Alphabet[(this->Group >> 6) & 63];
+			this->Out[3] = Alphabet[this->Group & 63];
+			this->Out += 4;
+			this->Group = 0;
+			this->GroupBytes = 0;
+		}
+	}
+
+
+public:
+
+	explicit MbmlBase64Encoder( char * out ) : Out( out ) {}
+
+	/** Number of characters the encoding of numBytes bytes takes. */
+	static std::size_t GetEncodedLength( std::size_t numBytes ) { return (numBytes + 2) / 3 * 4; }
+
+	/** Append a single as four little-endian bytes. */
+	void WriteSingle( float value )
+	{
+		std::uint32_t bits;
+		std::memcpy( &bits, &value, sizeof( bits ) );
+		WriteByte( bits & 0xff );
+		WriteByte( (bits >> 8) & 0xff );
+		WriteByte( (bits >> 16) & 0xff );
+		WriteByte( bits >> 24 );
+	}
+
+	/** Write out the last, incomplete group, padded with '='. Returns the end of the written characters. */
+	char * Finish();
+};
+
+
+
+
+/**
+ * An MbML document that is built once and then updated in place. The values of its matrix elements sit in fixed-width fields, padded with spaces (which
+ * xml2mat ignores), so that an update costs O(values): the tags are not re-written and nothing is allocated.
+ *
+ * Intended for documents that have the same structure every time, such as the responses to a remote controller: build the document into Text with an
+ * MbmlWriter when the structure changes, using MbmlWriter::AddMatrixSlot() for the matrices and keeping the returned slots, then update the slots with
+ * SetMatrix() and send Text whenever the document is needed.
+ */
+class MbmlTemplate
+{
+public:
+
+	/** Width of the field of a value in text encoding, including a separating space. In base64 encoding, values take no fields of their own; the content
+	 ** of a matrix has a fixed length anyway. */
+	static const int FieldWidth = FloatFormat::MaxLength + 1;
+
+	/** Handle to the values of a matrix element of a template. Stays valid until Text is rebuilt. */
+	struct MatrixSlot
+	{
+		std::size_t Offset = 0;
+		int Rows = 0;
+		int Cols = 0;
+		MbmlEncoding Encoding = MbmlTextEncoding;
+	};
+
+
+	/** The document. */
+	std::string Text;
+
+
+	/** Overwrite the values of a matrix, reading them with get( row, col ), in column-major order. */
+	template<typename Getter>
+	void SetMatrix( const MatrixSlot & slot, Getter get )
+	{
+		if( slot.Encoding == MbmlBase64Encoding )
+		{
+			MbmlBase64Encoder encoder( &this->Text[slot.Offset] );
+			for( int col = 0; col < slot.Cols; ++col )
+			{
+				for( int row = 0; row < slot.Rows; ++row )
+				{
+					encoder.WriteSingle( get( row, col ) );
+				}
+			}
+			encoder.Finish();
+			return;
+		}
+
+		char * field = &this->Text[slot.Offset];
+		for( int col = 0; col < slot.Cols; ++col )
+		{
+			for( int row = 0; row < slot.Rows; ++row )
+			{
+				int length = FloatFormat::Write( field, get( row, col ) );
+				std::memset( field + length, ' ', FieldWidth - length );
+				field += FieldWidth;
+			}
+		}
+	}
+};
+
+
+
+
+/**
+ * Streaming writer for MbML documents (@see Mbml): emits the elements directly as text into a string, typically XmlFSocket::OutText, without building a
+ * document tree and without allocating once the string has grown to its steady-state capacity.
+ *
+ * The output follows the conventions of Mbml and of xml4mat on the Matlab side: every element carries the class and size attributes, matrix data is written
+ * in column-major order (the first dimension is contiguous), char arrays are encoded the xml4mat way (every character that is not a letter or a digit as
+ * "#<ascii code>;"), and elements are never self-closing, as xml2mat does not understand that. Floats are written as the shortest string that reads back to
+ * the same single precision value (@see FloatFormat), or in base64 (@see MbmlEncoding).
+ *
+ * Structs are opened with BeginStruct() and closed with EndStruct(); everything added in between becomes a field of the struct. Element names are not
+ * copied: they must stay valid until the element has been closed (string literals are the intended use).
+ */
+class MbmlWriter
+{
+public:
+
+	/** Maximum nesting depth of structs. */
+	static const int MaxDepth = 16;
+
+
+private:
+
+	std::string & Out;
+
+	/** Names of the open structs, innermost last. */
+	const char * OpenStructs[MaxDepth];
+	int Depth = 0;
+
+
+	/** Write a start tag: <name class="type" size="rows cols">, with an encoding attribute unless the encoding is text */
+	void WriteStartTag( const char * name, const char * type, int rows, int cols, MbmlEncoding encoding = MbmlTextEncoding );
+
+	/** Write an end tag: </name> */
+	void WriteEndTag( const char * name );
+
+	void WriteInt( int value );
+
+	void WriteFloat( float value )
+	{
+		char buffer[FloatFormat::MaxLength];
+		this->Out.append( buffer, FloatFormat::Write( buffer, value ) );
+	}
+
+
+public:
+
+	/** Start writing a document at the end of out. The document is complete when all structs have been closed. */
+	explicit MbmlWriter( std::string & out ) : Out( out ) {}
+
+	MbmlWriter( const MbmlWriter & ) = delete;
+	MbmlWriter & operator=( const MbmlWriter & ) = delete;
+
+
+	/** Open a struct element. The root element of a document is typically a scalar struct. Struct arrays are supported: after opening, add all fields of the
+	 ** first struct, then all fields of the second struct, and so on. */
+	void BeginStruct( const char * name, int rows = 1, int cols = 1 );
+
+	/** Close the innermost open struct. */
+	void EndStruct();
+
+	/** Add a char array (string) element. */
+	void AddCharArray( const char * name, const char * content );
+
+	/** Add a single precision matrix element. The data is read in column-major order. */
+	void AddMatrix( const char * name, const float * data, int rows, int cols, MbmlEncoding encoding = MbmlTextEncoding );
+
+	/** Add a single precision matrix element, reading the elements with get( row, col ), in column-major order. Saves copying strided data (e.g. one field
+	 ** of each element of an array of structs) into a contiguous buffer first. */
+	template<typename Getter>
+	void AddMatrix( const char * name, int rows, int cols, Getter get, MbmlEncoding encoding = MbmlTextEncoding )
+	{
+		WriteStartTag( name, "single", rows, cols, encoding );
+		if( encoding == MbmlBase64Encoding )
+		{
+			std::size_t begin = this->Out.size();
+			this->Out.resize( begin + MbmlBase64Encoder::GetEncodedLength( std::size_t( rows ) * cols * sizeof( float ) ) );
+			MbmlBase64Encoder encoder( &this->Out[begin] );
+			for( int col = 0; col < cols; ++col )
+			{
+				for( int row = 0; row < rows; ++row )
+				{
+					encoder.WriteSingle( get( row, col ) );
+				}
+			}
+			encoder.Finish();
+			WriteEndTag( name );
+			return;
+		}
+
+		for( int col = 0; col < cols; ++col )
+		{
+			for( int row = 0; row < rows; ++row )
+			{
+				if( row > 0 || col > 0 ) this->Out += ' ';
+				WriteFloat( get( row, col ) );
+			}
+		}
+		WriteEndTag( name );
+	}
+
+	void AddScalar( const char * name, float value ) { AddMatrix( name, &value, 1, 1 ); }
+
+	/** Add a single precision matrix element to a template document, with all values set to 0. The values are written later, in place, with
+	 ** MbmlTemplate::SetMatrix(); the returned slot refers to the position of the values in the written string. */
+	MbmlTemplate::MatrixSlot AddMatrixSlot( const char * name, int rows, int cols, MbmlEncoding encoding = MbmlTextEncoding );
+
+	/** Whether all structs have been closed. */
+	bool IsComplete() const { return this->Depth == 0; }
+};
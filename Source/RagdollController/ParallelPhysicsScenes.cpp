@@ -0,0 +1,290 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "ParallelPhysicsScenes.h"
+
+#include "ControlledRagdoll.h"
+
+#include <ParallelFor.h>
+#include <PhysicsEngine/PhysicsSettings.h>
+
+#include <PxPhysics.h>
+#include <PxScene.h>
+#include <PxSceneLock.h>
+#include <PxRigidDynamic.h>
+#include <PxRigidStatic.h>
+#include <PxAggregate.h>
+#include <extensions/PxDefaultCpuDispatcher.h>
+#include <extensions/PxSimpleFactory.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+
+
+
+
+ParallelPhysicsScenes::ParallelPhysicsScenes( physx::PxScene * worldScene ) :
+	WorldScene( worldScene )
+{
+	check( this->WorldScene );
+}
+
+
+
+
+ParallelPhysicsScenes::~ParallelPhysicsScenes()
+{
+	// return all ragdolls to the world scene. RemoveRagdoll() releases emptied scenes, so always pick the last ragdoll of the last scene.
+	while( this->Scenes.Num() > 0 )
+	{
+		Scene & scene = *this->Scenes.Last();
+		if( scene.Ragdolls.empty() )
+		{
+			ReleaseScene( scene );
+			this->Scenes.Pop();
+			continue;
+		}
+		RemoveRagdoll( scene.Ragdolls.back() );
+	}
+}
+
+
+
+
+std::unique_ptr<ParallelPhysicsScenes::Scene> ParallelPhysicsScenes::CreateScene( FName group )
+{
+	std::unique_ptr<Scene> scene( new Scene );
+	scene->Group = group;
+
+	physx::PxSceneReadLock worldLock( *this->WorldScene );
+	physx::PxPhysics & physics = this->WorldScene->getPhysics();
+
+	// copy the world scene's settings. Each private scene is stepped by a single pool thread, so no PhysX worker threads are needed (a dispatcher
+	// with zero threads runs all simulation tasks on the calling thread), and no PhysX level locking either.
+	physx::PxSceneDesc desc( physics.getTolerancesScale() );
+	desc.gravity = this->WorldScene->getGravity();
+	desc.filterShader = this->WorldScene->getFilterShader();
+	desc.filterShaderData = this->WorldScene->getFilterShaderData();
+	desc.filterShaderDataSize = this->WorldScene->getFilterShaderDataSize();
+	desc.bounceThresholdVelocity = this->WorldScene->getBounceThresholdVelocity();
+	desc.solverBatchSize = this->WorldScene->getSolverBatchSize();
+	desc.flags = this->WorldScene->getFlags();
+	desc.flags.clear( physx::PxSceneFlag::eREQUIRE_RW_LOCK );
+
+	scene->CpuDispatcher = physx::PxDefaultCpuDispatcherCreate( 0 );
+	desc.cpuDispatcher = scene->CpuDispatcher;
+	if( !scene->CpuDispatcher || !desc.isValid() ) return nullptr;
+
+	scene->PxScene = physics.createScene( desc );
+	if( !scene->PxScene )
+	{
+		scene->CpuDispatcher->release();
+		return nullptr;
+	}
+
+	// clone the static geometry
+	std::vector<physx::PxActor *> statics( this->WorldScene->getNbActors( physx::PxActorTypeFlag::eRIGID_STATIC ) );
+	this->WorldScene->getActors( physx::PxActorTypeFlag::eRIGID_STATIC, statics.data(), statics.size() );
+	scene->StaticActors.reserve( statics.size() );
+	for( physx::PxActor * actor : statics )
+	{
+		physx::PxRigidStatic * original = static_cast<physx::PxRigidStatic *>(actor);
+		physx::PxRigidStatic * clone = physx::PxCloneStatic( physics, original->getGlobalPose(), *original );
+		if( !clone ) continue;
+
+		scene->PxScene->addActor( *clone );
+		scene->StaticActors.push_back( clone );
+	}
+
+	UE_LOG( LogRcSystem, Log, TEXT( "(%s) Private physics scene created for group '%s' (%d static actors cloned)." ), TEXT( __FUNCTION__ ),
+		*group.ToString(), (int32)scene->StaticActors.size() );
+
+	return scene;
+}
+
+
+
+
+void ParallelPhysicsScenes::ReleaseScene( Scene & scene )
+{
+	check( scene.Ragdolls.empty() );
+
+	// releasing the scene would only remove our static clones, release them explicitly first
+	for( physx::PxRigidStatic * actor : scene.StaticActors )
+	{
+		actor->release();
+	}
+	scene.StaticActors.clear();
+
+	scene.PxScene->release();
+	scene.PxScene = nullptr;
+	scene.CpuDispatcher->release();
+	scene.CpuDispatcher = nullptr;
+}
+
+
+
+
+bool ParallelPhysicsScenes::MoveRagdoll( AControlledRagdoll * ragdoll, physx::PxScene & from, physx::PxScene & to )
+{
+	USkeletalMeshComponent * skeletalMeshComponent = ragdoll->GetSkeletalMeshComponent();
+
+	// collect the actors to be moved. UE puts the bodies of larger skeletons into a PxAggregate, which has to be moved as a whole.
+	std::vector<physx::PxRigidDynamic *> actors;
+	std::vector<physx::PxAggregate *> aggregates;
+	for( FBodyInstance * bodyInstance : skeletalMeshComponent->Bodies )
+	{
+		physx::PxRigidDynamic * pxBody = bodyInstance ? bodyInstance->GetPxRigidDynamic() : nullptr;
+		if( !pxBody || pxBody->getScene() != &from ) return false;
+
+		if( physx::PxAggregate * aggregate = pxBody->getAggregate() )
+		{
+			if( std::find( aggregates.begin(), aggregates.end(), aggregate ) == aggregates.end() ) aggregates.push_back( aggregate );
+		}
+		else
+		{
+			actors.push_back( pxBody );
+		}
+	}
+
+	// move. Joints follow their actors: PhysX removes a constraint from a scene with either of its actors, and adds it back once both actors are in the
+	// same scene again.
+	physx::PxSceneWriteLock fromLock( from );
+	physx::PxSceneWriteLock toLock( to );
+	for( physx::PxAggregate * aggregate : aggregates )
+	{
+		from.removeAggregate( *aggregate );
+		to.addAggregate( *aggregate );
+	}
+	for( physx::PxRigidDynamic * actor : actors )
+	{
+		from.removeActor( *actor );
+		to.addActor( *actor );
+	}
+
+	return true;
+}
+
+
+
+
+bool ParallelPhysicsScenes::AddRagdoll( AControlledRagdoll * ragdoll, FName group )
+{
+	check( ragdoll );
+
+	// find the scene of a named group, or create a new scene
+	Scene * scene = nullptr;
+	if( group != NAME_None )
+	{
+		for( auto & candidate : this->Scenes )
+		{
+			if( candidate->Group == group ) scene = candidate.get();
+		}
+	}
+	if( !scene )
+	{
+		std::unique_ptr<Scene> newScene = CreateScene( group );
+		if( !newScene )
+		{
+			UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to create a private physics scene!" ), TEXT( __FUNCTION__ ) );
+			return false;
+		}
+		scene = newScene.get();
+		this->Scenes.Add( std::move( newScene ) );
+	}
+
+	// move the ragdoll
+	if( !MoveRagdoll( ragdoll, *this->WorldScene, *scene->PxScene ) )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to move %s into a private physics scene!" ), TEXT( __FUNCTION__ ), *ragdoll->GetHumanReadableName() );
+		if( scene->Ragdolls.empty() )
+		{
+			ReleaseScene( *scene );
+			this->Scenes.Pop();
+		}
+		return false;
+	}
+
+	scene->Ragdolls.push_back( ragdoll );
+	return true;
+}
+
+
+
+
+void ParallelPhysicsScenes::RemoveRagdoll( AControlledRagdoll * ragdoll )
+{
+	for( int32 sceneInd = 0; sceneInd < this->Scenes.Num(); ++sceneInd )
+	{
+		Scene & scene = *this->Scenes[sceneInd];
+
+		auto iter = std::find( scene.Ragdolls.begin(), scene.Ragdolls.end(), ragdoll );
+		if( iter == scene.Ragdolls.end() ) continue;
+
+		// move the ragdoll back to the world scene
+		if( !MoveRagdoll( ragdoll, *scene.PxScene, *this->WorldScene ) )
+		{
+			UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to return %s to the world physics scene!" ), TEXT( __FUNCTION__ ), *ragdoll->GetHumanReadableName() );
+		}
+		scene.Ragdolls.erase( iter );
+
+		// release the scene if it became empty
+		if( scene.Ragdolls.empty() )
+		{
+			ReleaseScene( scene );
+			this->Scenes.RemoveAt( sceneInd );
+		}
+		return;
+	}
+}
+
+
+
+
+void ParallelPhysicsScenes::StepScene( Scene & scene, float deltaSeconds )
+{
+	// substep like UE does for the world scene
+	const UPhysicsSettings * physicsSettings = UPhysicsSettings::Get();
+	int32 numSubsteps = 1;
+	if( physicsSettings->bSubstepping && physicsSettings->MaxSubstepDeltaTime > 0.f )
+	{
+		numSubsteps = FMath::Clamp( (int32)std::ceil( deltaSeconds / physicsSettings->MaxSubstepDeltaTime ), 1, FMath::Max( physicsSettings->MaxSubsteps, 1 ) );
+	}
+	float substepDeltaSeconds = deltaSeconds / numSubsteps;
+
+	for( int32 substep = 0; substep < numSubsteps; ++substep )
+	{
+		// PhysX clears applied forces after each simulate() call, so re-apply torques before every substep
+		for( AControlledRagdoll * ragdoll : scene.Ragdolls )
+		{
+			ragdoll->ApplyPrivateSceneTorques();
+		}
+
+		scene.PxScene->simulate( substepDeltaSeconds );
+		scene.PxScene->fetchResults( true );
+	}
+}
+
+
+
+
+void ParallelPhysicsScenes::Step( float deltaSeconds )
+{
+	if( deltaSeconds <= 0.f || this->Scenes.Num() == 0 ) return;
+
+	// scenes are independent, so step each on its own pool thread
+	ParallelFor( this->Scenes.Num(), [this, deltaSeconds]( int32 sceneInd ) {
+		StepScene( *this->Scenes[sceneInd], deltaSeconds );
+	} );
+
+	// torques have been consumed
+	for( auto & scene : this->Scenes )
+	{
+		for( AControlledRagdoll * ragdoll : scene->Ragdolls )
+		{
+			ragdoll->ClearPrivateSceneTorques();
+		}
+	}
+}
@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <vector>
+#include <memory>
+
+namespace physx
+{
+	class PxScene;
+	class PxRigidStatic;
+	class PxDefaultCpuDispatcher;
+};
+
+class AControlledRagdoll;
+
+
+
+
+/**
+ * Private PhysX scenes for ragdolls that do not interact with each other, stepped concurrently on the task graph worker pool.
+ *
+ * Ragdolls added with AddRagdoll() are moved out of the world's PhysX scene into a private scene. Ragdolls that share a scene group name are placed in the
+ * same scene and interact with each other; an unnamed group (NAME_None) always gets a scene of its own. The static geometry of the world scene is cloned
+ * into each private scene on creation; dynamic and kinematic actors of the world scene are not visible to private scenes.
+ *
+ * The UE physics scene knows nothing about private scenes: bodies keep their FBodyInstances, and UE keeps reading their poses directly from PhysX, but any
+ * forces must be applied via AControlledRagdoll::ApplyPrivateSceneTorques(), as UE's substepped force queue is tied to the world scene. Step() must be
+ * called once per tick after all ragdolls have written their torques, and before UE syncs the skeletal meshes to their bodies (TG_EndPhysics).
+ */
+class ParallelPhysicsScenes
+{
+
+	/** A single private scene and the ragdolls simulated in it. */
+	struct Scene
+	{
+		/** Scene group name, NAME_None for single-ragdoll scenes. */
+		FName Group;
+
+		physx::PxScene * PxScene = nullptr;
+		physx::PxDefaultCpuDispatcher * CpuDispatcher = nullptr;
+
+		/** Clones of the world scene's static actors. These are owned by us. */
+		std::vector<physx::PxRigidStatic *> StaticActors;
+
+		/** Ragdolls that have been moved into this scene. */
+		std::vector<AControlledRagdoll *> Ragdolls;
+	};
+
+
+	/** The world's PhysX scene (the synchronous scene of the UWorld), where ragdolls come from and are returned to. */
+	physx::PxScene * WorldScene;
+
+	/** All private scenes. */
+	TArray< std::unique_ptr<Scene> > Scenes;
+
+
+	/** Create a new private scene with the world scene's settings and a copy of its static geometry. Returns null on failure. */
+	std::unique_ptr<Scene> CreateScene( FName group );
+
+	/** Release a private scene and its static geometry. The scene must not contain any ragdolls. */
+	static void ReleaseScene( Scene & scene );
+
+	/** Move all PhysX actors (and thereby the joints between them) of the ragdoll from one scene to another. */
+	static bool MoveRagdoll( AControlledRagdoll * ragdoll, physx::PxScene & from, physx::PxScene & to );
+
+	/** Step a single scene by deltaSeconds, using substeps according to the project's physics settings. */
+	static void StepScene( Scene & scene, float deltaSeconds );
+
+
+public:
+
+	/** Constructs an empty set of private scenes for the provided world scene. */
+	ParallelPhysicsScenes( physx::PxScene * worldScene );
+
+	/** Returns all ragdolls back to the world scene and releases all private scenes. */
+	~ParallelPhysicsScenes();
+
+
+	/** Move the ragdoll into a private scene of the given group, creating the scene if needed. Returns false on failure, in which case the ragdoll stays
+	 ** in the world scene. */
+	bool AddRagdoll( AControlledRagdoll * ragdoll, FName group );
+
+	/** Return the ragdoll to the world scene. No-op if the ragdoll has not been added. Empty private scenes are released. */
+	void RemoveRagdoll( AControlledRagdoll * ragdoll );
+
+	/** Step all private scenes concurrently and wait for the results. */
+	void Step( float deltaSeconds );
+
+};
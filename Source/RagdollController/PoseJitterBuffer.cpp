@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "PoseJitterBuffer.h"
+
+#include <PxQuat.h>
+
+#include <cmath>
+#include <algorithm>
+
+
+// clock offset tracking: smoothing factors for samples that indicate a shorter (rise) or longer (decay) network delay than the current estimate. The
+// estimate follows the fastest deliveries quickly and forgets them slowly, so that it is not dragged around by jitter.
+#define POSE_JITTER_CLOCK_RISE 0.5
+#define POSE_JITTER_CLOCK_DECAY 0.01
+
+// clock offset tracking: reset the estimate if a sample is off by more than this (seconds), e.g. after a server restart or a hitch
+#define POSE_JITTER_CLOCK_RESET_THRESHOLD 1.0
+
+
+
+
+namespace
+{
+	physx::PxQuat IntegrateRotation( const physx::PxQuat & q, const physx::PxVec3 & angularVelocity, float dt )
+	{
+		float angularSpeed = angularVelocity.magnitude();
+		if( angularSpeed * dt < 1e-6f ) return q;
+
+		return (physx::PxQuat( angularSpeed * dt, angularVelocity / angularSpeed ) * q).getNormalized();
+	}
+}
+
+
+
+
+PoseJitterBuffer::PoseJitterBuffer( int32 capacity )
+{
+	check( capacity >= 2 );
+	this->Entries.SetNum( capacity );
+}
+
+
+
+
+void PoseJitterBuffer::Push( double serverTimestamp, double localTime, const FBodyStates & states )
+{
+	// update the clock offset estimate
+	double offsetSample = serverTimestamp - localTime;
+	if( !this->HasClockOffset || std::abs( offsetSample - this->ClockOffset ) > POSE_JITTER_CLOCK_RESET_THRESHOLD )
+	{
+		// (re)start from scratch: buffered poses are on a different time line
+		Reset();
+		this->ClockOffset = offsetSample;
+		this->HasClockOffset = true;
+	}
+	else
+	{
+		this->ClockOffset += (offsetSample - this->ClockOffset) * (offsetSample > this->ClockOffset ? POSE_JITTER_CLOCK_RISE : POSE_JITTER_CLOCK_DECAY);
+	}
+
+	// drop stale poses and poses for a different skeleton
+	if( this->Count > 0 )
+	{
+		const Entry & newest = GetEntry( this->Count - 1 );
+		if( serverTimestamp <= newest.Timestamp ) return;
+		if( states.Num() != newest.States.Num() ) this->Count = 0;
+	}
+
+	// drop the oldest pose if full
+	if( this->Count == this->Entries.Num() )
+	{
+		this->Head = (this->Head + 1) % this->Entries.Num();
+		--this->Count;
+	}
+
+	// store, reusing the allocations of the recycled entry
+	Entry & entry = this->Entries[(this->Head + this->Count) % this->Entries.Num()];
+	entry.Timestamp = serverTimestamp;
+	entry.States.SetNum( states.Num() );
+	for( int32 body = 0; body < states.Num(); ++body )
+	{
+		entry.States.Poses[body] = states.Poses[body];
+		entry.States.LinearVelocities[body] = states.LinearVelocities[body];
+		entry.States.AngularVelocities[body] = states.AngularVelocities[body];
+	}
+	++this->Count;
+}
+
+
+
+
+bool PoseJitterBuffer::Sample( double localTime, float playoutDelay, float maxExtrapolation, FBodyStates & states )
+{
+	if( this->Count == 0 ) return false;
+
+	// map local time to the server's time line, and clamp to what can be interpolated or extrapolated
+	const Entry & newest = GetEntry( this->Count - 1 );
+	double playoutTime = localTime + this->ClockOffset - playoutDelay;
+	playoutTime = FMath::Clamp( playoutTime, GetEntry( 0 ).Timestamp, newest.Timestamp + maxExtrapolation );
+
+	// nothing to do if the output would not change (e.g. the buffer has run dry and extrapolation is capped)
+	if( playoutTime == this->LastPlayoutTime && newest.Timestamp == this->LastNewestTimestamp ) return false;
+	this->LastPlayoutTime = playoutTime;
+	this->LastNewestTimestamp = newest.Timestamp;
+
+	if( playoutTime >= newest.Timestamp )
+	{
+		// late: extrapolate the newest pose along its velocities
+		int32 numBodies = newest.States.Num();
+		states.SetNum( numBodies );
+		float dt = float( playoutTime - newest.Timestamp );
+		for( int32 body = 0; body < numBodies; ++body )
+		{
+			const physx::PxTransform & pose = newest.States.Poses[body];
+			states.Poses[body] = physx::PxTransform( pose.p + newest.States.LinearVelocities[body] * dt,
+				IntegrateRotation( pose.q, newest.States.AngularVelocities[body], dt ) );
+			states.LinearVelocities[body] = newest.States.LinearVelocities[body];
+			states.AngularVelocities[body] = newest.States.AngularVelocities[body];
+		}
+
+		// keep only the newest pose, older ones cannot be needed anymore
+		this->Head = (this->Head + this->Count - 1) % this->Entries.Num();
+		this->Count = 1;
+		return true;
+	}
+
+	// find the bracketing poses: the newest pose that is not after the playout time, and its successor
+	int32 first = this->Count - 2;
+	while( first > 0 && GetEntry( first ).Timestamp > playoutTime ) --first;
+	const Entry & a = GetEntry( first );
+	const Entry & b = GetEntry( first + 1 );
+
+	// interpolate
+	FBodyStates::Lerp( a.States, b.States, float( (playoutTime - a.Timestamp) / (b.Timestamp - a.Timestamp) ), states );
+
+	// drop poses older than the first bracketing pose
+	this->Head = (this->Head + first) % this->Entries.Num();
+	this->Count -= first;
+	return true;
+}
+
+
+
+
+void PoseJitterBuffer::Reset()
+{
+	this->Head = 0;
+	this->Count = 0;
+	this->HasClockOffset = false;
+	this->LastPlayoutTime = -INFINITY;
+	this->LastNewestTimestamp = -INFINITY;
+}
@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PoseReplication.h"
+
+
+
+
+/**
+ * Client-side playout buffer for poses received from the server.
+ *
+ * Received poses are stored with the server's timestamps. Sample() maps the local time to the server's time line (using a smoothed estimate of the clock
+ * offset), subtracts a playout delay, and interpolates between the two buffered poses that bracket the resulting playout time. If the playout time is past
+ * the newest pose (packets are late or lost), then the newest pose is extrapolated using its velocities, up to a limit.
+ *
+ * Entries are recycled in place, so that a warmed-up buffer does not allocate.
+ */
+class PoseJitterBuffer
+{
+
+	/** A received pose and its server timestamp. */
+	struct Entry
+	{
+		double Timestamp;
+		FBodyStates States;
+	};
+
+
+	/** Ring buffer of received poses, ordered by timestamp. The oldest entry is at index Head. */
+	TArray<Entry> Entries;
+	int32 Head = 0;
+	int32 Count = 0;
+
+	/** Smoothed estimate of (server time - local time). */
+	double ClockOffset = 0.0;
+	bool HasClockOffset = false;
+
+	/** Playout time and newest timestamp of the last output of Sample(), for detecting unchanged output. */
+	double LastPlayoutTime = -INFINITY;
+	double LastNewestTimestamp = -INFINITY;
+
+
+	const Entry & GetEntry( int32 ind ) const { return this->Entries[(this->Head + ind) % this->Entries.Num()]; }
+
+
+public:
+
+	/** Constructs an empty buffer that holds at most capacity poses. */
+	PoseJitterBuffer( int32 capacity = 16 );
+
+
+	/** Store a received pose. Poses that are not newer than the newest buffered pose are dropped. If the buffer is full, then the oldest pose is dropped. */
+	void Push( double serverTimestamp, double localTime, const FBodyStates & states );
+
+	/**
+	 * Compute the pose to be shown at the provided local time.
+	 *
+	 * @param playoutDelay How far (seconds) behind the estimated server time to play out. Should cover the expected network jitter.
+	 * @param maxExtrapolation Limit (seconds) for extrapolating past the newest pose.
+	 * @param states Output. Untouched if false is returned.
+	 * @return False if the buffer is empty, or if the output would be identical to that of the previous call.
+	 */
+	bool Sample( double localTime, float playoutDelay, float maxExtrapolation, FBodyStates & states );
+
+	/** Drop all buffered poses and the clock offset estimate. */
+	void Reset();
+
+};
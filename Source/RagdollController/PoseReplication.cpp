@@ -0,0 +1,409 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "PoseReplication.h"
+
+#include <PxQuat.h>
+
+#include <cmath>
+#include <algorithm>
+
+
+// position quantization: resolution in world units (cm) and bit count. 16 bits at 1/64 cm covers +-512 cm around the origin.
+#define POSE_POSITION_RESOLUTION (1.f / 64.f)
+#define POSE_POSITION_BITS 16
+
+// velocity quantization: bit count and the allowed range for the per-bone scale exponents
+#define POSE_VELOCITY_BITS 12
+#define POSE_VELOCITY_MIN_EXPONENT -8
+#define POSE_VELOCITY_MAX_EXPONENT 20
+
+// rotation quantization: bits per smallest-three component (3 * 10 + 2 = 32 bits per rotation)
+#define POSE_ROTATION_COMPONENT_BITS 10
+
+// sanity limit for the number of bones in a received pose
+#define POSE_MAX_BONES 1024
+
+
+
+
+namespace
+{
+	const int32 PositionMax = (1 << (POSE_POSITION_BITS - 1)) - 1;
+	const int32 VelocityMax = (1 << (POSE_VELOCITY_BITS - 1)) - 1;
+	const int32 RotationComponentMax = (1 << POSE_ROTATION_COMPONENT_BITS) - 1;
+	const float RotationComponentRange = 0.70710678f;   // 1 / sqrt(2): bound for the three smallest components of a unit quaternion
+
+
+	int16 QuantizeSigned( float value, float scale, int32 max )
+	{
+		return (int16)FMath::Clamp( FMath::RoundToInt( value * scale ), -max, max );
+	}
+
+
+	uint32 QuantizeRotation( const physx::PxQuat & quat )
+	{
+		float q[4] = { quat.x, quat.y, quat.z, quat.w };
+
+		// find the largest component, it is dropped and reconstructed from the others
+		uint32 largest = 0;
+		for( uint32 i = 1; i < 4; ++i )
+		{
+			if( std::abs( q[i] ) > std::abs( q[largest] ) ) largest = i;
+		}
+
+		// q and -q represent the same rotation: flip so that the dropped component is positive
+		float sign = q[largest] < 0.f ? -1.f : 1.f;
+
+		uint32 packed = largest;
+		for( uint32 i = 0; i < 4; ++i )
+		{
+			if( i == largest ) continue;
+
+			float normalized = FMath::Clamp( (sign * q[i] / RotationComponentRange + 1.f) * 0.5f, 0.f, 1.f );
+			packed = (packed << POSE_ROTATION_COMPONENT_BITS) | (uint32)FMath::RoundToInt( normalized * RotationComponentMax );
+		}
+
+		return packed;
+	}
+
+
+	physx::PxQuat DequantizeRotation( uint32 packed )
+	{
+		float q[4];
+		int32 largest = int32( packed >> (3 * POSE_ROTATION_COMPONENT_BITS) );
+
+		// unpack the three smallest components (in reverse order of packing)
+		float sumOfSquares = 0.f;
+		for( int32 i = 3; i >= 0; --i )
+		{
+			if( i == largest ) continue;
+
+			float normalized = float( packed & RotationComponentMax ) / RotationComponentMax;
+			packed >>= POSE_ROTATION_COMPONENT_BITS;
+
+			q[i] = (normalized * 2.f - 1.f) * RotationComponentRange;
+			sumOfSquares += q[i] * q[i];
+		}
+
+		// reconstruct the largest component
+		q[largest] = std::sqrt( std::max( 1.f - sumOfSquares, 0.f ) );
+
+		return physx::PxQuat( q[0], q[1], q[2], q[3] ).getNormalized();
+	}
+
+
+	/** Choose the smallest power-of-two scale exponent that covers all components of the provided vector. */
+	int8 ChooseVelocityExponent( const physx::PxVec3 & vector )
+	{
+		float maxAbs = vector.abs().maxElement();
+
+		int exponent = POSE_VELOCITY_MIN_EXPONENT;
+		if( maxAbs > 0.f )
+		{
+			std::frexp( maxAbs, &exponent );   // maxAbs = m * 2^exponent, m in [0.5, 1)
+		}
+
+		return (int8)FMath::Clamp( exponent, POSE_VELOCITY_MIN_EXPONENT, POSE_VELOCITY_MAX_EXPONENT );
+	}
+
+
+	/** Whether two body states differ by more than the provided thresholds. Velocity thresholds are the pose thresholds times velocityThresholdScale. */
+	bool IsChanged( const physx::PxTransform & pose, const physx::PxVec3 & linearVelocity, const physx::PxVec3 & angularVelocity,
+		const physx::PxTransform & otherPose, const physx::PxVec3 & otherLinearVelocity, const physx::PxVec3 & otherAngularVelocity,
+		float positionThreshold, float rotationThreshold, float velocityThresholdScale )
+	{
+		return (pose.p - otherPose.p).magnitudeSquared() > positionThreshold * positionThreshold
+			|| std::abs( pose.q.dot( otherPose.q ) ) < std::cos( 0.5f * rotationThreshold )   // |dot(q1, q2)| = cos(angle / 2)
+			|| (linearVelocity - otherLinearVelocity).magnitudeSquared() > FMath::Square( positionThreshold * velocityThresholdScale )
+			|| (angularVelocity - otherAngularVelocity).magnitudeSquared() > FMath::Square( rotationThreshold * velocityThresholdScale );
+	}
+
+
+	/** Serialize a signed fixed-point value with the given number of bits. */
+	void SerializeSigned( FArchive & Ar, int16 & value, int32 bits )
+	{
+		const int32 max = (1 << (bits - 1)) - 1;
+
+		uint32 offsetValue = uint32( int32( value ) + max );
+		Ar.SerializeInt( offsetValue, 2 * max + 1 );
+		value = int16( int32( offsetValue ) - max );
+	}
+}
+
+
+
+
+bool FBodyStates::HasChanged( int32 body, const FBodyStates & other, float positionThreshold, float rotationThreshold, float velocityThresholdScale ) const
+{
+	return IsChanged( this->Poses[body], this->LinearVelocities[body], this->AngularVelocities[body],
+		other.Poses[body], other.LinearVelocities[body], other.AngularVelocities[body], positionThreshold, rotationThreshold, velocityThresholdScale );
+}
+
+
+
+
+void FBodyStates::Lerp( const FBodyStates & a, const FBodyStates & b, float t, FBodyStates & result )
+{
+	int32 numBodies = a.Num();
+	check( b.Num() == numBodies );
+	result.SetNum( numBodies );
+
+	for( int32 body = 0; body < numBodies; ++body )
+	{
+		const physx::PxTransform & poseA = a.Poses[body];
+		const physx::PxTransform & poseB = b.Poses[body];
+
+		// normalized lerp is close enough to slerp for the small angles between consecutive poses. Take the short way around.
+		physx::PxQuat quatB = poseA.q.dot( poseB.q ) < 0.f ? -poseB.q : poseB.q;
+		physx::PxQuat quat = (poseA.q * (1.f - t) + quatB * t).getNormalized();
+
+		result.Poses[body] = physx::PxTransform( poseA.p + (poseB.p - poseA.p) * t, quat );
+		result.LinearVelocities[body] = a.LinearVelocities[body] + (b.LinearVelocities[body] - a.LinearVelocities[body]) * t;
+		result.AngularVelocities[body] = a.AngularVelocities[body] + (b.AngularVelocities[body] - a.AngularVelocities[body]) * t;
+	}
+}
+
+
+
+
+void FQuantizedBoneState::Quantize( const physx::PxVec3 & origin, const physx::PxTransform & pose, const physx::PxVec3 & linearVelocity,
+	const physx::PxVec3 & angularVelocity )
+{
+	this->LinearVelocityExponent = ChooseVelocityExponent( linearVelocity );
+	this->AngularVelocityExponent = ChooseVelocityExponent( angularVelocity );
+
+	const physx::PxVec3 relativePosition = pose.p - origin;
+	const float positionScale = 1.f / POSE_POSITION_RESOLUTION;
+	const float linearVelocityScale = VelocityMax / std::ldexp( 1.f, this->LinearVelocityExponent );
+	const float angularVelocityScale = VelocityMax / std::ldexp( 1.f, this->AngularVelocityExponent );
+
+	this->Rotation = QuantizeRotation( pose.q );
+	for( int32 i = 0; i < 3; ++i )
+	{
+		this->Position[i] = QuantizeSigned( relativePosition[i], positionScale, PositionMax );
+		this->LinearVelocity[i] = QuantizeSigned( linearVelocity[i], linearVelocityScale, VelocityMax );
+		this->AngularVelocity[i] = QuantizeSigned( angularVelocity[i], angularVelocityScale, VelocityMax );
+	}
+}
+
+
+
+
+void FQuantizedBoneState::Dequantize( const physx::PxVec3 & origin, physx::PxTransform & pose, physx::PxVec3 & linearVelocity,
+	physx::PxVec3 & angularVelocity ) const
+{
+	const float linearVelocityScale = std::ldexp( 1.f, this->LinearVelocityExponent ) / VelocityMax;
+	const float angularVelocityScale = std::ldexp( 1.f, this->AngularVelocityExponent ) / VelocityMax;
+
+	pose.q = DequantizeRotation( this->Rotation );
+	for( int32 i = 0; i < 3; ++i )
+	{
+		pose.p[i] = origin[i] + this->Position[i] * POSE_POSITION_RESOLUTION;
+		linearVelocity[i] = this->LinearVelocity[i] * linearVelocityScale;
+		angularVelocity[i] = this->AngularVelocity[i] * angularVelocityScale;
+	}
+}
+
+
+
+
+void FQuantizedBoneState::NetSerialize( FArchive & Ar )
+{
+	Ar << this->Rotation;
+	for( int32 i = 0; i < 3; ++i )
+	{
+		SerializeSigned( Ar, this->Position[i], POSE_POSITION_BITS );
+	}
+
+	Ar << this->LinearVelocityExponent;
+	for( int32 i = 0; i < 3; ++i )
+	{
+		SerializeSigned( Ar, this->LinearVelocity[i], POSE_VELOCITY_BITS );
+	}
+
+	Ar << this->AngularVelocityExponent;
+	for( int32 i = 0; i < 3; ++i )
+	{
+		SerializeSigned( Ar, this->AngularVelocity[i], POSE_VELOCITY_BITS );
+	}
+}
+
+
+
+
+float FQuantizedBoneState::GetPositionRange()
+{
+	return PositionMax * POSE_POSITION_RESOLUTION;
+}
+
+
+
+
+bool FBoneStateItem::NetSerialize( FArchive & Ar, class UPackageMap * Map, bool & bOutSuccess )
+{
+	uint32 boneIndex = (uint32)this->BoneIndex;
+	Ar.SerializeIntPacked( boneIndex );
+	if( Ar.IsLoading() )
+	{
+		if( boneIndex >= POSE_MAX_BONES )
+		{
+			Ar.SetError();
+			bOutSuccess = false;
+			return true;
+		}
+		this->BoneIndex = (int32)boneIndex;
+	}
+
+	this->State.NetSerialize( Ar );
+
+	bOutSuccess = !Ar.IsError();
+	return true;
+}
+
+
+
+
+int32 FBoneStateArray::Update( FVector & origin, const FVector & actorLocation, const FBodyStates & bodyStates, float positionThreshold,
+	float rotationThreshold, float velocityThresholdScale )
+{
+	int32 numBones = bodyStates.Num();
+	bool markAll = false;
+
+	// (re)build the item array if the skeleton changed
+	if( this->Items.Num() != numBones )
+	{
+		this->Items.SetNum( numBones );
+		for( int32 bone = 0; bone < numBones; ++bone )
+		{
+			this->Items[bone].BoneIndex = bone;
+		}
+		MarkArrayDirty();
+		markAll = true;
+	}
+
+	// re-anchor the origin if the actor has drifted halfway to the edge of the representable range; all relative positions change then
+	if( (actorLocation - origin).GetAbsMax() > 0.5f * FQuantizedBoneState::GetPositionRange() )
+	{
+		origin = actorLocation;
+		markAll = true;
+	}
+
+	const physx::PxVec3 pxOrigin( origin.X, origin.Y, origin.Z );
+
+	int32 numDirty = 0;
+	for( int32 bone = 0; bone < numBones; ++bone )
+	{
+		FBoneStateItem & item = this->Items[bone];
+		const physx::PxTransform & pose = bodyStates.Poses[bone];
+		const physx::PxVec3 & linearVelocity = bodyStates.LinearVelocities[bone];
+		const physx::PxVec3 & angularVelocity = bodyStates.AngularVelocities[bone];
+
+		// skip bones that have not changed enough since they were last sent
+		if( !markAll && !IsChanged( pose, linearVelocity, angularVelocity, item.SentPose, item.SentLinearVelocity, item.SentAngularVelocity,
+			positionThreshold, rotationThreshold, velocityThresholdScale ) )
+		{
+			continue;
+		}
+
+		item.State.Quantize( pxOrigin, pose, linearVelocity, angularVelocity );
+		item.SentPose = pose;
+		item.SentLinearVelocity = linearVelocity;
+		item.SentAngularVelocity = angularVelocity;
+		MarkItemDirty( item );
+		++numDirty;
+	}
+
+	return numDirty;
+}
+
+
+
+
+bool FBoneStateArray::Unpack( const FVector & origin, int32 numBones, FBodyStates & bodyStates ) const
+{
+	if( this->Items.Num() != numBones ) return false;
+
+	bodyStates.SetNum( numBones );
+	const physx::PxVec3 pxOrigin( origin.X, origin.Y, origin.Z );
+
+	for( const FBoneStateItem & item : this->Items )
+	{
+		if( item.BoneIndex < 0 || item.BoneIndex >= numBones ) return false;
+
+		item.State.Dequantize( pxOrigin, bodyStates.Poses[item.BoneIndex], bodyStates.LinearVelocities[item.BoneIndex],
+			bodyStates.AngularVelocities[item.BoneIndex] );
+	}
+
+	return true;
+}
+
+
+
+
+void FPosePacket::Pack( uint32 sequence, float timestamp, const FVector & origin, const FBodyStates & bodyStates )
+{
+	int32 numBones = bodyStates.Num();
+
+	this->Sequence = sequence;
+	this->Timestamp = timestamp;
+	this->Origin = origin;
+	this->Bones.SetNum( numBones, false );
+
+	const physx::PxVec3 pxOrigin( origin.X, origin.Y, origin.Z );
+	for( int32 bone = 0; bone < numBones; ++bone )
+	{
+		this->Bones[bone].Quantize( pxOrigin, bodyStates.Poses[bone], bodyStates.LinearVelocities[bone], bodyStates.AngularVelocities[bone] );
+	}
+}
+
+
+
+
+bool FPosePacket::Unpack( FBodyStates & bodyStates ) const
+{
+	int32 numBones = this->Bones.Num();
+	if( numBones == 0 ) return false;
+
+	bodyStates.SetNum( numBones );
+	const physx::PxVec3 pxOrigin( this->Origin.X, this->Origin.Y, this->Origin.Z );
+	for( int32 bone = 0; bone < numBones; ++bone )
+	{
+		this->Bones[bone].Dequantize( pxOrigin, bodyStates.Poses[bone], bodyStates.LinearVelocities[bone], bodyStates.AngularVelocities[bone] );
+	}
+
+	return true;
+}
+
+
+
+
+bool FPosePacket::NetSerialize( FArchive & Ar, class UPackageMap * Map, bool & bOutSuccess )
+{
+	// header
+	Ar << this->Sequence;
+	Ar << this->Timestamp;
+	Ar << this->Origin;
+
+	uint32 numBones = this->Bones.Num();
+	Ar.SerializeIntPacked( numBones );
+	if( Ar.IsLoading() )
+	{
+		if( numBones > POSE_MAX_BONES )
+		{
+			Ar.SetError();
+			bOutSuccess = false;
+			return true;
+		}
+		this->Bones.SetNum( numBones, false );
+	}
+
+	// bones
+	for( FQuantizedBoneState & bone : this->Bones )
+	{
+		bone.NetSerialize( Ar );
+	}
+
+	bOutSuccess = !Ar.IsError();
+	return true;
+}
@@ -0,0 +1,219 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <Net/UnrealNetwork.h>
+
+#include <PxTransform.h>
+#include <PxVec3.h>
+
+#include "PoseReplication.generated.h"
+
+
+
+
+/** Physical state of all bodies of a skeletal mesh, in the order of USkeletalMeshComponent::Bodies. Plain PhysX data, not replicated as such. */
+struct FBodyStates
+{
+	TArray<physx::PxTransform> Poses;
+	TArray<physx::PxVec3> LinearVelocities;
+	TArray<physx::PxVec3> AngularVelocities;
+
+
+	int32 Num() const { return this->Poses.Num(); }
+
+	/** Resize all arrays. Never shrinks the allocations, so that re-using the same object on every tick does not allocate. */
+	void SetNum( int32 num )
+	{
+		this->Poses.SetNum( num, false );
+		this->LinearVelocities.SetNum( num, false );
+		this->AngularVelocities.SetNum( num, false );
+	}
+
+	/** Whether a body's state differs from the state of the same body in other by more than the provided thresholds. @see FBoneStateArray::Update() */
+	bool HasChanged( int32 body, const FBodyStates & other, float positionThreshold, float rotationThreshold, float velocityThresholdScale ) const;
+
+	/** Interpolate between two states of the same skeleton: positions and velocities linearly, rotations along the shorter arc. result may be a or b. */
+	static void Lerp( const FBodyStates & a, const FBodyStates & b, float t, FBodyStates & result );
+};
+
+
+
+
+/**
+ * Quantized state of a single bone.
+ *
+ * Rotations use smallest-three compression (32 bits). Positions are stored relative to an origin (normally near the actor root), with a fixed resolution
+ * and range (see GetPositionRange()); bones outside the range are clamped. Velocities are scaled by a power-of-two scale that is chosen per bone, so that
+ * the available bits are always used for the current range of motion.
+ *
+ * Serialization is explicit and bit-packed (see NetSerialize()), so float representation compatibility between the server and the clients is not an issue.
+ */
+struct FQuantizedBoneState
+{
+	/** Rotation in smallest-three form: index of the dropped (largest) component in the two highest bits, followed by the three remaining components. */
+	uint32 Rotation;
+
+	/** Position relative to the origin, in fixed point. */
+	int16 Position[3];
+
+	/** Linear and angular velocities, in fixed point relative to the velocity scales. */
+	int16 LinearVelocity[3];
+	int16 AngularVelocity[3];
+
+	/** Base-2 exponents of the velocity scales. */
+	int8 LinearVelocityExponent;
+	int8 AngularVelocityExponent;
+
+
+	/** Quantize the provided state relative to the provided origin. */
+	void Quantize( const physx::PxVec3 & origin, const physx::PxTransform & pose, const physx::PxVec3 & linearVelocity, const physx::PxVec3 & angularVelocity );
+
+	/** Dequantize into the provided state, relative to the provided origin. */
+	void Dequantize( const physx::PxVec3 & origin, physx::PxTransform & pose, physx::PxVec3 & linearVelocity, physx::PxVec3 & angularVelocity ) const;
+
+	/** Bit-packed serialization. */
+	void NetSerialize( FArchive & Ar );
+
+	/** Maximum distance from the origin, along each axis, that positions can be represented at. */
+	static float GetPositionRange();
+};
+
+
+
+
+/** Replicated state of a single bone. @see FBoneStateArray */
+USTRUCT()
+struct FBoneStateItem : public FFastArraySerializerItem
+{
+	GENERATED_USTRUCT_BODY()
+
+
+	/** Index of the bone in USkeletalMeshComponent::Bodies. */
+	int32 BoneIndex;
+
+	/** The replicated, quantized state. */
+	FQuantizedBoneState State;
+
+
+	/* Server only: the state that was last marked for replication, for dirtiness checks (not replicated) */
+
+	physx::PxTransform SentPose;
+	physx::PxVec3 SentLinearVelocity;
+	physx::PxVec3 SentAngularVelocity;
+
+
+	FBoneStateItem() : BoneIndex( INDEX_NONE ) {}
+
+	/** Custom bit-packed net serialization. */
+	bool NetSerialize( FArchive & Ar, class UPackageMap * Map, bool & bOutSuccess );
+};
+
+
+template<>
+struct TStructOpsTypeTraits<FBoneStateItem> : public TStructOpsTypeTraitsBase
+{
+	enum
+	{
+		WithNetSerializer = true
+	};
+};
+
+
+
+
+/**
+ * Delta-replicated pose of a whole skeleton.
+ *
+ * Only bones that have been marked dirty are sent, and a bone is marked dirty only if its state has changed beyond the thresholds given to Update() since
+ * it was last marked dirty. Positions are quantized relative to an origin that is replicated separately by the owner; Update() re-anchors the origin (and
+ * thereby dirties all bones) only when the actor drifts too far from it.
+ */
+USTRUCT()
+struct FBoneStateArray : public FFastArraySerializer
+{
+	GENERATED_USTRUCT_BODY()
+
+
+	UPROPERTY()
+	TArray<FBoneStateItem> Items;
+
+
+	/**
+	 * Server: update the replicated state from the provided body states. Bones whose position or rotation has changed by more than positionThreshold (world
+	 * units) or rotationThreshold (radians) since they were last sent are marked dirty. Velocities are compared against the same thresholds multiplied by
+	 * velocityThresholdScale, which should be the net update frequency (a velocity change that would integrate to the threshold within one update).
+	 *
+	 * @param origin The replicated origin. Re-anchored to actorLocation if the actor has drifted too far from it.
+	 * @return The number of bones marked dirty.
+	 */
+	int32 Update( FVector & origin, const FVector & actorLocation, const FBodyStates & bodyStates, float positionThreshold, float rotationThreshold,
+		float velocityThresholdScale );
+
+	/** Client: dequantize all bones relative to the provided origin. Returns false if the received bones do not cover exactly numBones bones. */
+	bool Unpack( const FVector & origin, int32 numBones, FBodyStates & bodyStates ) const;
+
+	bool NetDeltaSerialize( FNetDeltaSerializeInfo & DeltaParms )
+	{
+		return FFastArraySerializer::FastArrayDeltaSerialize<FBoneStateItem>( this->Items, DeltaParms, *this );
+	}
+};
+
+
+template<>
+struct TStructOpsTypeTraits<FBoneStateArray> : public TStructOpsTypeTraitsBase
+{
+	enum
+	{
+		WithNetDeltaSerializer = true
+	};
+};
+
+
+
+
+/** A complete, timestamped and sequence-numbered pose of a whole skeleton, for sending as an unreliable RPC. @see FQuantizedBoneState */
+USTRUCT()
+struct FPosePacket
+{
+	GENERATED_USTRUCT_BODY()
+
+
+	/** Sender's sequence number, for dropping stale and duplicate packets. Wraps around. */
+	uint32 Sequence;
+
+	/** Sender's game time at the moment the pose was read. */
+	float Timestamp;
+
+	/** World position that bone positions are relative to. */
+	FVector Origin;
+
+	/** Quantized bone states, in the order of USkeletalMeshComponent::Bodies. */
+	TArray<FQuantizedBoneState> Bones;
+
+
+	FPosePacket() : Sequence( 0 ), Timestamp( 0.f ), Origin( FVector::ZeroVector ) {}
+
+
+	/** Quantize the provided body states relative to the provided origin. */
+	void Pack( uint32 sequence, float timestamp, const FVector & origin, const FBodyStates & bodyStates );
+
+	/** Dequantize all bones into the provided body states. Returns false if the packet is empty. */
+	bool Unpack( FBodyStates & bodyStates ) const;
+
+	/** Whether this packet is newer than the one with the provided sequence number, taking wrap-around into account. */
+	bool IsNewerThan( uint32 sequence ) const { return int32( this->Sequence - sequence ) > 0; }
+
+	/** Custom bit-packed net serialization. */
+	bool NetSerialize( FArchive & Ar, class UPackageMap * Map, bool & bOutSuccess );
+};
+
+
+template<>
+struct TStructOpsTypeTraits<FPosePacket> : public TStructOpsTypeTraitsBase
+{
+	enum
+	{
+		WithNetSerializer = true
+	};
+};
@@ -3,9 +3,16 @@
 #include "RagdollController.h"
 #include "RCLevelScriptActor.h"
 
+#include "ParallelPhysicsScenes.h"
+#include "RemoteControllable.h"
+#include "ControlledRagdoll.h"
+#include "ByteStream.h"
+#include "TickProfiler.h"
+
 #include <App.h>
 #include <Net/UnrealNetwork.h>
 #include <PhysicsPublic.h>
+#include <ParallelFor.h>
 
 #include <PxPhysics.h>
 #include <PxScene.h>
@@ -16,8 +23,24 @@
 #include <algorithm>
 
 
-// average tick rate logging: frame timestamp window size (must be >= 2)
-#define ESTIMATE_TICKRATE_SAMPLES 10
+// frame time histogram: number and duration (seconds) of the sliding window slots
+#define TICK_TIMES_WINDOW_SLOTS 60
+#define TICK_TIMES_SLOT_DURATION 1.0
+
+// window for estimating the current average tick rate (seconds, rounded up to whole slots, the current slot being partially filled)
+#define TICK_TIMES_AVERAGE_WINDOW 2.0
+
+// interval for logging the frame time report (seconds)
+#define TICK_TIMES_REPORT_INTERVAL 10.0
+
+// interval for re-evaluating the tick rate cap policy (seconds)
+#define TICK_RATE_POLICY_CHECK_INTERVAL 0.5
+
+// gathering remote controller inputs: time slice for waiting on a single socket before re-polling all of them (milliseconds)
+#define GATHER_WAIT_SLICE_MS 1
+
+
+DECLARE_CYCLE_STAT( TEXT( "GatherRemoteControllers" ), STAT_RcGatherRemoteControllers, STATGROUP_RagdollController );
 
 
 
@@ -27,6 +50,7 @@ void ARCLevelScriptActor::GetLifetimeReplicatedProps( TArray<FLifetimeProperty>
 	Super::GetLifetimeReplicatedProps( OutLifetimeProps );
 
 	DOREPLIFETIME( ARCLevelScriptActor, currentAverageAuthorityTickRate );
+	DOREPLIFETIME( ARCLevelScriptActor, ServerSimulationTime );
 }
 
 
@@ -34,8 +58,16 @@ void ARCLevelScriptActor::GetLifetimeReplicatedProps( TArray<FLifetimeProperty>
 
 ARCLevelScriptActor::ARCLevelScriptActor( const FObjectInitializer & ObjectInitializer ) :
 	Super( ObjectInitializer ),
-	tickTimestamps( ESTIMATE_TICKRATE_SAMPLES )
+	TickTimes( TICK_TIMES_WINDOW_SLOTS, TICK_TIMES_SLOT_DURATION )
+{
+}
+
+
+
+
+ARCLevelScriptActor::~ARCLevelScriptActor()
 {
+	// out of line, so that ParallelPhysicsScenes is a complete type here
 }
 
 
@@ -47,6 +79,15 @@ void ARCLevelScriptActor::PostInitializeComponents()
 
 	// Register self for automatic NetUpdateFrequency management
 	RegisterManagedNetUpdateFrequency( this );
+
+	// validate the action delay before the ragdolls start using it
+	int32 minActionDelayTicks = this->PipelineRemoteControllers ? 1 : 0;
+	if( this->ActionDelayTicks < minActionDelayTicks )
+	{
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s) ActionDelayTicks %d is below the minimum of %d, raising it to the minimum." ), TEXT( __FUNCTION__ ),
+			this->ActionDelayTicks, minActionDelayTicks );
+		this->ActionDelayTicks = minActionDelayTicks;
+	}
 }
 
 
@@ -60,6 +101,13 @@ void ARCLevelScriptActor::BeginPlay()
 	check( this->FixedFps != 0.f );
 	FApp::SetFixedDeltaTime( 1.f / this->FixedFps );
 
+	// nominal tick rate until there are frame times to estimate it from
+	this->currentAverageTickRate = this->FixedFps;
+	if( HasAuthority() )
+	{
+		this->currentAverageAuthorityTickRate = this->FixedFps;
+	}
+
 	// connect to physics debugger (adapted from https://physx3.googlecode.com/svn/trunk/PhysX-3.2_PC_SDK_Core/Samples/SampleBase/PhysXSample.cpp)
 	if( this->ConnectToPhysXVisualDebugger )
 	{
@@ -88,6 +136,63 @@ void ARCLevelScriptActor::BeginPlay()
 			UE_LOG( LogRcSystem, Error, TEXT( "(%s) PhysX Visual Debugger: Failed to initialize connection: Failed to access the PhysX scene!" ), TEXT( __FUNCTION__ ) );
 		}
 	}
+
+	// register the tick function for stepping private physics scenes
+	if( this->UseParallelPhysicsScenes && HasAuthority() )
+	{
+		this->PhysicsScenesTickFunction.TickGroup = TG_DuringPhysics;
+		this->PhysicsScenesTickFunction.bCanEverTick = true;
+		this->PhysicsScenesTickFunction.Target = this;
+		this->PhysicsScenesTickFunction.RegisterTickFunction( GetLevel() );
+	}
+
+	// register the tick function for the post-physics stages of batch-ticked ragdolls
+	if( this->BatchTickRagdolls && HasAuthority() )
+	{
+		this->RagdollsPostPhysicsTickFunction.TickGroup = TG_PostPhysics;
+		this->RagdollsPostPhysicsTickFunction.bCanEverTick = true;
+		this->RagdollsPostPhysicsTickFunction.Target = this;
+		this->RagdollsPostPhysicsTickFunction.RegisterTickFunction( GetLevel() );
+
+		if( this->PipelineRemoteControllers )
+		{
+			this->RagdollsDuringPhysicsTickFunction.TickGroup = TG_DuringPhysics;
+			this->RagdollsDuringPhysicsTickFunction.bCanEverTick = true;
+			this->RagdollsDuringPhysicsTickFunction.Target = this;
+			this->RagdollsDuringPhysicsTickFunction.RegisterTickFunction( GetLevel() );
+
+			// stepping the private scenes blocks the game thread, so communicate first
+			if( this->PhysicsScenesTickFunction.IsTickFunctionRegistered() )
+			{
+				this->PhysicsScenesTickFunction.AddPrerequisite( this, this->RagdollsDuringPhysicsTickFunction );
+			}
+		}
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::EndPlay( const EEndPlayReason::Type EndPlayReason )
+{
+	// return all ragdolls to the world physics scene and release the private scenes
+	if( this->PhysicsScenesTickFunction.IsTickFunctionRegistered() )
+	{
+		this->PhysicsScenesTickFunction.UnRegisterTickFunction();
+	}
+	this->PhysicsScenes.reset();
+	this->UseParallelPhysicsScenes = false;   // do not re-create the scenes during teardown
+
+	if( this->RagdollsPostPhysicsTickFunction.IsTickFunctionRegistered() )
+	{
+		this->RagdollsPostPhysicsTickFunction.UnRegisterTickFunction();
+	}
+	if( this->RagdollsDuringPhysicsTickFunction.IsTickFunctionRegistered() )
+	{
+		this->RagdollsDuringPhysicsTickFunction.UnRegisterTickFunction();
+	}
+
+	Super::EndPlay( EndPlayReason );
 }
 
 
@@ -97,11 +202,12 @@ void ARCLevelScriptActor::Tick( float deltaSeconds )
 {
 	Super::Tick( deltaSeconds );
 
-	// If not dedicated server, or CapServerTickRate == true, then cap fps here. The -UseFixedTimeStep commannd line option disables built-in framerate
+	// If not dedicated server, or if ServerTickRateCap says so, then cap fps here. The -UseFixedTimeStep commannd line option disables built-in framerate
 	// control in UEngine::UpdateTimeAndHandleMaxTickRate(), and we can't override that method as it is not virtual.
 	UWorld * world = GetWorld();
 	check( world );
-	if( world->GetNetMode() != NM_DedicatedServer || this->CapServerTickRate )
+	UpdateTickRatePolicy();
+	if( this->TickRateCapped )
 	{
 		HandleMaxTickRate( this->FixedFps );
 	}
@@ -109,10 +215,16 @@ void ARCLevelScriptActor::Tick( float deltaSeconds )
 	// estimate the current average frame rate
 	estimateAverageTickRate();
 
-	// if predictive pose replication is enabled an we are not authority, then sync game speed with server
-	if( this->PoseReplicationDoClientsidePrediction && !HasAuthority() )
+	// timestamp the tick for client clock synchronization (clients sync their game speed when the timestamp is received, @see OnRep_ServerSimulationTime)
+	if( HasAuthority() )
 	{
-		syncGameSpeedWithServer();
+		this->ServerSimulationTime = world->GetTimeSeconds();
+	}
+
+	// Tick the batch-ticked ragdolls through the pre-physics stages (@see TickRagdollsPostPhysics for the rest)
+	if( this->BatchTickedRagdolls.Num() > 0 )
+	{
+		TickRagdolls( deltaSeconds );
 	}
 
 	// Adjust the net update frequencies of all registered actors
@@ -122,13 +234,73 @@ void ARCLevelScriptActor::Tick( float deltaSeconds )
 
 
 
+void ARCLevelScriptActor::UpdateTickRatePolicy()
+{
+	// the policy depends on connections only, no need to check on every tick
+	double now = FramePacer::Now();
+	bool firstCheck = this->LastTickRatePolicyCheckTime == 0.0;
+	if( !firstCheck && now - this->LastTickRatePolicyCheckTime < TICK_RATE_POLICY_CHECK_INTERVAL ) return;
+	this->LastTickRatePolicyCheckTime = now;
+
+	UWorld * world = GetWorld();
+	check( world );
+
+	// count the remote players and the remote controllers (only if the policy cares about them)
+	int32 numRemotePlayers = 0;
+	int32 numRemoteControllers = 0;
+	if( world->GetNetMode() == NM_DedicatedServer && (this->ServerTickRateCap == EServerTickRateCap::WhenSpectated ||
+		this->ServerTickRateCap == EServerTickRateCap::WhenSpectatedOrRemoteControlled) )
+	{
+		for( FConstPlayerControllerIterator iter = world->GetPlayerControllerIterator(); iter; ++iter )
+		{
+			if( *iter && !(*iter)->IsLocalController() ) ++numRemotePlayers;
+		}
+
+		if( this->ServerTickRateCap == EServerTickRateCap::WhenSpectatedOrRemoteControlled )
+		{
+			for( TActorIterator<AActor> iter( world ); iter; ++iter )
+			{
+				IRemoteControllable * controllable = Cast<IRemoteControllable>( *iter );
+				if( controllable && controllable->IsRemoteControlled() ) ++numRemoteControllers;
+			}
+		}
+	}
+
+	// clients and standalone instances render for a local viewer, so they always run at real time
+	bool capped;
+	switch( world->GetNetMode() != NM_DedicatedServer ? EServerTickRateCap::Always : this->ServerTickRateCap.GetValue() )
+	{
+	case EServerTickRateCap::Never:
+		capped = false;
+		break;
+	case EServerTickRateCap::WhenSpectated:
+	case EServerTickRateCap::WhenSpectatedOrRemoteControlled:
+		capped = numRemotePlayers > 0 || numRemoteControllers > 0;
+		break;
+	default:
+		capped = true;
+		break;
+	}
+
+	// log transitions, and restart the pacing schedule so that the first capped tick does not try to catch up with a stale deadline
+	if( firstCheck || capped != this->TickRateCapped )
+	{
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s) Tick rate %s (remote players: %d, remote controllers: %d)." ), TEXT( __FUNCTION__ ),
+			capped ? *FString::Printf( TEXT( "capped to real time (%.1f fps)" ), this->FixedFps ) : TEXT( "uncapped" ), numRemotePlayers, numRemoteControllers );
+		this->TickRateCapped = capped;
+		this->TickPacer.Restart();
+	}
+}
+
+
+
+
 /**
- * The following implementation is mostly copied from UEngine::UpdateTimeAndHandleMaxTickRate().
+ * UEngine::UpdateTimeAndHandleMaxTickRate() does no frame rate control when using fixed time steps, so we do it here.
  *
- * Note that UEngine::UpdateTimeAndHandleMaxTickRate()'s fixed dt implementation will cause FApp::CurrentTime to drift!
- * However, do not poke the engine in any way (do not try to imitate the dynamic dt code path in UpdateTimeAndHandleMaxTickRate).
- *
- * Do not use FApp::LastTime, as we do not know the execution order with UpdateTimeAndHandleMaxTickRate().
+ * Do not poke the engine in any way (do not try to imitate the dynamic dt code path in UpdateTimeAndHandleMaxTickRate). Ticks are paced against absolute
+ * deadlines by TickPacer, independently of FApp::CurrentTime and FApp::LastTime, as we do not know the execution order with
+ * UpdateTimeAndHandleMaxTickRate().
  */
 void ARCLevelScriptActor::HandleMaxTickRate( const float MaxTickRate )
 {
@@ -136,95 +308,89 @@ void ARCLevelScriptActor::HandleMaxTickRate( const float MaxTickRate )
 	const bool bUseFixedTimeStep = FApp::IsBenchmarking() || FApp::UseFixedTimeStep();
 
 	// Only continue if UEngine::UpdateTimeAndHandleMaxTickRate() followed the code path with no fps control (in UE 4.4)
-	if( !bUseFixedTimeStep ) return;
+	if( !bUseFixedTimeStep || MaxTickRate <= 0.f ) return;
+
+	// wait for the next deadline (sleeps, then spins only for a calibrated sub-millisecond margin)
+	this->TickPacer.Wait( 1.0 / MaxTickRate );
+}
 
 
-	// store current time
-	double CurrentTime = FPlatformTime::Seconds();
 
-	// timestamp from previous call, for computing the real dt
-	static double LastTime = 0.0;
 
-	// first call? real dt not known -> store time and return
-	if( LastTime == 0.0 )
+void ARCLevelScriptActor::estimateAverageTickRate()
+{
+	// record the frame time
+	double now = FramePacer::Now();
+	if( this->LastTickTime == 0.0 )
 	{
-		LastTime = CurrentTime;
+		this->LastTickTime = now;
+		this->LastTickTimeReportTime = now;
 		return;
 	}
+	this->TickTimes.Record( uint64( (now - this->LastTickTime) * 1e6 ), now );
+	this->LastTickTime = now;
 
-	// compute real dt up to now
-	float DeltaTime = CurrentTime - LastTime;
-
-
-	float WaitTime = 0;
-	// Convert from max FPS to wait time.
-	if (MaxTickRate > 0)
+	// average over the last second or two; keep the previous estimate if there is no data yet
+	Histogram window;
+	this->TickTimes.GetWindow( TICK_TIMES_AVERAGE_WINDOW, now, window );
+	if( window.GetMean() > 0.0 )
 	{
-		WaitTime = FMath::Max(1.f / MaxTickRate - DeltaTime, 0.f);
+		this->currentAverageTickRate = float( 1e6 / window.GetMean() );
 	}
 
-	// Enforce maximum framerate and smooth framerate by waiting.
-	//STAT(double ActualWaitTime = 0.f);
-	if (WaitTime > 0)
+	// log the percentiles
+	if( now - this->LastTickTimeReportTime >= TICK_TIMES_REPORT_INTERVAL )
 	{
-		double WaitEndTime = CurrentTime + WaitTime;
-		//SCOPE_SECONDS_COUNTER(ActualWaitTime);
-		//SCOPE_CYCLE_COUNTER(STAT_GameTickWaitTime);
-		//SCOPE_CYCLE_COUNTER(STAT_GameIdleTime);
-		
-		// if (IsRunningDedicatedServer()) // We aren't so concerned about wall time with a server, lots of CPU is wasted spinning. I suspect there is more to do with sleeping and time on dedicated servers.
-		if( false ) // use the precise approach also on dedicated servers
-		{
-			FPlatformProcess::Sleep(WaitTime);
-		}
-		else
-		{
-			// Sleep if we're waiting more than 5 ms. We set the scheduler granularity to 1 ms
-			// at startup on PC. We reserve 2 ms of slack time which we will wait for by giving
-			// up our timeslice.
-			if (WaitTime > 5 / 1000.f)
-			{
-				FPlatformProcess::Sleep(WaitTime - 0.002f);
-			}
-
-			// Give up timeslice for remainder of wait time.
-			while (FPlatformTime::Seconds() < WaitEndTime)
-			{
-				FPlatformProcess::Sleep(0);
-			}
-		}
-		//FApp::SetCurrentTime(FPlatformTime::Seconds());
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s) Frame times: %s" ), TEXT( __FUNCTION__ ), *GetTickTimeReport() );
+		this->LastTickTimeReportTime = now;
 	}
 
+	// if authority, then copy this also to currentAverageAuthorityTickRate
+	if( HasAuthority() )
+	{
+		this->currentAverageAuthorityTickRate = this->currentAverageTickRate;
+	}
+}
 
-	//SET_FLOAT_STAT(STAT_GameTickWantedWaitTime, WaitTime * 1000.f);
-	//SET_FLOAT_STAT(STAT_GameTickAdditionalWaitTime, FMath::Max<float>((ActualWaitTime - WaitTime)*1000.f, 0.f));
 
 
-	// update LastTime
-	LastTime = CurrentTime + WaitTime;
-}
 
+FString ARCLevelScriptActor::GetTickTimeReport() const
+{
+	static const double windows[] = { 1.0, 10.0, 60.0 };
 
+	FString report;
+	Histogram window;
+	double now = FramePacer::Now();
+	for( double windowLength : windows )
+	{
+		this->TickTimes.GetWindow( windowLength, now, window );
+		report += FString::Printf( TEXT( "%s%.0fs: n=%llu mean=%.2f p50=%.2f p99=%.2f max=%.2f ms" ), report.IsEmpty() ? TEXT( "" ) : TEXT( "; " ), windowLength,
+			window.GetCount(), window.GetMean() * 1e-3, window.GetPercentile( 50.0 ) * 1e-3, window.GetPercentile( 99.0 ) * 1e-3, window.GetMax() * 1e-3 );
+	}
 
+	return report;
+}
 
-void ARCLevelScriptActor::estimateAverageTickRate()
-{
-	check( ESTIMATE_TICKRATE_SAMPLES >= 2 );
 
-	// store a time stamp for the current tick
-	this->tickTimestamps.push_back( FPlatformTime::Seconds() );
 
-	// compute the running average for the last n - 1 deltas
-	this->currentAverageTickRate = (ESTIMATE_TICKRATE_SAMPLES - 1) / (this->tickTimestamps.back() - this->tickTimestamps.front());
 
-	// if authority, then copy this also to currentAverageAuthorityTickRate
-	if( HasAuthority() )
+/** Console command: log the frame time report of the world's level script actor. */
+static void LogTickTimeReport( UWorld * world )
+{
+	ARCLevelScriptActor * lsa = world ? Cast<ARCLevelScriptActor>( world->GetLevelScriptActor() ) : nullptr;
+	if( !lsa )
 	{
-		this->currentAverageAuthorityTickRate = this->currentAverageTickRate;
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The level script actor is not an ARCLevelScriptActor, no frame time statistics available." ), TEXT( __FUNCTION__ ) );
+		return;
 	}
+
+	UE_LOG( LogRcSystem, Display, TEXT( "(%s) Frame times: %s" ), TEXT( __FUNCTION__ ), *lsa->GetTickTimeReport() );
 }
 
+static FAutoConsoleCommandWithWorld TickStatsCommand( TEXT( "rc.TickStats" ),
+	TEXT( "Log the wall clock frame time percentiles over the last 1, 10 and 60 seconds." ), FConsoleCommandWithWorldDelegate::CreateStatic( &LogTickTimeReport ) );
+
 
 
 
@@ -233,18 +399,300 @@ void ARCLevelScriptActor::syncGameSpeedWithServer()
 	// no point in syncing auth's speed with itself
 	if( HasAuthority() ) return;
 
-	// compute the speed difference
+	// feed-forward: the speed difference implied by the tick rates; the controller corrects for the remaining rate error and for the accumulated offset
 	float serverSpeedMultiplier = this->currentAverageAuthorityTickRate / this->currentAverageTickRate;
-	
+	float dilation = this->ServerClockSync.AddSample( this->ServerSimulationTime, GetWorld()->GetTimeSeconds(), FramePacer::Now(), serverSpeedMultiplier );
+
 	// sync using global time dilation
 	AWorldSettings * ws = GetWorldSettings(); check( ws );
 	if( ws )
 	{
-		ws->TimeDilation = serverSpeedMultiplier;
+		ws->TimeDilation = dilation;
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::OnRep_ServerSimulationTime()
+{
+	// if predictive pose replication is enabled, then sync game speed with server
+	if( this->PoseReplicationDoClientsidePrediction )
+	{
+		syncGameSpeedWithServer();
+	}
+}
+
+
+
+
+ParallelPhysicsScenes * ARCLevelScriptActor::GetParallelPhysicsScenes()
+{
+	if( !this->UseParallelPhysicsScenes || !HasAuthority() ) return nullptr;
+
+	// create on first use: ragdolls might call this from their BeginPlay() before ours has been called
+	if( !this->PhysicsScenes )
+	{
+		UWorld * world = GetWorld();
+		physx::PxScene * worldScene = world && world->GetPhysicsScene() ? world->GetPhysicsScene()->GetPhysXScene( PST_Sync ) : nullptr;
+		if( !worldScene )
+		{
+			UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to access the PhysX scene! Parallel physics scenes disabled." ), TEXT( __FUNCTION__ ) );
+			this->UseParallelPhysicsScenes = false;
+			return nullptr;
+		}
+
+		this->PhysicsScenes = std::make_unique<ParallelPhysicsScenes>( worldScene );
+	}
+
+	return this->PhysicsScenes.get();
+}
+
+
+
+
+void ARCLevelScriptActor::StepParallelPhysicsScenes( float deltaSeconds )
+{
+	if( this->PhysicsScenes )
+	{
+		this->PhysicsScenes->Step( deltaSeconds );
+	}
+}
+
+
+
+
+void FParallelPhysicsScenesTickFunction::ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	const FGraphEventRef & MyCompletionGraphEvent )
+{
+	if( this->Target && !this->Target->IsPendingKill() )
+	{
+		this->Target->StepParallelPhysicsScenes( DeltaTime );
+	}
+}
+
+
+
+
+FString FParallelPhysicsScenesTickFunction::DiagnosticMessage()
+{
+	return TEXT( "ARCLevelScriptActor[StepParallelPhysicsScenes]" );
+}
+
+
+
+
+void ARCLevelScriptActor::TickRagdolls( float deltaSeconds )
+{
+	TArray<AControlledRagdoll *> & ragdolls = this->BatchTickedRagdolls;
+
+	// wait for all remote controllers concurrently: they all have had our replies since the end of the previous tick (if pipelined, then this happens
+	// during the physics step instead, @see TickRagdollsDuringPhysics)
+	if( !this->PipelineRemoteControllers )
+	{
+		GatherRemoteControllerInputs( ragdolls );
+	}
+
+	// remote controller communication and replay: sockets and PhysX writes, serially
+	for( AControlledRagdoll * ragdoll : ragdolls )
+	{
+		ragdoll->TickStageInbound( deltaSeconds );
+	}
+
+	// tick hooks and Blueprints, serially
+	for( AControlledRagdoll * ragdoll : ragdolls )
+	{
+		ragdoll->TickStageUpdate( deltaSeconds );
+	}
+
+	// torques, computed in parallel
+	ParallelFor( ragdolls.Num(), [&ragdolls]( int32 ind ) {
+		ragdolls[ind]->TickStageComputeTorques();
+	} );
+
+	// PhysX writes, serially
+	for( AControlledRagdoll * ragdoll : ragdolls )
+	{
+		ragdoll->TickStageApplyTorques();
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::TickRagdollsPostPhysics( float deltaSeconds )
+{
+	TArray<AControlledRagdoll *> & ragdolls = this->BatchTickedRagdolls;
+
+	// PhysX reads, in parallel
+	ParallelFor( ragdolls.Num(), [&ragdolls]( int32 ind ) {
+		ragdolls[ind]->TickStageReadSimulation();
+	} );
+
+	// remote controller replies, pose replication and recording, serially
+	for( AControlledRagdoll * ragdoll : ragdolls )
+	{
+		ragdoll->TickStageOutbound();
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::TickRagdollsDuringPhysics( float deltaSeconds )
+{
+	TArray<AControlledRagdoll *> & ragdolls = this->BatchTickedRagdolls;
+
+	// replies with the observations of the previous tick, serially
+	for( AControlledRagdoll * ragdoll : ragdolls )
+	{
+		ragdoll->TickStageSendObservations();
+	}
+
+	// wait for all remote controllers concurrently, then pick up the results
+	GatherRemoteControllerInputs( ragdolls );
+	for( AControlledRagdoll * ragdoll : ragdolls )
+	{
+		ragdoll->TickStageReceiveCommands();
+	}
+}
+
+
+
+
+void FBatchTickedRagdollsDuringPhysicsTickFunction::ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	const FGraphEventRef & MyCompletionGraphEvent )
+{
+	if( this->Target && !this->Target->IsPendingKill() )
+	{
+		this->Target->TickRagdollsDuringPhysics( DeltaTime );
+	}
+}
+
+
+
+
+FString FBatchTickedRagdollsDuringPhysicsTickFunction::DiagnosticMessage()
+{
+	return TEXT( "ARCLevelScriptActor[TickRagdollsDuringPhysics]" );
+}
+
+
+
+
+void FBatchTickedRagdollsPostPhysicsTickFunction::ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	const FGraphEventRef & MyCompletionGraphEvent )
+{
+	if( this->Target && !this->Target->IsPendingKill() )
+	{
+		this->Target->TickRagdollsPostPhysics( DeltaTime );
+	}
+}
+
+
+
+
+FString FBatchTickedRagdollsPostPhysicsTickFunction::DiagnosticMessage()
+{
+	return TEXT( "ARCLevelScriptActor[TickRagdollsPostPhysics]" );
+}
+
+
+
+
+void ARCLevelScriptActor::GatherRemoteControllerInputs( const TArray<AControlledRagdoll *> & ragdolls )
+{
+	RC_SCOPE_TICK_PHASE( STAT_RcGatherRemoteControllers, "GatherRemoteControllers" );
+
+	TArray<AControlledRagdoll *> & pending = this->PendingRemoteControllers;
+	pending = ragdolls;
+
+	while( true )
+	{
+		// poll all pending controllers, drop those that are done
+		pending.RemoveAllSwap( []( AControlledRagdoll * ragdoll ) { return ragdoll->PollRemoteController(); } );
+		if( pending.Num() == 0 ) break;
+
+		// wait for data on one of the pending connections, but only for a short while, so that data arriving on the others is not left waiting for long
+		// (FSocket cannot wait on several sockets at once)
+		ByteStream * stream = pending[0]->GetRemoteControllerStream();
+		check( stream );
+		stream->WaitForData( GATHER_WAIT_SLICE_MS );
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::RegisterBatchTickedRagdoll( AControlledRagdoll * ragdoll )
+{
+	if( !ragdoll )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The provided ragdoll pointer is null! Ignoring." ), TEXT( __FUNCTION__ ) );
+		return;
 	}
-	
-	//// sync by modifying fixed dt
-	//FApp::SetFixedDeltaTime( serverSpeedMultiplier * (1.f / this->FixedFps) );
+
+	if( this->BatchTickedRagdolls.Contains( ragdoll ) )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The provided ragdoll (%s) is already registered! Ignoring." ), TEXT( __FUNCTION__ ),
+			*ragdoll->GetHumanReadableName() );
+		return;
+	}
+
+	this->BatchTickedRagdolls.Add( ragdoll );
+}
+
+
+void ARCLevelScriptActor::UnregisterBatchTickedRagdoll( AControlledRagdoll * ragdoll )
+{
+	if( this->BatchTickedRagdolls.Remove( ragdoll ) != 1 )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The provided ragdoll (%s) is not registered! Ignoring." ), TEXT( __FUNCTION__ ),
+			ragdoll ? *ragdoll->GetHumanReadableName() : TEXT( "(nullptr)" ) );
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::RegisterSelfTickedRagdoll( AControlledRagdoll * ragdoll )
+{
+	if( !ragdoll )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The provided ragdoll pointer is null! Ignoring." ), TEXT( __FUNCTION__ ) );
+		return;
+	}
+
+	if( this->SelfTickedRagdolls.Contains( ragdoll ) )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The provided ragdoll (%s) is already registered! Ignoring." ), TEXT( __FUNCTION__ ),
+			*ragdoll->GetHumanReadableName() );
+		return;
+	}
+
+	this->SelfTickedRagdolls.Add( ragdoll );
+}
+
+
+void ARCLevelScriptActor::UnregisterSelfTickedRagdoll( AControlledRagdoll * ragdoll )
+{
+	if( this->SelfTickedRagdolls.Remove( ragdoll ) != 1 )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) The provided ragdoll (%s) is not registered! Ignoring." ), TEXT( __FUNCTION__ ),
+			ragdoll ? *ragdoll->GetHumanReadableName() : TEXT( "(nullptr)" ) );
+	}
+}
+
+
+
+
+void ARCLevelScriptActor::GatherSelfTickedRemoteControllerInputs()
+{
+	// once per tick: the later ragdolls find their documents received
+	if( this->SelfTickedInputsGatheredFrame == GFrameCounter ) return;
+	this->SelfTickedInputsGatheredFrame = GFrameCounter;
+
+	GatherRemoteControllerInputs( this->SelfTickedRagdolls );
 }
 
 
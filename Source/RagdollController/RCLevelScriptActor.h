@@ -3,13 +3,112 @@
 #pragma once
 
 #include "Engine/LevelScriptActor.h"
+#include "FramePacer.h"
+#include "Histogram.h"
+#include "ClockSync.h"
 
-#include <boost/circular_buffer.hpp>
 #include <unordered_set>
+#include <memory>
 
 #include "RCLevelScriptActor.generated.h"
 
 
+class ARCLevelScriptActor;
+class AControlledRagdoll;
+class ParallelPhysicsScenes;
+
+
+
+
+/** Channels for server-to-client pose replication. */
+UENUM()
+namespace EPoseReplicationMode
+{
+	enum Type
+	{
+		/** Delta-replicated property: reliable state convergence, but the server diffs the pose per connection. */
+		Property,
+
+		/** Timestamped, sequence-numbered unreliable multicast RPC per pose: no per-connection diffing, clients drop stale packets. */
+		UnreliableMulticast
+	};
+}
+
+
+
+
+/** Policies for capping the real (wall-clock) tick rate of dedicated servers. */
+UENUM()
+namespace EServerTickRateCap
+{
+	enum Type
+	{
+		/** Always run as fast as possible. */
+		Never,
+
+		/** Always run at real time. */
+		Always,
+
+		/** Run at real time while remote players (spectators) are connected, otherwise as fast as possible. */
+		WhenSpectated,
+
+		/** Run at real time while remote players or remote controllers are connected, otherwise as fast as possible. */
+		WhenSpectatedOrRemoteControlled
+	};
+}
+
+
+
+
+/** Tick function for stepping the private physics scenes of ARCLevelScriptActor. Ticks during TG_DuringPhysics, that is, after all ragdolls have written
+ ** their torques and before skeletal meshes are synced to their bodies. */
+USTRUCT()
+struct FParallelPhysicsScenesTickFunction : public FTickFunction
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** The LevelScriptActor whose private scenes are to be stepped. */
+	ARCLevelScriptActor * Target;
+
+	virtual void ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef & MyCompletionGraphEvent ) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+
+
+
+/** Tick function for the during-physics stages of the batch-ticked ragdolls of ARCLevelScriptActor, if remote controller communication is pipelined. Ticks
+ ** during TG_DuringPhysics, that is, while the world's physics scene is being stepped. */
+USTRUCT()
+struct FBatchTickedRagdollsDuringPhysicsTickFunction : public FTickFunction
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** The LevelScriptActor whose batch-ticked ragdolls are to be ticked. */
+	ARCLevelScriptActor * Target;
+
+	virtual void ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef & MyCompletionGraphEvent ) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+
+
+
+/** Tick function for the post-physics stages of the batch-ticked ragdolls of ARCLevelScriptActor. Ticks during TG_PostPhysics, that is, after the physics
+ ** step and after the skeletal meshes have been synced to their bodies. */
+USTRUCT()
+struct FBatchTickedRagdollsPostPhysicsTickFunction : public FTickFunction
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** The LevelScriptActor whose batch-ticked ragdolls are to be ticked. */
+	ARCLevelScriptActor * Target;
+
+	virtual void ExecuteTick( float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef & MyCompletionGraphEvent ) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+
 
 
 /**
@@ -21,22 +120,81 @@ class RAGDOLLCONTROLLER_API ARCLevelScriptActor : public ALevelScriptActor
 	GENERATED_BODY()
 
 
-	/** Average tick rate estimation: timestamps for the last n ticks */
-	boost::circular_buffer<double> tickTimestamps;
+	/** Wall clock frame times (microseconds) over the last minute, in one-second slots. @see GetTickTimeReport */
+	SlidingWindowHistogram TickTimes;
+
+	/** FramePacer::Now() at the previous tick, zero before the first tick. */
+	double LastTickTime = 0.0;
+
+	/** FramePacer::Now() at the previous frame time report. */
+	double LastTickTimeReportTime = 0.0;
+
+	/** Client game speed control. @see syncGameSpeedWithServer */
+	ClockSync ServerClockSync;
+
+	/** Tick rate capping. @see HandleMaxTickRate */
+	FramePacer TickPacer;
+
+	/** Whether the tick rate is currently capped. @see UpdateTickRatePolicy */
+	bool TickRateCapped = false;
+
+	/** FramePacer::Now() at the previous tick rate policy check, zero before the first check. */
+	double LastTickRatePolicyCheckTime = 0.0;
+
+	/** Private physics scenes, created on demand if UseParallelPhysicsScenes is set. @see GetParallelPhysicsScenes */
+	std::unique_ptr<ParallelPhysicsScenes> PhysicsScenes;
+
+	/** Tick function for stepping PhysicsScenes. */
+	FParallelPhysicsScenesTickFunction PhysicsScenesTickFunction;
+
+	/** Ragdolls ticked in stages by TickRagdolls() and TickRagdollsPostPhysics(). @see BatchTickRagdolls */
+	TArray<AControlledRagdoll *> BatchTickedRagdolls;
+
+	/** Tick function for TickRagdollsPostPhysics(). */
+	FBatchTickedRagdollsPostPhysicsTickFunction RagdollsPostPhysicsTickFunction;
+
+	/** Tick function for TickRagdollsDuringPhysics(). */
+	FBatchTickedRagdollsDuringPhysicsTickFunction RagdollsDuringPhysicsTickFunction;
+
+	/** Ragdolls ticked through their own tick functions (on authority). Unless pipelined, their remote controllers are waited for together, by the first of
+	 ** them to tick. @see GatherSelfTickedRemoteControllerInputs */
+	TArray<AControlledRagdoll *> SelfTickedRagdolls;
+
+	/** GFrameCounter of the last GatherSelfTickedRemoteControllerInputs() that waited. */
+	uint64 SelfTickedInputsGatheredFrame = MAX_uint64;
+
+	/** Scratch list for GatherRemoteControllerInputs(). */
+	TArray<AControlledRagdoll *> PendingRemoteControllers;
 
 	/** Actors registered for managed NetUpdateFrequency. @see RegisterManagedNetUpdateFrequency, UnregisterManagedNetUpdateFrequency */
 	std::unordered_set<AActor *> NetUpdateFrequencyManagedActors;
 
 
-	/** Cap the tick rate. Only operates when using fixed time steps (otherwise no-op). */
+	/** Decide whether to cap the tick rate, according to the net mode and ServerTickRateCap. Logs each transition. */
+	void UpdateTickRatePolicy();
+
+	/** Cap the tick rate by pacing ticks against absolute deadlines. Only operates when using fixed time steps (otherwise no-op). */
 	void HandleMaxTickRate( const float MaxTickRate );
 
-	/** Estimate and log the current average tick rate. */
+	/** Record the frame time, estimate the current average tick rate, and periodically log the frame time percentiles. */
 	void estimateAverageTickRate();
 
-	/** Re-adjust client game speed so as to match the server game speed. Has no effect if called on server / standalone. */
+	/** Re-adjust client game speed so as to keep the client simulation time aligned with ServerSimulationTime. Called on each received server timestamp.
+	 ** Has no effect if called on server / standalone. */
 	void syncGameSpeedWithServer();
 
+	/** Replication notify for ServerSimulationTime. */
+	UFUNCTION()
+	void OnRep_ServerSimulationTime();
+
+	/** Wait until the documents of the remote controllers of all provided ragdolls have arrived, receiving from whichever socket has data, so that the wait
+	 ** takes as long as the slowest controller instead of the sum of all. */
+	void GatherRemoteControllerInputs( const TArray<AControlledRagdoll *> & ragdolls );
+
+	/** Tick all registered ragdolls through the pre-physics stages, stage by stage, running the stages that only touch a single ragdoll in parallel.
+	 ** @see BatchTickRagdolls */
+	void TickRagdolls( float deltaSeconds );
+
 	/** Manage net update frequencies of the registered actors (@see NetUpdateFrequencyManagedActors). */
 	void manageNetUpdateFrequencies( float gameDeltaTime );
 
@@ -54,23 +212,73 @@ public:
 	UPROPERTY( Config )
 	float FixedFps = 60.f;
 
-	/** Whether to cap the real (wall-clock) tick rate by FixedFps also on dedicated servers. */
+	/** When to cap the real (wall-clock) tick rate by FixedFps on dedicated servers. By default, servers run as fast as possible while nobody watches, and
+	 ** switch to real time whenever a client connects. */
 	UPROPERTY( Config )
-	bool CapServerTickRate = false;
+	TEnumAsByte<EServerTickRateCap::Type> ServerTickRateCap = EServerTickRateCap::WhenSpectated;
 
 	/** Target real-time value for AActor::NetUpdateFrequency (the nominal value must be corrected by the wall clock vs game time fps difference).
 	 ** This is used for actors that have registered for automatic NetUpdateFrequency management. @see RegisterManagedNetUpdateFrequency */
 	UPROPERTY( Config )
 	float RealtimeNetUpdateFrequency = 60.f;
 
+	/** Channel for server-to-client pose replication. Must be the same on the server and on the clients. */
+	UPROPERTY( Config )
+	TEnumAsByte<EPoseReplicationMode::Type> PoseReplicationMode = EPoseReplicationMode::Property;
+
+	/** Pose replication: a bone is re-sent only if its position has changed by more than this (world units) since it was last sent. Linear velocities are
+	 ** compared against this times RealtimeNetUpdateFrequency. On the UnreliableMulticast channel, a pose packet is sent only if some bone has changed
+	 ** (an unchanged pose is re-sent once per second). */
+	UPROPERTY( Config )
+	float PoseReplicationPositionThreshold = 0.05f;
+
+	/** Pose replication: a bone is re-sent only if its rotation has changed by more than this (radians) since it was last sent. Angular velocities are
+	 ** compared against this times RealtimeNetUpdateFrequency. @see PoseReplicationPositionThreshold */
+	UPROPERTY( Config )
+	float PoseReplicationRotationThreshold = 0.001f;
+
 	/** If true, then clients are synced to server's speed and the pose is updated on clients only whenever a new pose is received from the server.
 	 ** If false, then the pose is updated on each tick, effectively freezing the actor between pose replications. Game speeds will not be synced in this case.
 	 ** Note that client-side prediction with a non-realtime server might require adjustments of the max physics (sub)step size! */
 	UPROPERTY( Config )
 	bool PoseReplicationDoClientsidePrediction = false;
 
+	/** Clients play out received poses this far (seconds) behind the server, interpolating between them, so as to hide network jitter. Should cover a few
+	 ** pose intervals at RealtimeNetUpdateFrequency. Zero disables the jitter buffer: the latest pose is then applied as is. Not used with client-side
+	 ** prediction. */
+	UPROPERTY( Config )
+	float PoseJitterBufferDelay = 0.05f;
+
+	/** Clients extrapolate the newest received pose along its velocities for at most this long (seconds) when poses are late. */
+	UPROPERTY( Config )
+	float PoseMaxExtrapolationTime = 0.1f;
+
+
+	/** If true, then ragdolls are moved out of the world's PhysX scene into private scenes that are stepped concurrently. Ragdolls in different private
+	 ** scenes do not interact with each other nor with dynamic objects of the world. @see AControlledRagdoll::PhysicsSceneGroup */
+	UPROPERTY( Config )
+	bool UseParallelPhysicsScenes = false;
+
+	/** If true, then ragdolls are ticked by this actor instead of through their own tick functions: each tick stage is run for all ragdolls before moving to
+	 ** the next one, and computing the torques and reading the simulation are spread over the task graph workers. The pre-physics stages run in this
+	 ** actor's Tick(), the post-physics stages in a TG_PostPhysics tick function. Standalone / server only. @see AControlledRagdoll::TickStageInbound */
+	UPROPERTY( Config )
+	bool BatchTickRagdolls = false;
+
+	/** If true, then remote controller communication overlaps with the physics step: while PhysX simulates a tick, the observations of the previous tick
+	 ** are sent and the commands for the next tick are received, so that the network and xml costs are hidden behind the simulation. Costs one tick of
+	 ** action delay, @see ActionDelayTicks. Standalone / server only. */
+	UPROPERTY( Config )
+	bool PipelineRemoteControllers = false;
+
+	/** Action delay of remote controllers, in ticks: the setter commands of a document that responds to the observations of tick k act on the physics step
+	 ** of tick k + 1 + ActionDelayTicks. Without pipelining the delay can be zero, with pipelining it is at least one; smaller values are raised to the
+	 ** minimum. Larger delays queue the received documents. */
+	UPROPERTY( Config )
+	int32 ActionDelayTicks = 0;
+
 
-	/** Computed estimate of the current average tick rate (averaging window length is controlled by ESTIMATE_TICKRATE_SAMPLES). */
+	/** Computed estimate of the current average tick rate, over the last 1-2 seconds of TickTimes. */
 	float currentAverageTickRate;
 
 	/** Computed estimate of the current average tick rate of the authoritative world: if server or standalone, then this equals currentAverageTickRate,
@@ -78,16 +286,63 @@ public:
 	UPROPERTY( Replicated )
 	float currentAverageAuthorityTickRate;
 
+	/** Simulation time (UWorld::GetTimeSeconds()) of the authoritative world at its latest tick, for client clock synchronization. */
+	UPROPERTY( ReplicatedUsing = OnRep_ServerSimulationTime )
+	float ServerSimulationTime;
+
 
 
 	ARCLevelScriptActor( const FObjectInitializer & ObjectInitializer );
 
 
+	virtual ~ARCLevelScriptActor();
+
 	virtual void PostInitializeComponents() override;
 	virtual void BeginPlay() override;
+	virtual void EndPlay( const EEndPlayReason::Type EndPlayReason ) override;
 	virtual void Tick( float deltaSeconds ) override;
 
 
+	/** Get the private physics scenes. Returns null if UseParallelPhysicsScenes is off, if we are not authority, or if the private scenes have already been
+	 ** torn down at the end of play. */
+	ParallelPhysicsScenes * GetParallelPhysicsScenes();
+
+	/** Step the private physics scenes. Called by PhysicsScenesTickFunction. */
+	void StepParallelPhysicsScenes( float deltaSeconds );
+
+	/** Tick all registered ragdolls through the post-physics stages. Called by RagdollsPostPhysicsTickFunction. @see TickRagdolls */
+	void TickRagdollsPostPhysics( float deltaSeconds );
+
+	/** Tick all registered ragdolls through the during-physics stages, if PipelineRemoteControllers is set. Called by RagdollsDuringPhysicsTickFunction.
+	 ** @see TickRagdolls */
+	void TickRagdollsDuringPhysics( float deltaSeconds );
+
+
+	/** Get a one-line summary of the wall clock frame times: count, mean, p50, p99 and max over the last 1, 10 and 60 seconds. Can be called from any
+	 ** thread. Used for the log, the rc.TickStats console command and the TICKSTATS remote query. */
+	FString GetTickTimeReport() const;
+
+
+	/** Register a ragdoll for batch ticking. The ragdoll must disable its own tick function. No-op with a logged warning if the ragdoll is already
+	 ** registered. @see BatchTickRagdolls, UnregisterBatchTickedRagdoll */
+	void RegisterBatchTickedRagdoll( AControlledRagdoll * ragdoll );
+
+	/** Unregister a ragdoll from batch ticking. No-op with a logged warning if the ragdoll has not been registered. @see RegisterBatchTickedRagdoll */
+	void UnregisterBatchTickedRagdoll( AControlledRagdoll * ragdoll );
+
+	/** Register a ragdoll that ticks through its own tick functions, for GatherSelfTickedRemoteControllerInputs(). No-op with a logged warning if the ragdoll
+	 ** is already registered. @see UnregisterSelfTickedRagdoll */
+	void RegisterSelfTickedRagdoll( AControlledRagdoll * ragdoll );
+
+	/** Unregister a self-ticked ragdoll. No-op with a logged warning if the ragdoll has not been registered. @see RegisterSelfTickedRagdoll */
+	void UnregisterSelfTickedRagdoll( AControlledRagdoll * ragdoll );
+
+	/** Wait until the documents of the remote controllers of all self-ticked ragdolls have arrived, as batch ticking does before its inbound stage. Waits on
+	 ** the first call of each tick, no-op afterwards: the self-ticked ragdolls call it before receiving, so that the first of them to tick waits for all.
+	 ** Not for pipelined remote controllers, whose documents answer observations that the ragdolls send during the same tick. */
+	void GatherSelfTickedRemoteControllerInputs();
+
+
 	/** Register an actor so as to have its NetUpdateFrequency automatically corrected on each tick, so as to take into account the simulation time vs. wall
 	 ** clock time difference; UE does not take care of this in our case of using fixed time steps. No-op with a logged warning if the actor is already
 	 ** registered. @see UnregisterManagedNetUpdateFrequency */
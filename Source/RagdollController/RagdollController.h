@@ -8,3 +8,6 @@
 DECLARE_LOG_CATEGORY_EXTERN( LogRcSystem, Log, All );   // RagdollController: system log
 DECLARE_LOG_CATEGORY_EXTERN( LogRcCr, Log, All );   // RagdollController: ControlledRagdoll log
 DECLARE_LOG_CATEGORY_EXTERN( LogRcRch, Log, All );   // RagdollController: RemoteControlHub log
+
+
+DECLARE_STATS_GROUP( TEXT( "RagdollController" ), STATGROUP_RagdollController, STATCAT_Advanced );   // RagdollController: tick phase timings
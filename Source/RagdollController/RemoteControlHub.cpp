@@ -4,12 +4,14 @@
 #include "RemoteControlHub.h"
 
 #include "RemoteControllable.h"
+#include "RCLevelScriptActor.h"
 
 #include "XmlFSocket.h"
+#include "FSocketByteStream.h"
 #include "ScopeGuard.h"
-#include "Utility.h"
 
 #include <Networking.h>
+#include <boost/utility/string_ref.hpp>
 
 #include <string>
 #include <memory>
@@ -30,9 +32,44 @@
 
 // command strings
 #define RCH_COMMAND_CONNECT "CONNECT "
+#define RCH_COMMAND_TICKSTATS "TICKSTATS"
 
-// size of the buffer for incoming dispatch command lines
-#define LINE_BUFFER_SIZE 1024
+
+
+
+/** Convert a line (or a part of it) for logging. Allocates: keep it off the success paths. */
+static FString LineToFString( boost::string_ref line )
+{
+	return FString( UTF8_TO_TCHAR( std::string( line.begin(), line.end() ).c_str() ) );
+}
+
+
+
+
+/** Compare a name, up to its first '_' or its end, to a line (or a part of it) without converting either. Names and lines are ASCII in practice, so the
+ ** comparison is per code unit. */
+template<typename CharType>
+static bool IsNameEqual( const CharType * name, boost::string_ref line )
+{
+	std::size_t i = 0;
+	for( ; name[i] != 0 && name[i] != '_'; ++i )
+	{
+		if( i >= line.size() || name[i] != CharType( (unsigned char)line[i] ) ) return false;
+	}
+
+	return i == line.size();
+}
+
+
+
+
+/** Compare an actor name, cleaned up as by Utility::CleanupName() (cut at the first '_', which also drops the instance number), to a line. The name is read
+ ** in place from its name table entry. */
+static bool IsNameEqual( const FName & name, boost::string_ref line )
+{
+	const FNameEntry * entry = name.GetDisplayNameEntry();
+	return entry->IsWide() ? IsNameEqual( entry->GetWideName(), line ) : IsNameEqual( entry->GetAnsiName(), line );
+}
 
 
 
@@ -136,7 +173,7 @@ void ARemoteControlHub::CheckForNewConnections()
 			finalReceiveBufferSize, finalSendBufferSize );
 
 		// wrap the socket into an XmlFSocket and store it to PendingSockets (check goodness later)
-		this->PendingSockets.Add( std::make_unique<XmlFSocket>( std::move( connectionSocket ) ) );
+		this->PendingSockets.Add( std::make_unique<XmlFSocket>( std::make_unique<FSocketByteStream>( std::move( connectionSocket ) ) ) );
 
 	}
 }
@@ -165,8 +202,7 @@ void ARemoteControlHub::ManagePendingConnections()
 		}
 
 		// try to dispatch the connection, then remove the socket from the pending sockets list
-		std::string command = (*iterPendingSocket)->Line;   // do this before move
-		DispatchSocket( command, std::move( *iterPendingSocket ) );
+		DispatchSocket( std::move( *iterPendingSocket ) );
 		this->PendingSockets.RemoveAt( iterPendingSocket.GetIndex() );
 
 		// play safe and don't touch the iterator anymore
@@ -177,25 +213,32 @@ void ARemoteControlHub::ManagePendingConnections()
 
 
 
-void ARemoteControlHub::DispatchSocket( std::string command, std::unique_ptr<XmlFSocket> socket )
+void ARemoteControlHub::DispatchSocket( std::unique_ptr<XmlFSocket> socket )
 {
+	// refer to the command line in the socket's buffer (valid until the socket is read from again)
+	boost::string_ref command = socket->Line;
+
 	// verify and remove handshake
-	if( command.compare( 0, std::strlen( RCH_HANDSHAKE_STRING ), RCH_HANDSHAKE_STRING ) != 0 )
+	if( !command.starts_with( RCH_HANDSHAKE_STRING ) )
 	{
-		UE_LOG( LogRcRch, Error, TEXT( "(%s) Invalid handshake string: %s" ), TEXT( __FUNCTION__ ), *FString( command.c_str() ) );
+		UE_LOG( LogRcRch, Error, TEXT( "(%s) Invalid handshake string: %s" ), TEXT( __FUNCTION__ ), *LineToFString( command ) );
 		socket->PutLine( RCH_ERROR_STRING );   // don't care about errors
 		return;
 	}
-	command.erase( 0, std::strlen( RCH_HANDSHAKE_STRING ) );
+	command.remove_prefix( std::strlen( RCH_HANDSHAKE_STRING ) );
 
 	// switch on command
-	if( command.compare( 0, std::strlen( RCH_COMMAND_CONNECT ), RCH_COMMAND_CONNECT ) == 0 )
+	if( command.starts_with( RCH_COMMAND_CONNECT ) )
 	{
 		CmdConnect( command.substr( std::strlen( RCH_COMMAND_CONNECT ) ), std::move( socket ) );
 	}
+	else if( command == RCH_COMMAND_TICKSTATS )
+	{
+		CmdTickStats( std::move( socket ) );
+	}
 	else
 	{
-		UE_LOG( LogRcRch, Error, TEXT( "(%s) Invalid command: %s" ), TEXT( __FUNCTION__ ), *FString( command.c_str() ) );
+		UE_LOG( LogRcRch, Error, TEXT( "(%s) Invalid command: %s" ), TEXT( __FUNCTION__ ), *LineToFString( command ) );
 		socket->PutLine( RCH_ERROR_STRING );
 	}
 }
@@ -203,24 +246,24 @@ void ARemoteControlHub::DispatchSocket( std::string command, std::unique_ptr<Xml
 
 
 
-void ARemoteControlHub::CmdConnect( std::string args, std::unique_ptr<XmlFSocket> socket )
+void ARemoteControlHub::CmdConnect( boost::string_ref args, std::unique_ptr<XmlFSocket> socket )
 {
 	// find the target actor based on its FName
 	check( GetWorld() );
 	for( TActorIterator<AActor> iter( GetWorld() ); iter; ++iter )
 	{
-		if( Utility::CleanupName( iter->GetName() ) == FString( args.c_str() ) )
+		if( IsNameEqual( iter->GetFName(), args ) )
 		{
 			/* target actor found */
 
-			UE_LOG( LogRcRch, Log, TEXT( "(%s) Target actor found, forwarding the connection. Target: %s" ), TEXT( __FUNCTION__ ), *FString( args.c_str() ) );
+			UE_LOG( LogRcRch, Log, TEXT( "(%s) Target actor found, forwarding the connection. Target: %s" ), TEXT( __FUNCTION__ ), *iter->GetName() );
 
 			// check that the actor is RemoteControllable
 			IRemoteControllable * target = Cast<IRemoteControllable>( *iter );
 			if( !target )
 			{
 				// no: log and let the connection drop
-				UE_LOG( LogRcRch, Error, TEXT( "(%s) Target actor is not RemoteControllable! Target: %s" ), TEXT( __FUNCTION__ ), *FString( args.c_str() ) );
+				UE_LOG( LogRcRch, Error, TEXT( "(%s) Target actor is not RemoteControllable! Target: %s" ), TEXT( __FUNCTION__ ), *iter->GetName() );
 				socket->PutLine( RCH_ERROR_STRING );
 				return;
 			}
@@ -229,7 +272,7 @@ void ARemoteControlHub::CmdConnect( std::string args, std::unique_ptr<XmlFSocket
 			if( !socket->PutLine( RCH_ACK_STRING ) )
 			{
 				// failed: log and let the connection drop (no point in sending an error string to the already failed TCP stream)
-				UE_LOG( LogRcRch, Error, TEXT( "(%s) Failed to send ACK string to remote!" ), TEXT( __FUNCTION__ ), *FString( args.c_str() ) );
+				UE_LOG( LogRcRch, Error, TEXT( "(%s) Failed to send ACK string to remote! Target: %s" ), TEXT( __FUNCTION__ ), *iter->GetName() );
 				return;
 			}
 
@@ -240,6 +283,27 @@ void ARemoteControlHub::CmdConnect( std::string args, std::unique_ptr<XmlFSocket
 	}
 
 	// target not found, log and let the connection drop
-	UE_LOG( LogRcRch, Error, TEXT( "(%s) Target actor not found: %s" ), TEXT( __FUNCTION__ ), *FString( args.c_str() ) );
+	UE_LOG( LogRcRch, Error, TEXT( "(%s) Target actor not found: %s" ), TEXT( __FUNCTION__ ), *LineToFString( args ) );
 	socket->PutLine( RCH_ERROR_STRING );
 }
+
+
+
+
+void ARemoteControlHub::CmdTickStats( std::unique_ptr<XmlFSocket> socket )
+{
+	check( GetWorld() );
+	ARCLevelScriptActor * lsa = Cast<ARCLevelScriptActor>( GetWorld()->GetLevelScriptActor() );
+	if( !lsa )
+	{
+		UE_LOG( LogRcRch, Error, TEXT( "(%s) The level script actor is not an ARCLevelScriptActor!" ), TEXT( __FUNCTION__ ) );
+		socket->PutLine( RCH_ERROR_STRING );
+		return;
+	}
+
+	// reply and let the connection drop (don't care about errors)
+	if( socket->PutLine( RCH_ACK_STRING ) )
+	{
+		socket->PutLine( TCHAR_TO_UTF8( *lsa->GetTickTimeReport() ) );
+	}
+}
@@ -6,8 +6,8 @@
 #include "XmlFSocket.h"
 
 #include <Networking.h>
+#include <boost/utility/string_ref.hpp>
 
-#include <string>
 #include <memory>
 
 #include "RemoteControlHub.generated.h"
@@ -42,14 +42,18 @@ protected:
 	/** Check if any of the PendingSockets have received the necessary information for doing a dispatch. */
 	void ManagePendingConnections();
 
-	/** Try to dispatch the socket according to the command. Close and discard the socket upon errors. */
-	void DispatchSocket( std::string command, std::unique_ptr<XmlFSocket> socket );
+	/** Try to dispatch the socket according to the command in its last line (XmlFSocket::Line). Close and discard the socket upon errors. */
+	void DispatchSocket( std::unique_ptr<XmlFSocket> socket );
 
 
 	/* commands */
 
-	/** Connect directly to an actor that implements the RemoteControllable interface */
-	void CmdConnect( std::string args, std::unique_ptr<XmlFSocket> socket );
+	/** Connect directly to an actor that implements the RemoteControllable interface. args refers to the line buffer of the socket: it is only valid until
+	 ** the socket is read from or handed over. */
+	void CmdConnect( boost::string_ref args, std::unique_ptr<XmlFSocket> socket );
+
+	/** Reply with an ACK line followed by the frame time report of the level script actor (@see ARCLevelScriptActor::GetTickTimeReport), then close. */
+	void CmdTickStats( std::unique_ptr<XmlFSocket> socket );
 
 
 public:
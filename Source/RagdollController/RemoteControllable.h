@@ -37,4 +37,7 @@ public:
 
 	virtual void ConnectWith( std::unique_ptr<XmlFSocket> socket );
 
+	/** Whether a remote controller is currently connected. */
+	bool IsRemoteControlled() const { return this->RemoteControlSocket != nullptr; }
+
 };
@@ -0,0 +1,200 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "TickProfiler.h"
+
+#include <string>
+#include <memory>
+#include <map>
+#include <algorithm>
+
+
+// upper limit for the number of events in a capture (about 40 bytes each), further events are dropped
+#define TICK_PROFILER_MAX_EVENTS (1 << 21)
+
+// size of the output buffer for writing the trace file
+#define TICK_PROFILER_WRITE_BUFFER_SIZE (256 * 1024)
+
+
+
+
+std::atomic<bool> TickProfiler::Capturing( false );
+std::mutex TickProfiler::EventsMutex;
+std::vector<TickProfiler::Event> TickProfiler::Events;
+double TickProfiler::CaptureStartTime = 0.0;
+bool TickProfiler::DroppedEvents = false;
+
+
+
+
+TickProfiler::Scope::Scope( const char * phase, const AActor * actor ) :
+	Phase( phase ),
+	Actor( actor ),
+	StartTime( IsCapturing() ? FPlatformTime::Seconds() : 0.0 )
+{
+}
+
+
+
+
+TickProfiler::Scope::~Scope()
+{
+	if( this->StartTime != 0.0 )
+	{
+		AddEvent( this->Phase, this->Actor, this->StartTime, FPlatformTime::Seconds() );
+	}
+}
+
+
+
+
+void TickProfiler::AddEvent( const char * phase, const AActor * actor, double startTime, double endTime )
+{
+	std::lock_guard<std::mutex> lock( EventsMutex );
+
+	// the capture might have been stopped while the scope was open
+	if( !IsCapturing() ) return;
+
+	if( Events.size() >= TICK_PROFILER_MAX_EVENTS )
+	{
+		if( !DroppedEvents )
+		{
+			UE_LOG( LogRcSystem, Warning, TEXT( "(%s) Trace capture is full (%d events), dropping further events." ), TEXT( __FUNCTION__ ), TICK_PROFILER_MAX_EVENTS );
+			DroppedEvents = true;
+		}
+		return;
+	}
+
+	Events.push_back( Event{ phase, actor ? actor->GetFName() : NAME_None, FPlatformTLS::GetCurrentThreadId(), GFrameCounter, startTime, endTime - startTime } );
+}
+
+
+
+
+void TickProfiler::StartCapture()
+{
+	std::lock_guard<std::mutex> lock( EventsMutex );
+
+	Events.clear();
+	Events.reserve( 64 * 1024 );
+	CaptureStartTime = FPlatformTime::Seconds();
+	DroppedEvents = false;
+	Capturing.store( true, std::memory_order_relaxed );
+
+	UE_LOG( LogRcSystem, Log, TEXT( "(%s) Tick trace capture started." ), TEXT( __FUNCTION__ ) );
+}
+
+
+
+
+bool TickProfiler::StopCapture( const FString & filePath )
+{
+	std::lock_guard<std::mutex> lock( EventsMutex );
+
+	if( !IsCapturing() )
+	{
+		UE_LOG( LogRcSystem, Warning, TEXT( "(%s) No tick trace capture is running." ), TEXT( __FUNCTION__ ) );
+		return false;
+	}
+	Capturing.store( false, std::memory_order_relaxed );
+
+	LogSummary();
+
+	std::unique_ptr<FArchive> file( IFileManager::Get().CreateFileWriter( *filePath ) );
+	if( !file )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to open '%s' for writing!" ), TEXT( __FUNCTION__ ), *filePath );
+		return false;
+	}
+
+	// trace-event JSON: one complete ("X") event per phase scope, timestamps in microseconds since the start of the capture
+	std::string buffer;
+	buffer.reserve( TICK_PROFILER_WRITE_BUFFER_SIZE + 1024 );
+	buffer += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	char line[512];
+	for( size_t ind = 0; ind < Events.size(); ++ind )
+	{
+		const Event & event = Events[ind];
+		FCStringAnsi::Snprintf( line, sizeof( line ),
+			"%s{\"name\":\"%s\",\"cat\":\"tick\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"actor\":\"%s\",\"frame\":%llu}}",
+			ind > 0 ? ",\n" : "", event.Phase, event.ThreadId, (event.StartTime - CaptureStartTime) * 1e6, event.Duration * 1e6,
+			TCHAR_TO_UTF8( *event.Actor.ToString() ), (unsigned long long)event.Frame );
+		buffer += line;
+
+		if( buffer.size() >= TICK_PROFILER_WRITE_BUFFER_SIZE )
+		{
+			file->Serialize( &buffer[0], buffer.size() );
+			buffer.clear();
+		}
+	}
+
+	buffer += "\n]}\n";
+	file->Serialize( &buffer[0], buffer.size() );
+
+	bool ok = file->Close() && !file->IsError();
+	if( ok )
+	{
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s) Tick trace with %d events written into '%s'." ), TEXT( __FUNCTION__ ), int32( Events.size() ), *filePath );
+	}
+	else
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to write the tick trace into '%s'!" ), TEXT( __FUNCTION__ ), *filePath );
+	}
+
+	Events.clear();
+	Events.shrink_to_fit();
+	return ok;
+}
+
+
+
+
+void TickProfiler::LogSummary()
+{
+	if( Events.empty() ) return;
+
+	// totals per phase and per actor
+	std::map<std::string, double> phaseTotals;
+	TMap<FName, double> actorTotals;
+	uint64 firstFrame = Events.front().Frame;
+	uint64 lastFrame = Events.front().Frame;
+	for( const Event & event : Events )
+	{
+		phaseTotals[event.Phase] += event.Duration;
+		actorTotals.FindOrAdd( event.Actor ) += event.Duration;
+		firstFrame = std::min( firstFrame, event.Frame );
+		lastFrame = std::max( lastFrame, event.Frame );
+	}
+	double numFrames = double( lastFrame - firstFrame + 1 );
+
+	UE_LOG( LogRcSystem, Log, TEXT( "(%s) Tick trace summary over %.0f frames (mean time per frame):" ), TEXT( __FUNCTION__ ), numFrames );
+	for( const auto & phase : phaseTotals )
+	{
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s)   phase %s: %.3f ms" ), TEXT( __FUNCTION__ ), UTF8_TO_TCHAR( phase.first.c_str() ), phase.second / numFrames * 1e3 );
+	}
+	for( const auto & actor : actorTotals )
+	{
+		UE_LOG( LogRcSystem, Log, TEXT( "(%s)   actor %s: %.3f ms" ), TEXT( __FUNCTION__ ), *actor.Key.ToString(), actor.Value / numFrames * 1e3 );
+	}
+}
+
+
+
+
+/** Console commands for starting and stopping a capture. The trace is written into Saved/Traces. */
+static void StopTickTraceCapture( const TArray<FString> & args )
+{
+	FString directory = FPaths::Combine( *FPaths::GameSavedDir(), TEXT( "Traces" ) );
+	IFileManager::Get().MakeDirectory( *directory, true );
+
+	FString fileName = args.Num() > 0 ? FPaths::GetCleanFilename( args[0] ) : FString::Printf( TEXT( "TickTrace-%s.json" ), *FDateTime::Now().ToString() );
+	TickProfiler::StopCapture( FPaths::Combine( *directory, *fileName ) );
+}
+
+static FAutoConsoleCommand TraceStartCommand( TEXT( "rc.TraceStart" ), TEXT( "Start capturing a trace of the ragdoll tick phases." ),
+	FConsoleCommandDelegate::CreateStatic( &TickProfiler::StartCapture ) );
+
+static FAutoConsoleCommand TraceStopCommand( TEXT( "rc.TraceStop" ),
+	TEXT( "Stop capturing the tick phase trace and write it as Chrome trace JSON into Saved/Traces. Optional argument: file name." ),
+	FConsoleCommandWithArgsDelegate::CreateStatic( &StopTickTraceCapture ) );
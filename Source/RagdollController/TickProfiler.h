@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+
+
+
+/** Time a tick phase of the calling actor (this), both as a UE cycle stat and, while a capture is running, as a TickProfiler trace event. */
+#define RC_SCOPE_TICK_PHASE( StatId, PhaseName ) \
+	SCOPE_CYCLE_COUNTER( StatId ); \
+	TickProfiler::Scope ANONYMOUS_VARIABLE( TickPhaseScope )( PhaseName, this )
+
+
+
+
+/**
+ * Collects scoped timings of actor tick phases, and exports them as a Chrome trace (chrome://tracing, Perfetto).
+ *
+ * Timings are collected only while a capture is running; otherwise a Scope costs a single relaxed atomic load. Scopes may be opened from any thread. When a
+ * capture is stopped, the events are written as trace-event JSON, and a per-phase and per-actor summary (mean time per frame) is logged.
+ */
+class TickProfiler
+{
+public:
+
+	/** Records the duration of its lifetime as a trace event, if a capture is running when it is constructed. */
+	class Scope
+	{
+		const char * Phase;
+		const AActor * Actor;
+		double StartTime;
+
+	public:
+		Scope( const char * phase, const AActor * actor );
+		~Scope();
+	};
+
+
+private:
+
+	struct Event
+	{
+		const char * Phase;
+		FName Actor;
+		uint32 ThreadId;
+		uint64 Frame;
+		double StartTime;
+		double Duration;
+	};
+
+	static std::atomic<bool> Capturing;
+	static std::mutex EventsMutex;
+	static std::vector<Event> Events;
+	static double CaptureStartTime;
+
+	/** Whether events have been dropped in the current capture because of TICK_PROFILER_MAX_EVENTS. */
+	static bool DroppedEvents;
+
+
+	static void AddEvent( const char * phase, const AActor * actor, double startTime, double endTime );
+
+	/** Log the mean time per frame of each phase and of each actor. */
+	static void LogSummary();
+
+
+public:
+
+	/** Start a new capture, discarding the events of a running one. */
+	static void StartCapture();
+
+	/** Stop the capture and write the trace into the provided file. Returns false if no capture was running or if writing failed. */
+	static bool StopCapture( const FString & filePath );
+
+	static bool IsCapturing() { return Capturing.load( std::memory_order_relaxed ); }
+};
@@ -0,0 +1,569 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "TrajectoryFile.h"
+
+#if PLATFORM_WINDOWS
+#include "AllowWindowsPlatformTypes.h"
+#include <windows.h>
+#include "HideWindowsPlatformTypes.h"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+
+// file format identification
+#define TRAJECTORY_FILE_MAGIC "RCTRAJ\0\0"
+#define TRAJECTORY_FILE_VERSION 1
+
+// the header (binary header + schema text) is padded to a multiple of this
+#define TRAJECTORY_HEADER_ALIGNMENT 4096
+
+// writer chunk size in bytes (rounded down to whole records, at least one record)
+#define TRAJECTORY_CHUNK_SIZE (1 << 20)
+
+
+
+
+std::string TrajectoryRecordLayout::MakeSchema( const TArray<FName> & jointNames ) const
+{
+	std::ostringstream schema;
+	schema << "frame:u64 time:f64 jointAngles:f32[" << this->NumJoints << "][3] motorCommands:f32[" << this->NumJoints << "][3] bodies:f32["
+		<< this->NumBodies << "][13] (px py pz qx qy qz qw vx vy vz wx wy wz)\n";
+	schema << "joints:";
+	for( int32 joint = 0; joint < jointNames.Num(); ++joint )
+	{
+		schema << (joint > 0 ? "," : "") << TCHAR_TO_UTF8( *jointNames[joint].ToString() );
+	}
+	schema << "\n";
+
+	return schema.str();
+}
+
+
+
+
+#if PLATFORM_WINDOWS
+
+namespace
+{
+	const intptr_t InvalidHandle = (intptr_t)INVALID_HANDLE_VALUE;
+
+	uint64 GetMapAlignment()
+	{
+		SYSTEM_INFO systemInfo;
+		GetSystemInfo( &systemInfo );
+		return systemInfo.dwAllocationGranularity;
+	}
+}
+
+
+MappedFile::MappedFile() : Handle( InvalidHandle ) {}
+
+
+bool MappedFile::Open( const FString & path, bool writable )
+{
+	Close();
+	this->Writable = writable;
+	this->Handle = (intptr_t)CreateFileW( *path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+		writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	return IsOpen();
+}
+
+
+void MappedFile::Close()
+{
+	if( IsOpen() ) CloseHandle( (HANDLE)this->Handle );
+	this->Handle = InvalidHandle;
+}
+
+
+uint64 MappedFile::GetSize() const
+{
+	LARGE_INTEGER size;
+	return IsOpen() && GetFileSizeEx( (HANDLE)this->Handle, &size ) ? uint64( size.QuadPart ) : 0;
+}
+
+
+MappedFile::View MappedFile::Map( uint64 offset, uint64 size )
+{
+	View view;
+	if( !IsOpen() || size == 0 ) return view;
+
+	// a mapping object larger than the file extends the file
+	uint64 end = this->Writable ? offset + size : GetSize();
+	HANDLE mapping = CreateFileMappingW( (HANDLE)this->Handle, nullptr, this->Writable ? PAGE_READWRITE : PAGE_READONLY, DWORD( end >> 32 ),
+		DWORD( end & 0xffffffff ), nullptr );
+	if( !mapping ) return view;
+
+	// views must start at a multiple of the allocation granularity. The view keeps the mapping object alive.
+	uint64 alignedOffset = offset - offset % GetMapAlignment();
+	uint64 mappedSize = offset + size - alignedOffset;
+	void * base = MapViewOfFile( mapping, this->Writable ? FILE_MAP_WRITE : FILE_MAP_READ, DWORD( alignedOffset >> 32 ), DWORD( alignedOffset & 0xffffffff ),
+		SIZE_T( mappedSize ) );
+	CloseHandle( mapping );
+	if( !base ) return view;
+
+	view.Base = base;
+	view.MappedSize = mappedSize;
+	view.Data = (uint8 *)base + (offset - alignedOffset);
+	return view;
+}
+
+
+void MappedFile::Unmap( View & view )
+{
+	if( view.Base ) UnmapViewOfFile( view.Base );
+	view = View();
+}
+
+#else
+
+namespace
+{
+	const intptr_t InvalidHandle = -1;
+
+	uint64 GetMapAlignment()
+	{
+		return (uint64)sysconf( _SC_PAGESIZE );
+	}
+}
+
+
+MappedFile::MappedFile() : Handle( InvalidHandle ) {}
+
+
+bool MappedFile::Open( const FString & path, bool writable )
+{
+	Close();
+	this->Writable = writable;
+	this->Handle = open( TCHAR_TO_UTF8( *path ), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644 );
+	return IsOpen();
+}
+
+
+void MappedFile::Close()
+{
+	if( IsOpen() ) close( (int)this->Handle );
+	this->Handle = InvalidHandle;
+}
+
+
+uint64 MappedFile::GetSize() const
+{
+	struct stat fileStat;
+	return IsOpen() && fstat( (int)this->Handle, &fileStat ) == 0 ? uint64( fileStat.st_size ) : 0;
+}
+
+
+MappedFile::View MappedFile::Map( uint64 offset, uint64 size )
+{
+	View view;
+	if( !IsOpen() || size == 0 ) return view;
+
+	// grow the file to cover the view, mapping past the end of file would fault on access
+	if( this->Writable && GetSize() < offset + size && ftruncate( (int)this->Handle, off_t( offset + size ) ) != 0 ) return view;
+
+	// views must start at a page boundary
+	uint64 alignedOffset = offset - offset % GetMapAlignment();
+	uint64 mappedSize = offset + size - alignedOffset;
+	void * base = mmap( nullptr, size_t( mappedSize ), this->Writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, (int)this->Handle,
+		off_t( alignedOffset ) );
+	if( base == MAP_FAILED ) return view;
+
+	view.Base = base;
+	view.MappedSize = mappedSize;
+	view.Data = (uint8 *)base + (offset - alignedOffset);
+	return view;
+}
+
+
+void MappedFile::Unmap( View & view )
+{
+	if( view.Base ) munmap( view.Base, size_t( view.MappedSize ) );
+	view = View();
+}
+
+#endif
+
+
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+
+
+bool MappedFile::IsOpen() const
+{
+	return this->Handle != InvalidHandle;
+}
+
+
+
+
+TrajectoryWriter::TrajectoryWriter() :
+	Out( std::make_shared<Output>() )
+{
+}
+
+
+
+
+std::unique_ptr<TrajectoryWriter> TrajectoryWriter::Create( const FString & path, const TArray<FName> & jointNames, int32 numBodies )
+{
+	std::unique_ptr<TrajectoryWriter> writer( new TrajectoryWriter );
+	Output & out = *writer->Out;
+	writer->Layout.NumJoints = jointNames.Num();
+	writer->Layout.NumBodies = numBodies;
+	writer->RecordSize = out.RecordSize = writer->Layout.GetRecordSize();
+	writer->ChunkRecords = std::max( TRAJECTORY_CHUNK_SIZE / writer->RecordSize, 1 );
+
+	// build the header
+	std::string schema = writer->Layout.MakeSchema( jointNames );
+	out.HeaderSize = Align( uint32( sizeof( TrajectoryFileHeader ) + schema.size() + 1 ), TRAJECTORY_HEADER_ALIGNMENT );
+
+	TrajectoryFileHeader header;
+	std::memset( &header, 0, sizeof( header ) );
+	std::memcpy( header.Magic, TRAJECTORY_FILE_MAGIC, sizeof( header.Magic ) );
+	header.Version = TRAJECTORY_FILE_VERSION;
+	header.HeaderSize = out.HeaderSize;
+	header.RecordSize = writer->RecordSize;
+	header.NumJoints = writer->Layout.NumJoints;
+	header.NumBodies = writer->Layout.NumBodies;
+	header.NumRecords = 0;
+
+	// create the file and write the header
+	if( !out.File.Open( path, true ) )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to create trajectory file '%s'!" ), TEXT( __FUNCTION__ ), *path );
+		return nullptr;
+	}
+	MappedFile::View view = out.File.Map( 0, out.HeaderSize );
+	if( !view.Data )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to map trajectory file '%s'!" ), TEXT( __FUNCTION__ ), *path );
+		return nullptr;
+	}
+	std::memset( view.Data, 0, out.HeaderSize );
+	std::memcpy( view.Data, &header, sizeof( header ) );
+	std::memcpy( view.Data + sizeof( header ), schema.c_str(), schema.size() + 1 );
+	MappedFile::Unmap( view );
+
+	// allocate the chunks and start the writer thread, which shares the ownership of the output
+	writer->FrontChunk.reserve( writer->ChunkRecords * writer->RecordSize );
+	out.BackChunk.reserve( writer->ChunkRecords * writer->RecordSize );
+	std::shared_ptr<Output> output = writer->Out;
+	writer->WriterThread = std::thread( [output]() { output->Run(); } );
+
+	return writer;
+}
+
+
+
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+	if( !this->WriterThread.joinable() ) return;
+
+	// hand the rest over to the writer thread, which writes it out after the back chunk and then exits; it is joined later, off the tick path (@see WaitForClosedFiles)
+	{
+		std::lock_guard<std::mutex> lock( this->Out->Mutex );
+		this->Out->LastChunk.swap( this->FrontChunk );
+		this->Out->Stopping = true;
+	}
+	this->Out->Condition.notify_one();
+
+	RetireWriterThread( std::move( this->WriterThread ), std::move( this->Out ) );
+}
+
+
+
+
+struct TrajectoryWriter::RetiredWriterThreads
+{
+	std::mutex Mutex;
+	std::vector<std::pair<std::thread, std::shared_ptr<Output>>> Threads;
+
+	// threads still running at exit (closed since the last WaitForClosedFiles()) are left to finish on their own; joining them here could deadlock while
+	// the module is being unloaded
+	~RetiredWriterThreads()
+	{
+		for( auto & retired : this->Threads ) retired.first.detach();
+	}
+};
+
+
+
+
+TrajectoryWriter::RetiredWriterThreads & TrajectoryWriter::GetRetiredWriterThreads()
+{
+	static RetiredWriterThreads retiredThreads;
+	return retiredThreads;
+}
+
+
+
+
+void TrajectoryWriter::RetireWriterThread( std::thread thread, std::shared_ptr<Output> output )
+{
+	RetiredWriterThreads & retiredThreads = GetRetiredWriterThreads();
+	std::lock_guard<std::mutex> lock( retiredThreads.Mutex );
+
+	// join the threads that are done, which does not wait
+	auto done = std::partition( retiredThreads.Threads.begin(), retiredThreads.Threads.end(),
+		[]( const std::pair<std::thread, std::shared_ptr<Output>> & retired ) { return !retired.second->Done; } );
+	for( auto retired = done; retired != retiredThreads.Threads.end(); ++retired ) retired->first.join();
+	retiredThreads.Threads.erase( done, retiredThreads.Threads.end() );
+
+	retiredThreads.Threads.emplace_back( std::move( thread ), std::move( output ) );
+}
+
+
+
+
+void TrajectoryWriter::WaitForClosedFiles()
+{
+	RetiredWriterThreads & retiredThreads = GetRetiredWriterThreads();
+	std::lock_guard<std::mutex> lock( retiredThreads.Mutex );
+
+	for( auto & retired : retiredThreads.Threads ) retired.first.join();
+	retiredThreads.Threads.clear();
+}
+
+
+
+
+uint8 * TrajectoryWriter::AppendRecord()
+{
+	if( this->Out->Failed ) return nullptr;
+
+	// hand a full front chunk over to the writer thread, unless it is still busy with the previous one (then keep growing the front chunk)
+	if( this->FrontChunk.size() >= size_t( this->ChunkRecords * this->RecordSize ) )
+	{
+		bool handedOver = false;
+		{
+			std::lock_guard<std::mutex> lock( this->Out->Mutex );
+			if( !this->Out->BackChunkPending )
+			{
+				this->FrontChunk.swap( this->Out->BackChunk );
+				this->Out->BackChunkPending = true;
+				handedOver = true;
+			}
+		}
+		if( handedOver )
+		{
+			this->Out->Condition.notify_one();
+			this->FrontChunk.clear();
+		}
+	}
+
+	size_t offset = this->FrontChunk.size();
+	this->FrontChunk.resize( offset + this->RecordSize );
+	return this->FrontChunk.data() + offset;
+}
+
+
+
+
+void TrajectoryWriter::Output::Run()
+{
+	std::unique_lock<std::mutex> lock( this->Mutex );
+	while( true )
+	{
+		this->Condition.wait( lock, [this]() { return this->BackChunkPending || this->Stopping; } );
+		if( !this->BackChunkPending ) break;
+
+		// write without holding the lock, the game thread keeps filling the front chunk meanwhile
+		lock.unlock();
+		if( !this->Failed && !WriteChunk( this->BackChunk ) ) this->Failed = true;
+		lock.lock();
+
+		this->BackChunkPending = false;
+	}
+	lock.unlock();
+
+	// write out the rest and close the file
+	if( !this->Failed && !WriteChunk( this->LastChunk ) ) this->Failed = true;
+	this->File.Close();
+
+	UE_LOG( LogRcSystem, Log, TEXT( "(%s) Trajectory file closed, %llu records written." ), TEXT( __FUNCTION__ ), this->NumRecordsWritten );
+	this->Done = true;
+}
+
+
+
+
+bool TrajectoryWriter::Output::WriteChunk( const std::vector<uint8> & chunk )
+{
+	uint64 numRecords = chunk.size() / this->RecordSize;
+	if( numRecords == 0 ) return true;
+
+	// copy the records into the file
+	MappedFile::View view = this->File.Map( this->HeaderSize + this->NumRecordsWritten * this->RecordSize, numRecords * this->RecordSize );
+	if( !view.Data )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to map trajectory file for writing! Recording stopped." ), TEXT( __FUNCTION__ ) );
+		return false;
+	}
+	std::memcpy( view.Data, chunk.data(), numRecords * this->RecordSize );
+	MappedFile::Unmap( view );
+	this->NumRecordsWritten += numRecords;
+
+	// update the record count in the header
+	view = this->File.Map( 0, sizeof( TrajectoryFileHeader ) );
+	if( !view.Data ) return false;
+	uint64 numRecordsWritten = this->NumRecordsWritten;
+	std::memcpy( view.Data + offsetof( TrajectoryFileHeader, NumRecords ), &numRecordsWritten, sizeof( numRecordsWritten ) );
+	MappedFile::Unmap( view );
+
+	return true;
+}
+
+
+
+
+std::unique_ptr<TrajectoryReader> TrajectoryReader::Open( const FString & path )
+{
+	std::unique_ptr<TrajectoryReader> reader( new TrajectoryReader );
+	if( !reader->File.Open( path, false ) )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to open trajectory file '%s'!" ), TEXT( __FUNCTION__ ), *path );
+		return nullptr;
+	}
+
+	// read and validate the header
+	uint64 fileSize = reader->File.GetSize();
+	TrajectoryFileHeader header;
+	MappedFile::View view = reader->File.Map( 0, sizeof( header ) );
+	if( !view.Data || fileSize < sizeof( header ) )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to read the header of trajectory file '%s'!" ), TEXT( __FUNCTION__ ), *path );
+		MappedFile::Unmap( view );
+		return nullptr;
+	}
+	std::memcpy( &header, view.Data, sizeof( header ) );
+	MappedFile::Unmap( view );
+
+	reader->Layout.NumJoints = header.NumJoints;
+	reader->Layout.NumBodies = header.NumBodies;
+	reader->RecordSize = reader->Layout.GetRecordSize();
+	if( std::memcmp( header.Magic, TRAJECTORY_FILE_MAGIC, sizeof( header.Magic ) ) != 0 || header.Version != TRAJECTORY_FILE_VERSION
+		|| header.RecordSize != uint32( reader->RecordSize ) || header.HeaderSize < sizeof( header ) || header.HeaderSize > fileSize )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) '%s' is not a valid trajectory file of version %d!" ), TEXT( __FUNCTION__ ), *path, TRAJECTORY_FILE_VERSION );
+		return nullptr;
+	}
+
+	// parse the joint names from the schema text
+	view = reader->File.Map( 0, header.HeaderSize );
+	if( !view.Data ) return nullptr;
+	const char * schemaText = (const char *)view.Data + sizeof( header );
+	std::string schema( schemaText, std::find( schemaText, (const char *)view.Data + header.HeaderSize, '\0' ) );
+	MappedFile::Unmap( view );
+
+	size_t jointsBegin = schema.find( "joints:" );
+	if( jointsBegin != std::string::npos )
+	{
+		jointsBegin += std::strlen( "joints:" );
+		FString joints = UTF8_TO_TCHAR( schema.substr( jointsBegin, schema.find( '\n', jointsBegin ) - jointsBegin ).c_str() );
+		TArray<FString> names;
+		joints.ParseIntoArray( names, TEXT( "," ), false );
+		for( const FString & name : names )
+		{
+			reader->JointNames.Add( FName( *name ) );
+		}
+	}
+
+	// map the records. Trust the file size over the header, in case the recording was interrupted between writing a chunk and updating the header.
+	reader->NumRecords = std::min<uint64>( header.NumRecords, (fileSize - header.HeaderSize) / reader->RecordSize );
+	if( reader->NumRecords == 0 )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Trajectory file '%s' contains no records!" ), TEXT( __FUNCTION__ ), *path );
+		return nullptr;
+	}
+	reader->Records = reader->File.Map( header.HeaderSize, reader->NumRecords * reader->RecordSize );
+	if( !reader->Records.Data )
+	{
+		UE_LOG( LogRcSystem, Error, TEXT( "(%s) Failed to map trajectory file '%s'!" ), TEXT( __FUNCTION__ ), *path );
+		return nullptr;
+	}
+
+	return reader;
+}
+
+
+
+
+TrajectoryReader::~TrajectoryReader()
+{
+	MappedFile::Unmap( this->Records );
+}
+
+
+
+
+double TrajectoryReader::GetTime( uint64 record ) const
+{
+	double time;
+	std::memcpy( &time, GetRecord( record ) + TrajectoryRecordLayout::TimeOffset, sizeof( time ) );
+	return time;
+}
+
+
+
+
+uint64 TrajectoryReader::FindRecord( double time ) const
+{
+	// binary search: only the pages on the search path are touched
+	uint64 first = 0;
+	uint64 last = this->NumRecords - 1;
+	while( first < last )
+	{
+		uint64 middle = first + (last - first + 1) / 2;
+		if( GetTime( middle ) <= time ) first = middle;
+		else last = middle - 1;
+	}
+
+	return first;
+}
+
+
+
+
+void TrajectoryReader::ReadBodyStates( uint64 record, FBodyStates & bodyStates ) const
+{
+	int32 numBodies = this->Layout.NumBodies;
+	bodyStates.SetNum( numBodies );
+
+	const uint8 * bodies = GetRecord( record ) + this->Layout.GetBodiesOffset();
+	for( int32 body = 0; body < numBodies; ++body )
+	{
+		float v[TrajectoryRecordLayout::FloatsPerBody];
+		std::memcpy( v, bodies + body * sizeof( v ), sizeof( v ) );
+
+		bodyStates.Poses[body] = physx::PxTransform( physx::PxVec3( v[0], v[1], v[2] ), physx::PxQuat( v[3], v[4], v[5], v[6] ) );
+		bodyStates.LinearVelocities[body] = physx::PxVec3( v[7], v[8], v[9] );
+		bodyStates.AngularVelocities[body] = physx::PxVec3( v[10], v[11], v[12] );
+	}
+}
+
+
+
+
+FVector TrajectoryReader::GetMotorCommand( uint64 record, int32 joint ) const
+{
+	float v[3];
+	std::memcpy( v, GetRecord( record ) + this->Layout.GetMotorCommandsOffset() + joint * sizeof( v ), sizeof( v ) );
+	return FVector( v[0], v[1], v[2] );
+}
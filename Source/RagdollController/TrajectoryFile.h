@@ -0,0 +1,277 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "PoseReplication.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <string>
+
+
+
+
+/**
+ * Trajectory files: per-tick recordings of a ragdoll's joint angles, motor commands and body states.
+ *
+ * A file consists of a header page followed by fixed-size records. The header starts with TrajectoryFileHeader, followed by a NUL-terminated plain text
+ * schema that names the record fields and the joints (see TrajectoryRecordLayout::MakeSchema()), padded to HeaderSize bytes. All values are in the native
+ * byte order of the recording machine (little-endian on all supported platforms).
+ */
+
+
+
+
+/** Binary file header. */
+struct TrajectoryFileHeader
+{
+	/** TRAJECTORY_FILE_MAGIC */
+	char Magic[8];
+
+	/** TRAJECTORY_FILE_VERSION */
+	uint32 Version;
+
+	/** Byte offset of the first record. */
+	uint32 HeaderSize;
+
+	/** Size of a single record in bytes. */
+	uint32 RecordSize;
+
+	uint32 NumJoints;
+	uint32 NumBodies;
+	uint32 Reserved;
+
+	/** Number of complete records in the file. Kept up to date while recording, so that the file is usable even if the recording is interrupted. */
+	uint64 NumRecords;
+};
+
+
+
+
+/**
+ * Layout of a single record:
+ *
+ *     uint64 Frame                                          engine frame counter
+ *     double Time                                           game time (seconds)
+ *     float JointAngles[NumJoints][3]                       twist, swing1, swing2 (radians) @see FJointState::JointAngles
+ *     float MotorCommands[NumJoints][3]                     @see FJointState::MotorCommand
+ *     float Bodies[NumBodies][13]                           global pose and velocities: px py pz qx qy qz qw vx vy vz wx wy wz
+ *     (padding to a multiple of 8 bytes)
+ */
+struct TrajectoryRecordLayout
+{
+	int32 NumJoints = 0;
+	int32 NumBodies = 0;
+
+
+	static const int32 FrameOffset = 0;
+	static const int32 TimeOffset = 8;
+	static const int32 JointAnglesOffset = 16;
+	static const int32 FloatsPerBody = 13;
+
+	int32 GetMotorCommandsOffset() const { return JointAnglesOffset + 3 * int32( sizeof( float ) ) * this->NumJoints; }
+	int32 GetBodiesOffset() const { return GetMotorCommandsOffset() + 3 * int32( sizeof( float ) ) * this->NumJoints; }
+	int32 GetRecordSize() const { return Align( GetBodiesOffset() + FloatsPerBody * int32( sizeof( float ) ) * this->NumBodies, 8 ); }
+
+	/** Plain text schema for the file header, including the joint names. */
+	std::string MakeSchema( const TArray<FName> & jointNames ) const;
+};
+
+
+
+
+/** A memory-mappable file. Views are mapped on demand, so that only the parts of the file that are accessed are paged in. */
+class MappedFile
+{
+	/** Platform file handle (a HANDLE on Windows, a file descriptor elsewhere). */
+	intptr_t Handle;
+
+	bool Writable = false;
+
+
+public:
+
+	/** A mapped view. Data points to the requested offset, which need not be aligned. */
+	struct View
+	{
+		void * Base = nullptr;
+		uint64 MappedSize = 0;
+		uint8 * Data = nullptr;
+	};
+
+
+	MappedFile();
+	~MappedFile();
+
+	MappedFile( const MappedFile & ) = delete;
+	MappedFile & operator=( const MappedFile & ) = delete;
+
+
+	/** Open a file for reading, or create (truncate) a file for writing. Returns false on failure. */
+	bool Open( const FString & path, bool writable );
+
+	/** Close the file. Views remain valid until unmapped. */
+	void Close();
+
+	bool IsOpen() const;
+
+	/** Current size of the file in bytes. */
+	uint64 GetSize() const;
+
+	/** Map size bytes starting at offset. A writable file is grown as needed to cover the view. Returns a view with null Data on failure. */
+	View Map( uint64 offset, uint64 size );
+
+	/** Unmap a view. Writes through a view reach the file via the OS page cache; unmapping does not wait for the disk. */
+	static void Unmap( View & view );
+};
+
+
+
+
+/**
+ * Appends trajectory records to a memory-mapped file without blocking the calling thread on disk I/O.
+ *
+ * Records are written into an in-memory front chunk. A full chunk is swapped with the back chunk and copied into the file by a writer thread, while the
+ * caller fills the other chunk. If the writer thread falls behind, then the front chunk keeps growing rather than blocking the caller. Closing does not
+ * block either: the writer thread writes the last records, closes the file and exits on its own.
+ */
+class TrajectoryWriter
+{
+	/** The file and the state shared with the writer thread. Owned jointly by the writer and its thread, so that the thread can finish the file after the
+	 ** writer is gone. */
+	struct Output
+	{
+		int32 RecordSize = 0;
+		uint32 HeaderSize = 0;
+
+		MappedFile File;
+
+		/** Handed over to the writer thread. Only touched by the writer thread while BackChunkPending is set. */
+		std::vector<uint8> BackChunk;
+		bool BackChunkPending = false;
+
+		/** The last records, handed over together with Stopping. Written after the back chunk. */
+		std::vector<uint8> LastChunk;
+		bool Stopping = false;
+
+		/** Number of records written into the file. Owned by the writer thread. */
+		uint64 NumRecordsWritten = 0;
+
+		std::mutex Mutex;
+		std::condition_variable Condition;
+
+		/** Set if writing into the file has failed; further records are discarded. */
+		std::atomic<bool> Failed;
+
+		/** Set by the writer thread when it has closed the file, right before it exits. */
+		std::atomic<bool> Done;
+
+
+		Output() : Failed( false ), Done( false ) {}
+
+		/** Writer thread main loop. */
+		void Run();
+
+		/** Append the records in chunk to the file and update the record count in the header. */
+		bool WriteChunk( const std::vector<uint8> & chunk );
+	};
+
+
+	TrajectoryRecordLayout Layout;
+	int32 RecordSize;
+
+	/** Records per chunk. */
+	int32 ChunkRecords;
+
+	/** Filled by the caller. */
+	std::vector<uint8> FrontChunk;
+
+	std::shared_ptr<Output> Out;
+	std::thread WriterThread;
+
+
+	TrajectoryWriter();
+
+	/** Threads of closed writers that may still be finishing their files, with their outputs. */
+	struct RetiredWriterThreads;
+	static RetiredWriterThreads & GetRetiredWriterThreads();
+
+	/** Keep the thread of a closed writer until it is done, and join the retired threads that are done (which does not wait). */
+	static void RetireWriterThread( std::thread thread, std::shared_ptr<Output> output );
+
+
+public:
+
+	/** Create a trajectory file for the provided joints and body count. Returns null on failure. */
+	static std::unique_ptr<TrajectoryWriter> Create( const FString & path, const TArray<FName> & jointNames, int32 numBodies );
+
+	/** Hand the remaining records over to the writer thread, which writes them out and closes the file. Does not wait for the writer thread. */
+	~TrajectoryWriter();
+
+	/** Wait until the files of all closed writers are complete, and join their threads. Blocks on disk I/O, so call it at the end of a session. */
+	static void WaitForClosedFiles();
+
+
+	const TrajectoryRecordLayout & GetLayout() const { return this->Layout; }
+
+	/** Append a record and return a pointer to its GetLayout().GetRecordSize() bytes, to be filled by the caller before the next call. Returns null if
+	 ** writing has failed. */
+	uint8 * AppendRecord();
+};
+
+
+
+
+/**
+ * Read-only access to a trajectory file.
+ *
+ * The record area is mapped as a whole but paged in by the OS only as records are accessed, so that opening is instant and memory use stays proportional
+ * to the part of the file that is actually played back, regardless of the file size.
+ */
+class TrajectoryReader
+{
+	TrajectoryRecordLayout Layout;
+	int32 RecordSize = 0;
+
+	/** Joint names from the schema text. */
+	TArray<FName> JointNames;
+
+	MappedFile File;
+	MappedFile::View Records;
+	uint64 NumRecords = 0;
+
+
+	TrajectoryReader() {}
+
+
+public:
+
+	/** Open a trajectory file and map its records. Returns null on failure (including version mismatches). */
+	static std::unique_ptr<TrajectoryReader> Open( const FString & path );
+
+	~TrajectoryReader();
+
+
+	const TrajectoryRecordLayout & GetLayout() const { return this->Layout; }
+	const TArray<FName> & GetJointNames() const { return this->JointNames; }
+	uint64 GetNumRecords() const { return this->NumRecords; }
+
+	/** Pointer to a record, laid out according to TrajectoryRecordLayout. */
+	const uint8 * GetRecord( uint64 record ) const { return this->Records.Data + record * this->RecordSize; }
+
+	/** Game time of a record. */
+	double GetTime( uint64 record ) const;
+
+	/** Index of the last record with a game time not after the provided time (the first record if all are after it). Binary search. */
+	uint64 FindRecord( double time ) const;
+
+	/** Read the body states of a record. */
+	void ReadBodyStates( uint64 record, FBodyStates & bodyStates ) const;
+
+	/** Read the motor command of a joint from a record. */
+	FVector GetMotorCommand( uint64 record, int32 joint ) const;
+};
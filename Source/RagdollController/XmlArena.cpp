@@ -0,0 +1,228 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "XmlArena.h"
+
+#include <pugixml.hpp>
+
+#include <cstdlib>
+#include <algorithm>
+
+
+// block sizes are rounded up to a multiple of this, which keeps the blocks pointer-aligned and leaves room for the free list link
+#define XML_ARENA_GRANULARITY sizeof( XmlArena::BlockHeader )
+
+// thread-local storage for the current arena (MSVC 2013 does not support thread_local)
+#if defined( _MSC_VER ) && _MSC_VER < 1900
+#define XML_ARENA_THREAD_LOCAL __declspec( thread )
+#else
+#define XML_ARENA_THREAD_LOCAL thread_local
+#endif
+
+
+
+
+/** The arena of the innermost open XmlArena::Scope of this thread, null if none. */
+static XML_ARENA_THREAD_LOCAL XmlArena * CurrentArena = nullptr;
+
+std::atomic<std::uint64_t> XmlArena::HeapCalls( 0 );
+
+/** Install the allocation functions before anything else can use pugixml. */
+static struct XmlArenaInstaller
+{
+	XmlArenaInstaller() { XmlArena::InstallPugiAllocator(); }
+} XmlArenaInstallerInstance;
+
+
+
+
+XmlArena::Scope::Scope( XmlArena & arena ) :
+	Previous( CurrentArena )
+{
+	CurrentArena = &arena;
+}
+
+
+
+
+XmlArena::Scope::~Scope()
+{
+	CurrentArena = this->Previous;
+}
+
+
+
+
+XmlArena::XmlArena( std::size_t initialSize )
+{
+	this->Chunks.reserve( 8 );
+	AddChunk( initialSize );
+}
+
+
+
+
+XmlArena::~XmlArena()
+{
+	ReleaseChunks();
+}
+
+
+
+
+void * XmlArena::Allocate( std::size_t size )
+{
+	size = (std::max( size, sizeof( BlockHeader * ) ) + XML_ARENA_GRANULARITY - 1) / XML_ARENA_GRANULARITY * XML_ARENA_GRANULARITY;
+
+	// reuse a freed block of the same size
+	for( BlockHeader ** link = &this->FreeList; *link; link = reinterpret_cast<BlockHeader **>( *link + 1 ) )
+	{
+		BlockHeader * block = *link;
+		if( block->Size == size )
+		{
+			*link = *reinterpret_cast<BlockHeader **>( block + 1 );
+			return block + 1;
+		}
+	}
+
+	// bump-allocate, from a new chunk if the current one is full
+	std::size_t blockSize = sizeof( BlockHeader ) + size;
+	if( std::size_t( this->End - this->Current ) < blockSize )
+	{
+		std::size_t chunkSize = std::max( blockSize, this->Chunks.empty() ? 0 : 2 * this->Chunks.back().Size );
+		if( !AddChunk( chunkSize ) ) return nullptr;   // pugixml reports status_out_of_memory
+	}
+
+	BlockHeader * block = reinterpret_cast<BlockHeader *>( this->Current );
+	this->Current += blockSize;
+	block->Arena = this;
+	block->Size = size;
+	return block + 1;
+}
+
+
+
+
+void XmlArena::Free( BlockHeader * block )
+{
+	*reinterpret_cast<BlockHeader **>( block + 1 ) = this->FreeList;
+	this->FreeList = block;
+}
+
+
+
+
+void XmlArena::Reset()
+{
+	// a message did not fit into one chunk: replace the chunks with a single one that fits them all
+	if( this->Chunks.size() > 1 )
+	{
+		std::size_t capacity = GetCapacity();
+		ReleaseChunks();
+		AddChunk( capacity );
+	}
+
+	this->Current = this->Chunks.empty() ? nullptr : this->Chunks.back().Memory;
+	this->FreeList = nullptr;
+}
+
+
+
+
+std::size_t XmlArena::GetCapacity() const
+{
+	std::size_t capacity = 0;
+	for( const Chunk & chunk : this->Chunks )
+	{
+		capacity += chunk.Size;
+	}
+	return capacity;
+}
+
+
+
+
+bool XmlArena::AddChunk( std::size_t size )
+{
+	Chunk chunk = { static_cast<char *>( HeapAllocate( size ) ), size };
+	if( !chunk.Memory ) return false;
+
+	this->Chunks.push_back( chunk );
+	this->Current = chunk.Memory;
+	this->End = chunk.Memory + size;
+	return true;
+}
+
+
+
+
+void XmlArena::ReleaseChunks()
+{
+	for( const Chunk & chunk : this->Chunks )
+	{
+		HeapFree( chunk.Memory );
+	}
+	this->Chunks.clear();
+	this->Current = this->End = nullptr;
+	this->FreeList = nullptr;
+}
+
+
+
+
+void * XmlArena::HeapAllocate( std::size_t size )
+{
+	HeapCalls.fetch_add( 1, std::memory_order_relaxed );
+	return std::malloc( size );
+}
+
+
+
+
+void XmlArena::HeapFree( void * memory )
+{
+	HeapCalls.fetch_add( 1, std::memory_order_relaxed );
+	std::free( memory );
+}
+
+
+
+
+void * XmlArena::PugiAllocate( std::size_t size )
+{
+	if( CurrentArena ) return CurrentArena->Allocate( size );
+
+	BlockHeader * block = static_cast<BlockHeader *>( HeapAllocate( sizeof( BlockHeader ) + size ) );
+	if( !block ) return nullptr;
+
+	block->Arena = nullptr;
+	block->Size = size;
+	return block + 1;
+}
+
+
+
+
+void XmlArena::PugiDeallocate( void * ptr )
+{
+	if( !ptr ) return;
+
+	// blocks go back to where they came from, no matter which scope is open
+	BlockHeader * block = static_cast<BlockHeader *>( ptr ) - 1;
+	if( block->Arena )
+	{
+		block->Arena->Free( block );
+	}
+	else
+	{
+		HeapFree( block );
+	}
+}
+
+
+
+
+void XmlArena::InstallPugiAllocator()
+{
+	pugi::set_memory_management_functions( &XmlArena::PugiAllocate, &XmlArena::PugiDeallocate );
+}
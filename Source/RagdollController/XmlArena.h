@@ -0,0 +1,106 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+
+
+
+/**
+ * Arena for the memory of pugixml documents, so that documents that are rebuilt for every message do not allocate from the heap in steady state.
+ *
+ * pugixml allocates through a pair of global functions, which XmlArena installs at startup: while an XmlArena::Scope is open on the calling thread,
+ * allocations are served from that scope's arena, otherwise from the heap. Allocations are bump-allocated from a chunk; freed blocks are kept on a free list
+ * and reused for allocations of the same size (pugixml mostly allocates whole pages of PUGIXML_MEMORY_PAGE_SIZE bytes), so that documents that are updated in
+ * place do not grow the arena either. Reset() releases all allocations in bulk. If a message needed more than the current chunk, then Reset() replaces the
+ * chunks with a single one that holds them all, so that the arena stops touching the heap after a few messages.
+ *
+ * Any pugixml document using an arena must be reset (or destroyed) before the arena is reset (or destroyed). An arena must not be used by several threads
+ * at once. Free of engine dependencies, so that it can be tested headless (Test/XmlArena).
+ */
+class XmlArena
+{
+	/** Precedes every block handed out to pugixml, also the heap blocks. */
+	struct BlockHeader
+	{
+		/** The arena that owns the block, or null for a heap block. */
+		XmlArena * Arena;
+
+		/** Size of the block, excluding the header. */
+		std::size_t Size;
+	};
+
+	struct Chunk
+	{
+		char * Memory;
+		std::size_t Size;
+	};
+
+	/** All chunks, the last one is the one being bump-allocated from. */
+	std::vector<Chunk> Chunks;
+
+	char * Current = nullptr;
+	char * End = nullptr;
+
+	/** Freed blocks, linked through their first bytes. */
+	BlockHeader * FreeList = nullptr;
+
+	/** Number of malloc and free calls made on behalf of pugixml and the arenas. @see GetHeapCallCount */
+	static std::atomic<std::uint64_t> HeapCalls;
+
+
+	void * Allocate( std::size_t size );
+	void Free( BlockHeader * block );
+
+	/** Add a chunk and bump-allocate from it from now on. Returns false if out of memory. */
+	bool AddChunk( std::size_t size );
+	void ReleaseChunks();
+
+	static void * HeapAllocate( std::size_t size );
+	static void HeapFree( void * memory );
+
+	/** pugixml allocation functions. */
+	static void * PugiAllocate( std::size_t size );
+	static void PugiDeallocate( void * ptr );
+
+
+public:
+
+	/** Routes the pugixml allocations of the calling thread to an arena for its lifetime. Scopes nest; stack use only. */
+	class Scope
+	{
+		XmlArena * Previous;
+
+	public:
+		explicit Scope( XmlArena & arena );
+		~Scope();
+
+		Scope( const Scope & ) = delete;
+		Scope & operator=( const Scope & ) = delete;
+	};
+
+
+	explicit XmlArena( std::size_t initialSize );
+	~XmlArena();
+
+	XmlArena( const XmlArena & ) = delete;
+	XmlArena & operator=( const XmlArena & ) = delete;
+
+
+	/** Release all allocations in bulk. The documents that used the arena must have been reset before. */
+	void Reset();
+
+	/** Total size of the chunks. */
+	std::size_t GetCapacity() const;
+
+
+	/** Install the pugixml allocation functions. Called automatically at startup; must precede any pugixml allocation. */
+	static void InstallPugiAllocator();
+
+	/** Number of malloc and free calls made so far on behalf of pugixml documents and arenas, for verifying that a code path does not touch the heap. */
+	static std::uint64_t GetHeapCallCount() { return HeapCalls.load( std::memory_order_relaxed ); }
+};
@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "RagdollController.h"
+#include "XmlDelayQueue.h"
+
+
+
+
+const pugi::xml_document * XmlDelayQueue::Push( const pugi::xml_document * document, std::size_t delay )
+{
+	// (re)build the ring if the delay has changed (the entries are kept otherwise, together with the memory of their arenas)
+	if( this->Entries.size() != delay + 1 )
+	{
+		Clear();
+		this->Entries.clear();
+		for( std::size_t entry = 0; entry < delay + 1; ++entry )
+		{
+			this->Entries.push_back( std::unique_ptr<Entry>( new Entry( this->ArenaSize ) ) );
+		}
+	}
+
+	// copy the document into the free entry, after releasing what that entry held in bulk
+	Entry & entry = *this->Entries[(this->Head + this->NumWaiting) % this->Entries.size()];
+	entry.Document.reset();
+	entry.Arena.Reset();
+	if( document )
+	{
+		XmlArena::Scope arenaScope( entry.Arena );
+		entry.Document.reset( *document );
+	}
+	++this->NumWaiting;
+
+	// hand out the oldest document once it has waited long enough; its entry becomes the free one for the next call
+	if( this->NumWaiting <= delay ) return nullptr;
+
+	Entry & due = *this->Entries[this->Head];
+	this->Head = (this->Head + 1) % this->Entries.size();
+	--this->NumWaiting;
+	return due.Document.first_child() ? &due.Document : nullptr;
+}
+
+
+
+
+void XmlDelayQueue::Clear()
+{
+	for( const std::unique_ptr<Entry> & entry : this->Entries )
+	{
+		entry->Document.reset();
+		entry->Arena.Reset();
+	}
+	this->Head = 0;
+	this->NumWaiting = 0;
+}
@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "XmlArena.h"
+
+#include <pugixml.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+
+
+/**
+ * Delay line for pugixml documents: holds copies of the documents pushed during the last few calls, for handling them a fixed number of calls later (e.g.
+ * the commands of a remote controller, delayed by a number of ticks). Each copy lives in an arena of its own, and the copies are recycled, so that the
+ * queue does not touch the heap once it has filled up and its arenas have grown to their steady-state size.
+ *
+ * Free of engine dependencies, so that it can be tested headless (Test/XmlArena).
+ */
+class XmlDelayQueue
+{
+	struct Entry
+	{
+		/** Memory for Document. Declared before Document, so that it outlives it. */
+		XmlArena Arena;
+		pugi::xml_document Document;
+
+		explicit Entry( std::size_t arenaSize ) : Arena( arenaSize ) {}
+	};
+
+	/** Ring of delay + 1 entries: the waiting documents, oldest at Head, and the one handed out by the last Push(). */
+	std::vector<std::unique_ptr<Entry>> Entries;
+	std::size_t Head = 0;
+	std::size_t NumWaiting = 0;
+
+	std::size_t ArenaSize;
+
+
+public:
+
+	/** arenaSize is the initial size of the arena of each copy. */
+	explicit XmlDelayQueue( std::size_t arenaSize ) : ArenaSize( arenaSize ) {}
+
+	XmlDelayQueue( const XmlDelayQueue & ) = delete;
+	XmlDelayQueue & operator=( const XmlDelayQueue & ) = delete;
+
+
+	/**
+	 * Queue a copy of document (null if there is none for this call, which still takes a place in the queue), and return the document that was pushed
+	 * delay calls ago. Returns null while the queue is filling up, or if no document was pushed back then. The returned document stays valid until the
+	 * next call. Changing the delay starts over, dropping the waiting documents.
+	 */
+	const pugi::xml_document * Push( const pugi::xml_document * document, std::size_t delay );
+
+	/** Drop the waiting documents. */
+	void Clear();
+};
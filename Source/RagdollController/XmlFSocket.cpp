@@ -3,21 +3,20 @@
 #include "RagdollController.h"
 #include "XmlFSocket.h"
 
-#include <Sockets.h>
-
 #include <pugixml.hpp>
 
-#include <boost/interprocess/streams/bufferstream.hpp>
-
 #include <memory>
 #include <algorithm>
-#include <functional>
 #include <cctype>
+#include <cstring>
 
 
 /** Preallocation size for various internal buffers. */
 #define PREALLOC_SIZE (64 * 1024)
 
+/** Preallocation size for the send buffer of PutLine(). */
+#define LINE_PREALLOC_SIZE 1024
+
 
 /** Xml block header and footer tag */
 #define XML_BLOCK_HEADER "XML_DOCUMENT_BEGIN"
@@ -26,10 +25,14 @@
 
 
 
-XmlFSocket::XmlFSocket( std::unique_ptr<FSocket> socket ) :
-	Socket( std::move( socket ) )
+XmlFSocket::XmlFSocket( std::unique_ptr<ByteStream> stream ) :
+	InXmlArena( PREALLOC_SIZE ),
+	Stream( std::move( stream ) )
 {
 	InXmlStatus.status = pugi::status_no_document_element;
+	Buffer.reserve( PREALLOC_SIZE );
+	OutText.reserve( PREALLOC_SIZE );
+	OutLine.reserve( LINE_PREALLOC_SIZE );
 }
 
 
@@ -37,7 +40,7 @@ XmlFSocket::XmlFSocket( std::unique_ptr<FSocket> socket ) :
 
 bool XmlFSocket::IsGood()
 {
-	return this->Socket && this->Socket->GetConnectionState() == ESocketConnectionState::SCS_Connected;
+	return this->Stream && this->Stream->IsGood();
 }
 
 
@@ -69,20 +72,29 @@ bool XmlFSocket::GetLine()
 
 
 
-bool XmlFSocket::PutLine( std::string line )
+bool XmlFSocket::PutBytes( const char * data, std::size_t size )
 {
 	// check that we have a valid and connected socket
 	if( !IsGood() ) return false;
 
-	// append LF (prefer a possible string copy in place of two Send() calls and risking network fragmentation)
-	line.append( "\n" );
+	// write data, return the success status
+	return this->Stream->Write( data, size );
+}
 
-	// write data
-	int32 bytesSent;
-	this->Socket->Send( (const uint8 *)line.data(), line.size(), bytesSent );
 
-	// return the success status
-	return bytesSent == line.size();
+
+
+bool XmlFSocket::PutLine( boost::string_ref line )
+{
+	// check that we have a valid and connected socket
+	if( !IsGood() ) return false;
+
+	// copy the line and an LF to the send buffer (prefer a copy in place of two Send() calls and risking network fragmentation)
+	this->OutLine.assign( line.data(), line.size() );
+	this->OutLine += '\n';
+
+	// write data, return the success status
+	return this->Stream->Write( this->OutLine.data(), this->OutLine.size() );
 }
 
 
@@ -128,19 +140,19 @@ bool XmlFSocket::PutXml( pugi::xml_document * xmlDoc /*= 0 */ )
 
 		virtual void write( const void* data, size_t size )
 		{
-			if( !IsGood || !Socket.Socket ) return;
+			if( !IsGood || !Socket.Stream ) return;
 
-			int32 bytesSent;
-			Socket.Socket->Send( (const uint8 *)data, size, bytesSent );
-			IsGood &= bytesSent == size;
+			IsGood &= Socket.Stream->Write( static_cast<const char *>( data ), size );
 		}
 	} writer( *this );
 
-	// write to socket
+	// write to socket (header and footer as constants: PutLine() would copy them into a string)
+	static const char header[] = XML_BLOCK_HEADER "\n";
+	static const char footer[] = XML_BLOCK_FOOTER "\n";
 	bool headerFooterOk = true;
-	headerFooterOk &= this->PutLine( XML_BLOCK_HEADER );
+	headerFooterOk &= this->PutBytes( header, sizeof( header ) - 1 );
 	xmlDoc->save( writer );
-	headerFooterOk &= this->PutLine( XML_BLOCK_FOOTER );
+	headerFooterOk &= this->PutBytes( footer, sizeof( footer ) - 1 );
 
 	// return the success status
 	return headerFooterOk && writer.IsGood;
@@ -149,6 +161,29 @@ bool XmlFSocket::PutXml( pugi::xml_document * xmlDoc /*= 0 */ )
 
 
 
+std::string & XmlFSocket::BeginOutText()
+{
+	this->OutText.assign( XML_BLOCK_HEADER "\n" );
+	return this->OutText;
+}
+
+
+
+
+bool XmlFSocket::PutOutText()
+{
+	// check that we have a valid and connected socket
+	if( !IsGood() ) return false;
+
+	// complete the block: the document does not necessarily end with an LF, while the footer must be on a line of its own
+	this->OutText += "\n" XML_BLOCK_FOOTER "\n";
+
+	return this->PutBytes( this->OutText.data(), this->OutText.size() );
+}
+
+
+
+
 void XmlFSocket::CleanupBuffer()
 {
 	// do we have an in-situ xml parse in Buffer?
@@ -158,15 +193,23 @@ void XmlFSocket::CleanupBuffer()
 		Buffer.erase( 0, BufferInSituXmlLength );
 		BufferInSituXmlLength = 0;
 
-		// reset InXml and its status
+		// reset InXml, its memory and its status
 		InXml.reset();
+		InXmlArena.Reset();
 		InXmlStatus = pugi::xml_parse_result();
 		InXmlStatus.status = pugi::status_no_document_element;
 	}
 
-	// drop leading whitespace
-	// copied from https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring
-	Buffer.erase( Buffer.begin(), std::find_if( Buffer.begin(), Buffer.end(), std::not1( std::ptr_fun<int, int>( std::isspace ) ) ) );
+	// do we have the line of the last GetLine() in Buffer? if so, drop it too
+	if( BufferLineLength > 0 )
+	{
+		Buffer.erase( 0, BufferLineLength );
+		BufferLineLength = 0;
+		Line.clear();
+	}
+
+	// drop leading whitespace (as unsigned char: std::isspace is undefined for the negative values of bytes >= 0x80)
+	Buffer.erase( Buffer.begin(), std::find_if( Buffer.begin(), Buffer.end(), []( unsigned char c ) { return !std::isspace( c ); } ) );
 }
 
 
@@ -181,9 +224,9 @@ bool XmlFSocket::ExtractLineFromBuffer()
 	std::size_t contentLength = this->Buffer.find_first_of( "\r\n" );
 	if( contentLength != std::string::npos )
 	{
-		// we have a line, extract it and return true
-		this->Line.assign( this->Buffer, 0, contentLength );
-		this->Buffer.erase( 0, contentLength );
+		// we have a line: refer to it and leave it in Buffer until the next read operation, then return true
+		this->Line = boost::string_ref( this->Buffer.data(), contentLength );
+		this->BufferLineLength = contentLength;
 		return true;
 	}
 	else
@@ -211,7 +254,10 @@ bool XmlFSocket::ExtractXmlFromBuffer()
 	// we have a valid xml document in the buffer, now try to parse it into InXml (let pugixml eat the block header).
 	// Set BufferInSituXmlLength so that the footer is discarded too when the in-situ parse is cleared (let the line terminator stay).
 	BufferInSituXmlLength = footerPos + std::strlen( XML_BLOCK_FOOTER );
-	InXmlStatus = InXml.load_buffer_inplace( &Buffer[0], footerPos );
+	{
+		XmlArena::Scope arenaScope( InXmlArena );
+		InXmlStatus = InXml.load_buffer_inplace( &Buffer[0], footerPos );
+	}
 
 	// check for parse errors
 	if( !InXmlStatus ) return false;
@@ -226,8 +272,8 @@ bool XmlFSocket::ExtractXmlFromBuffer()
 bool XmlFSocket::GetFromSocketToBuffer()
 {
 	bool success;
-	uint32 bytesPending;
-	int32 bytesRead;
+	std::size_t bytesPending;
+	std::size_t bytesRead;
 
 	// check that we have a valid and connected socket
 	if( !IsGood() ) return false;
@@ -235,15 +281,15 @@ bool XmlFSocket::GetFromSocketToBuffer()
 	// if in blocking mode, wait until we have new data
 	if( this->ShouldBlock )
 	{
-		this->Socket->Wait( ESocketWaitConditions::WaitForRead, FTimespan( 0, 0, 0, 0, this->BlockingTimeoutMs ) );
+		this->Stream->WaitForData( this->BlockingTimeoutMs );
 	}
 
 	// check how much new data we have, return false if nothing new
-	if( !this->Socket->HasPendingData( bytesPending ) ) return false;
+	if( !this->Stream->HasPendingData( bytesPending ) ) return false;
 
 	// allocate space and read the data
 	this->Buffer.resize( this->Buffer.size() + bytesPending );
-	success = this->Socket->Recv( (uint8 *)&this->Buffer[this->Buffer.size() - bytesPending], bytesPending, bytesRead, ESocketReceiveFlags::None );
+	success = this->Stream->Read( &this->Buffer[this->Buffer.size() - bytesPending], bytesPending, bytesRead );
 
 	if( !success )
 	{
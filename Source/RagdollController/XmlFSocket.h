@@ -3,21 +3,21 @@
 #pragma once
 
 
-#include <SharedPointer.h>
+#include "XmlArena.h"
+#include "ByteStream.h"
 
 #include <pugixml.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <string>
 #include <memory>
 #include <limits>
 
-#include <Networking.h>
-
 
 
 
 /**
-* Non-blocking xml wrapper for FSockets that supports both xml-based and line-based communications.
+* Non-blocking xml wrapper for byte streams (in practice, FSockets: @see FSocketByteStream) that supports both xml-based and line-based communications.
 * 
 * Xml documents received from the socket must be preceded by a block header and followed by a block footer as follows:
 *   XML_DOCUMENT_BEGIN
@@ -25,6 +25,13 @@
 *   XML_DOCUMENT_END
 * All outgoing xml documents are preceded by a similar block headers and footers.
 * 
+* The memory of InXml comes from a per-connection arena that is reset in bulk per message (@see XmlArena), so that receiving documents does not allocate in
+* steady state. Responses are written as text into OutText (e.g. with MbmlWriter), which skips the DOM entirely and does not allocate either; OutXml and
+* PutXml() remain for documents built with pugixml, whose memory comes from the heap.
+* 
+* Free of engine dependencies: the connection is reached through the ByteStream interface, so that the framing, buffering and parsing can be tested and
+* benchmarked headless (Test/XmlFSocket).
+* 
 * Warning: No flood protection! The line buffer size is unlimited.
 */
 class XmlFSocket
@@ -40,25 +47,41 @@ protected:
 	 ** Note that the Buffer data to be removed can contain nulls! */
 	std::size_t BufferInSituXmlLength = 0;
 
+	/** If this is non-zero, then the Buffer begins with the line that Line refers to. Further read operations should first remove this much data from the
+	 ** beginning of the buffer and clear Line. */
+	std::size_t BufferLineLength = 0;
+
+	/** Send buffer of PutLine(): the line and its LF, so that they are sent with a single write. Pre-sized, so that lines of up to its capacity do not
+	 ** allocate. */
+	std::string OutLine;
+
 	/** Whether read operations should block. */
 	bool ShouldBlock = false;
 
 	/** Network read timeout value for blocking read operations, in milliseconds. Note that a single read operation might perform several network reads, and
 	 ** this value controls the timeout of such single _network_ read operations. */
-	int32 BlockingTimeoutMs = 0;
+	int BlockingTimeoutMs = 0;
+
+	/** Memory for InXml, reset whenever InXml is. Declared before InXml, so that it outlives it. */
+	XmlArena InXmlArena;
+
+
+	/** Writes raw bytes to the stream. Returns true on success, false on full or partial failure. */
+	bool PutBytes( const char * data, std::size_t size );
 
 
-	/** Tries to read some more data from the socket into Buffer. Returns true if any new data was read. If ShouldBlock == true, then BlockingTimeoutMs
+	/** Tries to read some more data from the stream into Buffer. Returns true if any new data was read. If ShouldBlock == true, then BlockingTimeoutMs
 	 ** is adhered. */
 	bool GetFromSocketToBuffer();
 
 	/** Prepares Buffer for further processing. Drops leading whitespace (whitespace as in std::isspace, in practice: spaces, tabs, LFs and CRs).
-	 ** Checks for the presence of an in-situ xml parse and, if one is present, drops it and resets InXml. */
+	 ** Checks for the presence of an in-situ xml parse and, if one is present, drops it and resets InXml. Likewise drops the line of the last GetLine()
+	 ** and clears Line. */
 	void CleanupBuffer();
 
 	/**
-	* Tries to extract a complete, non-empty line from Buffer. On success, the line is placed in Line and true is returned.
-	* The Line field is not touched on failure.
+	* Tries to extract a complete, non-empty line from Buffer. On success, Line is set to refer to the line, and true is returned.
+	* The line stays at the beginning of Buffer (see BufferLineLength) until the next read operation.
 	*/
 	bool ExtractLineFromBuffer();
 
@@ -74,11 +97,12 @@ protected:
 
 public:
 
-	/** The UE FSocket. */
-	std::unique_ptr<FSocket> Socket;
+	/** The connection. */
+	std::unique_ptr<ByteStream> Stream;
 
-	/** A copy of the last full line read with GetLine(), without the terminating LF or CRLF. This buffer can be modified directly. */
-	std::string Line;
+	/** The last full line read with GetLine(), without the terminating LF or CRLF. Refers to the internal buffer: valid until the next read operation
+	 ** (GetLine or GetXml), which clears it. Copy the line if it is needed for longer. */
+	boost::string_ref Line;
 
 
 	/** The last XML document received with GetXml(). The document is reset on the next read operation (GetLine or GetXml); the document is an in-situ
@@ -94,15 +118,19 @@ public:
 	 ** before each send operation. OutXml is never written to or reset by XmlFSocket itself; it is up to client code to use it in whatever way seems best. */
 	pugi::xml_document OutXml;
 
+	/** Outbound text buffer, for documents that are written as text instead of being built in OutXml. Holds the block header, the document and, once
+	 ** PutOutText() has been called, the block footer, so that the whole block is sent with a single socket write. @see BeginOutText */
+	std::string OutText;
+
 
 	/**
-	* Constructs a new XmlFSocket wrapper around the provided FSocket and shares its ownership via the provided shared pointer.
-	* The socket argument can be null, in which case the resulting object will be in an invalid state (IsGood() == false).
+	* Constructs a new XmlFSocket wrapper around the provided stream, taking its ownership.
+	* The stream argument can be null, in which case the resulting object will be in an invalid state (IsGood() == false).
 	*/
-	XmlFSocket( std::unique_ptr<FSocket> socket );
+	XmlFSocket( std::unique_ptr<ByteStream> stream );
 
 
-	/** Check whether we have a socket and that it is connected and all-ok. */
+	/** Check whether we have a stream and that it is connected and all-ok. */
 	bool IsGood();
 
 	/** Set whether the read methods should block until success. Timeout is specified in milliseconds. Note that a timeout value of 0 does _not_ mean
@@ -111,19 +139,19 @@ public:
 
 
 	/**
-	* Tries to read the next non-empty, complete (LF or CRLF terminated) line from the socket. On success, the new line is placed into Line.
-	* The Line field is not touched upon failure.
+	* Tries to read the next non-empty, complete (LF or CRLF terminated) line from the socket. On success, Line refers to the new line.
+	* Note that the previous Line is cleared no matter whether a new line was found!
 	*
 	* @return True if a new line was read, false otherwise.
 	*/
 	bool GetLine();
 
 	/**
-	 * Writes the contents of 'line' to the socket after appending an LF to it.
+	 * Writes the contents of 'line' to the socket after appending an LF to it. Does not allocate for lines that fit the pre-sized send buffer.
 	 * 
 	 * @return True on success, false on full or partial failure.
 	 */
-	bool PutLine( std::string line );
+	bool PutLine( boost::string_ref line );
 
 	/**
 	* Tries to read the next complete xml document from the socket. A proper xml block header is expected (see class documentation for details).
@@ -144,4 +172,14 @@ public:
 	 * @return True on success, false on full or partial failure.
 	 */
 	bool PutXml( pugi::xml_document * xmlDoc = 0 );
+
+	/** Clear OutText and start a new outbound block in it. Append the xml document to the returned string, then send it with PutOutText(). */
+	std::string & BeginOutText();
+
+	/**
+	 * Completes the block in OutText and sends it to the socket.
+	 * 
+	 * @return True on success, false on full or partial failure.
+	 */
+	bool PutOutText();
 };
@@ -0,0 +1,297 @@
+// Headless test for MbmlWriter, MbmlTemplate and FloatFormat: checks that floats are written as the shortest strings that read back to the same value, and
+// that the written documents follow the MbML conventions that xml2mat expects (class and size attributes, column-major data, xml4mat-encoded char arrays,
+// and the base64 extension).
+
+#include "MbmlWriter.h"
+#include "FloatFormat.h"
+#include "TestSupport.h"
+
+#include <pugixml.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+// step through the bit patterns of all floats with this stride for the round-trip test (a prime, so that all mantissa bits get exercised)
+#define ROUND_TRIP_STRIDE 65521
+
+
+
+
+static std::string Format( float value )
+{
+	char buffer[FloatFormat::MaxLength];
+	int length = FloatFormat::Write( buffer, value );
+	TEST_CHECK( length > 0 && length <= FloatFormat::MaxLength );
+	return std::string( buffer, length );
+}
+
+
+
+
+static float FromBits( std::uint32_t bits )
+{
+	float value;
+	std::memcpy( &value, &bits, sizeof( value ) );
+	return value;
+}
+
+
+
+
+static void TestKnownValues()
+{
+	TEST_CHECK( Format( 0.f ) == "0" );
+	TEST_CHECK( Format( -0.f ) == "-0" );
+	TEST_CHECK( Format( 1.f ) == "1" );
+	TEST_CHECK( Format( -2.5f ) == "-2.5" );
+	TEST_CHECK( Format( 0.1f ) == "0.1" );
+	TEST_CHECK( Format( 0.001f ) == "0.001" );
+	TEST_CHECK( Format( 0.0001f ) == "0.0001" );
+	TEST_CHECK( Format( 1.5e-7f ) == "1.5e-7" );
+	TEST_CHECK( Format( 123456.f ) == "123456" );
+	TEST_CHECK( Format( 100000000.f ) == "100000000" );
+	TEST_CHECK( Format( 3e12f ) == "3e+12" );
+	TEST_CHECK( Format( 3.14159274f ) == "3.1415927" );
+	TEST_CHECK( Format( std::numeric_limits<float>::max() ) == "3.4028235e+38" );
+	TEST_CHECK( Format( -std::numeric_limits<float>::min() ) == "-1.1754944e-38" );
+	TEST_CHECK( Format( std::numeric_limits<float>::denorm_min() ) == "1e-45" );
+	TEST_CHECK( Format( std::numeric_limits<float>::quiet_NaN() ) == "NaN" );
+	TEST_CHECK( Format( std::numeric_limits<float>::infinity() ) == "Inf" );
+	TEST_CHECK( Format( -std::numeric_limits<float>::infinity() ) == "-Inf" );
+}
+
+
+
+
+static void TestRoundTrip()
+{
+	int numTested = 0;
+	for( std::uint64_t bits = 0; bits <= 0xffffffffu; bits += ROUND_TRIP_STRIDE )
+	{
+		float value = FromBits( std::uint32_t( bits ) );
+		if( !std::isfinite( value ) ) continue;
+
+		std::string text = Format( value );
+		float parsed = std::strtof( text.c_str(), nullptr );
+		if( !TEST_CHECK( std::memcmp( &parsed, &value, sizeof( value ) ) == 0 ) )
+		{
+			std::printf( "  %.9g written as '%s'\n", value, text.c_str() );
+		}
+
+		// shortest: dropping the last significant digit must not read back to the same value (checked on the fixed-notation fractions, where it is simple)
+		std::size_t dot = text.find( '.' );
+		if( dot != std::string::npos && text.find( 'e' ) == std::string::npos && text.size() - dot > 2 )
+		{
+			std::string shorter = text.substr( 0, text.size() - 1 );
+			TEST_CHECK( std::strtof( shorter.c_str(), nullptr ) != value || shorter.back() == '0' );
+		}
+
+		++numTested;
+	}
+
+	std::printf( "round trip: %d floats\n", numTested );
+}
+
+
+
+
+static void TestDocument()
+{
+	std::string out( "HEADER\n" );
+
+	const float matrix[2 * 3] = { 1.f, 2.f, 3.f, 4.f, 5.f, 6.f };   // column-major [2 3]
+
+	MbmlWriter writer( out );
+	writer.BeginStruct( "RemoteResponse" );
+	writer.BeginStruct( "sensors" );
+	writer.AddMatrix( "jointAngles", matrix, 2, 3 );
+	writer.AddMatrix( "transposed", 3, 2, [&matrix]( int row, int col ) { return matrix[row * 2 + col]; } );
+	writer.EndStruct();
+	TEST_CHECK( !writer.IsComplete() );
+	writer.AddCharArray( "name", "Owen 2.0" );
+	writer.AddScalar( "time", 0.25f );
+	writer.AddMatrix( "empty", nullptr, 0, 3 );
+	writer.EndStruct();
+	TEST_CHECK( writer.IsComplete() );
+
+	const char * expected =
+		"HEADER\n"
+		"<RemoteResponse class=\"struct\" size=\"1 1\">"
+		"<sensors class=\"struct\" size=\"1 1\">"
+		"<jointAngles class=\"single\" size=\"2 3\">1 2 3 4 5 6</jointAngles>"
+		"<transposed class=\"single\" size=\"3 2\">1 3 5 2 4 6</transposed>"
+		"</sensors>"
+		"<name class=\"char\" size=\"1 8\">Owen#32;2#46;0</name>"
+		"<time class=\"single\" size=\"1 1\">0.25</time>"
+		"<empty class=\"single\" size=\"0 3\"></empty>"
+		"</RemoteResponse>";
+	TEST_CHECK( out == expected );
+
+	// well-formed xml
+	pugi::xml_document document;
+	TEST_CHECK( document.load_string( out.c_str() + std::strlen( "HEADER\n" ) ) );
+	TEST_CHECK( std::strcmp( document.child( "RemoteResponse" ).child( "sensors" ).child( "jointAngles" ).attribute( "size" ).value(), "2 3" ) == 0 );
+
+	// steady state: writing the same document again into the cleared string does not reallocate
+	std::size_t capacity = out.capacity();
+	const char * data = out.data();
+	out.clear();
+	MbmlWriter again( out );
+	again.BeginStruct( "RemoteResponse" );
+	again.AddMatrix( "jointAngles", matrix, 2, 3 );
+	again.EndStruct();
+	TEST_CHECK( out.capacity() == capacity && out.data() == data );
+}
+
+
+
+
+static void TestTemplate()
+{
+	MbmlTemplate response;
+	MbmlWriter writer( response.Text );
+	writer.BeginStruct( "RemoteResponse" );
+	MbmlTemplate::MatrixSlot angles = writer.AddMatrixSlot( "jointAngles", 2, 3 );
+	MbmlTemplate::MatrixSlot empty = writer.AddMatrixSlot( "empty", 0, 3 );
+	writer.EndStruct();
+	TEST_CHECK( writer.IsComplete() );
+
+	// the template reads as zeros before the first update
+	pugi::xml_document document;
+	TEST_CHECK( document.load_string( response.Text.c_str() ) );
+	TEST_CHECK( std::strtof( document.child( "RemoteResponse" ).child_value( "jointAngles" ), nullptr ) == 0.f );
+
+	std::string built = response.Text;
+	std::size_t capacity = response.Text.capacity();
+	const char * data = response.Text.data();
+
+	for( int update = 0; update < 100; ++update )
+	{
+		// values of varying length, including the longest ones
+		float values[2 * 3] = { float( update ), -std::numeric_limits<float>::min(), 0.1f * update, std::numeric_limits<float>::quiet_NaN(), 1e-7f, -1.f };
+		response.SetMatrix( angles, [&values]( int row, int col ) { return values[col * 2 + row]; } );
+		response.SetMatrix( empty, []( int, int ) { return 1.f; } );
+
+		TEST_CHECK( response.Text.size() == built.size() && response.Text.capacity() == capacity && response.Text.data() == data );
+
+		// the document is still well-formed, and the values read back in column-major order
+		TEST_CHECK( document.load_string( response.Text.c_str() ) );
+		pugi::xml_node node = document.child( "RemoteResponse" ).child( "jointAngles" );
+		TEST_CHECK( std::strcmp( node.attribute( "size" ).value(), "2 3" ) == 0 );
+		const char * text = node.child_value();
+		for( int value = 0; value < 2 * 3; ++value )
+		{
+			char * end;
+			float parsed = std::strtof( text, &end );
+			TEST_CHECK( end != text );
+			TEST_CHECK( parsed == values[value] || (std::isnan( parsed ) && std::isnan( values[value] )) );
+			text = end;
+		}
+		TEST_CHECK( std::strspn( text, " " ) == std::strlen( text ) );
+	}
+
+	// the tags are untouched
+	std::size_t valuesBegin = angles.Offset;
+	std::size_t valuesEnd = angles.Offset + 2 * 3 * MbmlTemplate::FieldWidth;
+	TEST_CHECK( response.Text.compare( 0, valuesBegin, built, 0, valuesBegin ) == 0 );
+	TEST_CHECK( response.Text.compare( valuesEnd, std::string::npos, built, valuesEnd, std::string::npos ) == 0 );
+}
+
+
+
+
+/** Decodes base64 text (without whitespace) into floats, as the patched xml2mat does. */
+static std::vector<float> DecodeBase64Singles( const char * text )
+{
+	static const std::string alphabet( "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/" );
+
+	std::vector<unsigned char> bytes;
+	std::uint32_t group = 0;
+	int bits = 0;
+	for( ; *text && *text != '='; ++text )
+	{
+		group = (group << 6) | std::uint32_t( alphabet.find( *text ) );
+		bits += 6;
+		if( bits >= 8 )
+		{
+			bits -= 8;
+			bytes.push_back( (unsigned char)(group >> bits) );
+		}
+	}
+
+	std::vector<float> values( bytes.size() / 4 );
+	for( std::size_t value = 0; value < values.size(); ++value )
+	{
+		std::uint32_t little = bytes[4 * value] | bytes[4 * value + 1] << 8 | bytes[4 * value + 2] << 16 | std::uint32_t( bytes[4 * value + 3] ) << 24;
+		std::memcpy( &values[value], &little, sizeof( float ) );
+	}
+	return values;
+}
+
+
+
+
+static void TestBase64()
+{
+	// 1 = 0x3f800000, 2 = 0x40000000, -0.5 = 0xbf000000, little-endian
+	const float matrix[3] = { 1.f, 2.f, -0.5f };
+
+	std::string out;
+	MbmlWriter writer( out );
+	writer.AddMatrix( "one", matrix, 1, 1, MbmlBase64Encoding );
+	writer.AddMatrix( "two", matrix, 2, 1, MbmlBase64Encoding );
+	writer.AddMatrix( "three", matrix, 3, 1, MbmlBase64Encoding );
+	writer.AddMatrix( "empty", matrix, 0, 0, MbmlBase64Encoding );
+	TEST_CHECK( out ==
+		"<one class=\"single\" size=\"1 1\" encoding=\"base64\">AACAPw==</one>"
+		"<two class=\"single\" size=\"2 1\" encoding=\"base64\">AACAPwAAAEA=</two>"
+		"<three class=\"single\" size=\"3 1\" encoding=\"base64\">AACAPwAAAEAAAAC/</three>"
+		"<empty class=\"single\" size=\"0 0\" encoding=\"base64\"></empty>" );
+
+	// templates: all values, including NaN and denormals, read back bit-exact, and the encoding stays within its slot
+	MbmlTemplate response;
+	MbmlWriter templateWriter( response.Text );
+	templateWriter.BeginStruct( "RemoteResponse" );
+	MbmlTemplate::MatrixSlot slot = templateWriter.AddMatrixSlot( "jointAngles", 22, 3, MbmlBase64Encoding );
+	templateWriter.EndStruct();
+	std::size_t size = response.Text.size();
+
+	for( int update = 0; update < 100; ++update )
+	{
+		std::uint32_t seed = 12345u + update;
+		float values[22 * 3];
+		for( float & value : values )
+		{
+			seed = seed * 1664525u + 1013904223u;
+			std::memcpy( &value, &seed, sizeof( value ) );
+		}
+		response.SetMatrix( slot, [&values]( int row, int col ) { return values[col * 22 + row]; } );
+		TEST_CHECK( response.Text.size() == size );
+
+		pugi::xml_document document;
+		TEST_CHECK( document.load_string( response.Text.c_str() ) );
+		std::vector<float> decoded = DecodeBase64Singles( document.child( "RemoteResponse" ).child_value( "jointAngles" ) );
+		TEST_CHECK( decoded.size() == 22 * 3 && std::memcmp( decoded.data(), values, sizeof( values ) ) == 0 );
+	}
+}
+
+
+
+
+int main()
+{
+	TestKnownValues();
+	TestRoundTrip();
+	TestDocument();
+	TestTemplate();
+	TestBase64();
+
+	return GetTestExitCode();
+}
@@ -0,0 +1,440 @@
+// Load generator for the remote control hub (RCH) protocol. Opens one connection per target actor, performs the "RagdollController RCH: CONNECT" handshake
+// and then drives setActuators/getSensors exchanges in lockstep (send a command document, wait for the response, repeat) on all connections concurrently.
+// Reports the round-trip latency percentiles and the message rate, so that transport and codec changes can be compared objectively.
+//
+// Linux (POSIX sockets) only. Run against a local server, e.g.:
+//   RchBenchmark --messages 20000 Owen Owen2 Owen3
+
+#include "MbmlWriter.h"
+
+#include <pugixml.hpp>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// protocol strings, as in RemoteControlHub.cpp and XmlFSocket.cpp
+#define RCH_HANDSHAKE_STRING "RagdollController RCH: "
+#define RCH_COMMAND_CONNECT "CONNECT "
+#define RCH_ACK_STRING "OK"
+#define XML_BLOCK_HEADER "XML_DOCUMENT_BEGIN"
+#define XML_BLOCK_FOOTER "XML_DOCUMENT_END"
+
+// size of the chunks read from the socket
+#define RECEIVE_CHUNK_SIZE (64 * 1024)
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+
+
+struct Options
+{
+	std::string Host = "127.0.0.1";
+	std::string Port = "7770";
+	int Messages = 10000;
+	int Warmup = 100;
+	int Joints = 22;
+	MbmlEncoding Encoding = MbmlTextEncoding;
+	bool GetActuators = false;
+	bool Validate = true;
+	std::vector<std::string> Actors;
+};
+
+
+
+
+/** Blocking client side of one RCH connection. */
+class Connection
+{
+	int Socket = -1;
+
+	/** Received data; everything before BufferBegin has been consumed already. */
+	std::string Buffer;
+	std::size_t BufferBegin = 0;
+
+
+	/** Receive until delimiter is found in the unconsumed data. Returns the offset of the delimiter, or npos on failure. */
+	std::size_t ReceiveUntil( const char * delimiter )
+	{
+		std::size_t searchBegin = this->BufferBegin;
+		std::size_t delimiterLength = std::strlen( delimiter );
+		while( true )
+		{
+			std::size_t position = this->Buffer.find( delimiter, searchBegin );
+			if( position != std::string::npos ) return position;
+
+			// the delimiter might begin within the last few characters
+			searchBegin = std::max( this->BufferBegin, this->Buffer.size() - std::min( this->Buffer.size(), delimiterLength - 1 ) );
+
+			// drop the consumed data before reading more
+			if( this->BufferBegin > 0 )
+			{
+				this->Buffer.erase( 0, this->BufferBegin );
+				searchBegin -= this->BufferBegin;
+				this->BufferBegin = 0;
+			}
+
+			std::size_t size = this->Buffer.size();
+			this->Buffer.resize( size + RECEIVE_CHUNK_SIZE );
+			ssize_t received = recv( this->Socket, &this->Buffer[size], RECEIVE_CHUNK_SIZE, 0 );
+			this->Buffer.resize( size + std::max<ssize_t>( received, 0 ) );
+			if( received <= 0 ) return std::string::npos;
+		}
+	}
+
+
+public:
+
+	Connection() { this->Buffer.reserve( 2 * RECEIVE_CHUNK_SIZE ); }
+
+	~Connection() { if( this->Socket >= 0 ) close( this->Socket ); }
+
+	Connection( const Connection & ) = delete;
+	Connection & operator=( const Connection & ) = delete;
+
+
+	bool Open( const std::string & host, const std::string & port )
+	{
+		addrinfo hints;
+		std::memset( &hints, 0, sizeof( hints ) );
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo * addresses = nullptr;
+		if( getaddrinfo( host.c_str(), port.c_str(), &hints, &addresses ) != 0 ) return false;
+
+		for( addrinfo * address = addresses; address && this->Socket < 0; address = address->ai_next )
+		{
+			this->Socket = socket( address->ai_family, address->ai_socktype, address->ai_protocol );
+			if( this->Socket >= 0 && connect( this->Socket, address->ai_addr, address->ai_addrlen ) != 0 )
+			{
+				close( this->Socket );
+				this->Socket = -1;
+			}
+		}
+		freeaddrinfo( addresses );
+		if( this->Socket < 0 ) return false;
+
+		// lockstep traffic: send each document right away
+		int noDelay = 1;
+		setsockopt( this->Socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof( noDelay ) );
+		return true;
+	}
+
+	bool Send( const std::string & data )
+	{
+		for( std::size_t sent = 0; sent < data.size(); )
+		{
+			ssize_t result = send( this->Socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL );
+			if( result <= 0 ) return false;
+			sent += std::size_t( result );
+		}
+		return true;
+	}
+
+	/** Receive the next line, without the line terminator. The returned pointer is valid until the next receive operation. */
+	const char * ReceiveLine()
+	{
+		std::size_t end = ReceiveUntil( "\n" );
+		if( end == std::string::npos ) return nullptr;
+
+		char * line = &this->Buffer[this->BufferBegin];
+		if( end > this->BufferBegin && this->Buffer[end - 1] == '\r' ) this->Buffer[end - 1] = '\0';
+		this->Buffer[end] = '\0';
+		this->BufferBegin = end + 1;
+		return line;
+	}
+
+	/** Receive the next xml block, returning the document between the block header and footer, null terminated. The returned pointer is valid until the
+	 ** next receive operation. */
+	char * ReceiveXml( std::size_t & length )
+	{
+		std::size_t footer = ReceiveUntil( XML_BLOCK_FOOTER "\n" );
+		if( footer == std::string::npos ) return nullptr;
+
+		std::size_t begin = this->Buffer.find( XML_BLOCK_HEADER "\n", this->BufferBegin );
+		if( begin == std::string::npos || begin > footer ) return nullptr;
+		begin += std::strlen( XML_BLOCK_HEADER "\n" );
+
+		char * document = &this->Buffer[begin];
+		length = footer - begin;
+		this->Buffer[footer] = '\0';
+		this->BufferBegin = footer + std::strlen( XML_BLOCK_FOOTER "\n" );
+		return document;
+	}
+};
+
+
+
+
+/** Results of one connection. */
+struct ConnectionResult
+{
+	bool Ok = false;
+	std::string Error;
+
+	/** Round-trip times of the measured messages, in microseconds. */
+	std::vector<double> RoundTrips;
+
+	Clock::time_point Begin;
+	Clock::time_point End;
+	std::size_t BytesSent = 0;
+	std::size_t BytesReceived = 0;
+};
+
+
+
+
+/** Build the command document for the given message into out: motor commands that change on every message, and the getter commands. */
+static void BuildCommand( const Options & options, int message, std::string & out )
+{
+	out.assign( XML_BLOCK_HEADER "\n" );
+
+	MbmlWriter writer( out );
+	writer.BeginStruct( "RemoteCall" );
+	writer.AddMatrix( "setActuators", options.Joints, 3, [message]( int row, int col ) { return 0.1f * std::sin( 0.01f * message + row + 0.3f * col ); } );
+	writer.AddCharArray( "getSensors", "" );
+	if( options.GetActuators ) writer.AddCharArray( "getActuators", "" );
+	if( options.Encoding == MbmlBase64Encoding ) writer.AddCharArray( "responseEncoding", "base64" );
+	writer.EndStruct();
+
+	out += "\n" XML_BLOCK_FOOTER "\n";
+}
+
+
+
+
+/** Check that the response contains the joint angles of all joints. */
+static bool ValidateResponse( const Options & options, pugi::xml_document & document, char * text, std::size_t length, std::string & error )
+{
+	pugi::xml_parse_result result = document.load_buffer_inplace( text, length );
+	if( !result )
+	{
+		error = std::string( "malformed response: " ) + result.description();
+		return false;
+	}
+
+	pugi::xml_node jointAngles = document.child( "RemoteResponse" ).child( "sensors" ).child( "jointAngles" );
+	if( !jointAngles )
+	{
+		error = "no sensors/jointAngles in the response";
+		return false;
+	}
+
+	// count the values
+	int numValues = 0;
+	const char * values = jointAngles.child_value();
+	if( std::strcmp( jointAngles.attribute( "encoding" ).value(), "base64" ) == 0 )
+	{
+		std::size_t encodedLength = std::strlen( values );
+		numValues = encodedLength == MbmlBase64Encoder::GetEncodedLength( std::size_t( options.Joints ) * 3 * sizeof( float ) ) ? options.Joints * 3 : -1;
+	}
+	else
+	{
+		for( char * end; ; values = end, ++numValues )
+		{
+			std::strtof( values, &end );
+			if( end == values ) break;
+		}
+	}
+
+	if( numValues != options.Joints * 3 )
+	{
+		error = "unexpected number of joint angles in the response (is --joints right?)";
+		return false;
+	}
+
+	return true;
+}
+
+
+
+
+static void RunConnection( const Options & options, const std::string & actor, std::atomic<int> & numReady, ConnectionResult & result )
+{
+	Connection connection;
+	result.RoundTrips.reserve( options.Messages );
+
+	// the measurement starts on all connections together; failed connections count as ready, so that the others do not wait for them
+	bool ready = false;
+	auto setReady = [&]() { if( !ready ) { ready = true; ++numReady; } };
+	auto fail = [&]( const std::string & error ) { result.Error = actor + ": " + error; setReady(); };
+
+	// connect and hand-shake
+	if( !connection.Open( options.Host, options.Port ) ) return fail( "failed to connect to " + options.Host + ":" + options.Port );
+	if( !connection.Send( RCH_HANDSHAKE_STRING RCH_COMMAND_CONNECT + actor + "\n" ) ) return fail( "failed to send the handshake" );
+	const char * reply = connection.ReceiveLine();
+	if( !reply || std::strcmp( reply, RCH_ACK_STRING ) != 0 ) return fail( std::string( "handshake refused: " ) + (reply ? reply : "connection closed") );
+
+	std::string command;
+	command.reserve( RECEIVE_CHUNK_SIZE );
+	pugi::xml_document document;
+	std::string error;
+
+	for( int message = 0; message < options.Warmup + options.Messages; ++message )
+	{
+		// start measuring together with the other connections
+		if( message == options.Warmup )
+		{
+			setReady();
+			while( numReady.load() < int( options.Actors.size() ) ) std::this_thread::yield();
+			result.Begin = Clock::now();
+		}
+
+		BuildCommand( options, message, command );
+
+		Clock::time_point sendTime = Clock::now();
+		if( !connection.Send( command ) ) return fail( "failed to send a command document" );
+
+		std::size_t length;
+		char * response = connection.ReceiveXml( length );
+		if( !response ) return fail( "connection closed while waiting for a response" );
+		Clock::time_point receiveTime = Clock::now();
+
+		if( message >= options.Warmup )
+		{
+			result.RoundTrips.push_back( std::chrono::duration<double, std::micro>( receiveTime - sendTime ).count() );
+			result.BytesSent += command.size();
+			result.BytesReceived += length;
+		}
+
+		if( options.Validate && !ValidateResponse( options, document, response, length, error ) ) return fail( error );
+	}
+
+	result.End = Clock::now();
+	result.Ok = true;
+}
+
+
+
+
+/** Value at the percentile (0..100) of sorted values, nearest rank. */
+static double GetPercentile( const std::vector<double> & sorted, double percentile )
+{
+	if( sorted.empty() ) return 0.0;
+	std::size_t rank = std::size_t( std::ceil( percentile / 100.0 * sorted.size() ) );
+	return sorted[std::min( std::max<std::size_t>( rank, 1 ), sorted.size() ) - 1];
+}
+
+
+
+
+static void PrintUsage()
+{
+	std::printf(
+		"Usage: RchBenchmark [options] <actor> [<actor> ...]\n"
+		"Opens one connection per actor and exchanges command/response documents in lockstep on all of them.\n"
+		"  --host <host>        server address (default 127.0.0.1)\n"
+		"  --port <port>        server port (default 7770)\n"
+		"  --messages <n>       measured messages per connection (default 10000)\n"
+		"  --warmup <n>         unmeasured messages per connection before measuring (default 100)\n"
+		"  --joints <n>         number of joints of the ragdolls (default 22)\n"
+		"  --encoding <e>       response matrix encoding: text or base64 (default text)\n"
+		"  --get-actuators      also request the actuator states\n"
+		"  --no-validate        do not parse and check the responses\n" );
+}
+
+
+
+
+static bool ParseOptions( int argc, char ** argv, Options & options )
+{
+	for( int arg = 1; arg < argc; ++arg )
+	{
+		std::string name( argv[arg] );
+		bool hasValue = arg + 1 < argc;
+
+		if( name == "--host" && hasValue ) options.Host = argv[++arg];
+		else if( name == "--port" && hasValue ) options.Port = argv[++arg];
+		else if( name == "--messages" && hasValue ) options.Messages = std::atoi( argv[++arg] );
+		else if( name == "--warmup" && hasValue ) options.Warmup = std::atoi( argv[++arg] );
+		else if( name == "--joints" && hasValue ) options.Joints = std::atoi( argv[++arg] );
+		else if( name == "--encoding" && hasValue )
+		{
+			std::string encoding( argv[++arg] );
+			if( encoding != "text" && encoding != "base64" ) return false;
+			options.Encoding = encoding == "base64" ? MbmlBase64Encoding : MbmlTextEncoding;
+		}
+		else if( name == "--get-actuators" ) options.GetActuators = true;
+		else if( name == "--no-validate" ) options.Validate = false;
+		else if( name.compare( 0, 2, "--" ) == 0 ) return false;
+		else options.Actors.push_back( name );
+	}
+
+	return !options.Actors.empty() && options.Messages > 0 && options.Warmup >= 0 && options.Joints > 0;
+}
+
+
+
+
+int main( int argc, char ** argv )
+{
+	Options options;
+	if( !ParseOptions( argc, argv, options ) )
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	// run all connections concurrently
+	std::vector<ConnectionResult> results( options.Actors.size() );
+	std::vector<std::thread> threads;
+	std::atomic<int> numReady( 0 );
+	for( std::size_t actor = 0; actor < options.Actors.size(); ++actor )
+	{
+		threads.emplace_back( RunConnection, std::cref( options ), std::cref( options.Actors[actor] ), std::ref( numReady ), std::ref( results[actor] ) );
+	}
+	for( std::thread & thread : threads ) thread.join();
+
+	// report
+	bool ok = true;
+	std::vector<double> roundTrips;
+	Clock::time_point begin = Clock::time_point::max(), end = Clock::time_point::min();
+	std::size_t bytesSent = 0, bytesReceived = 0;
+	for( ConnectionResult & result : results )
+	{
+		if( !result.Ok )
+		{
+			std::fprintf( stderr, "FAILED: %s\n", result.Error.c_str() );
+			ok = false;
+			continue;
+		}
+
+		roundTrips.insert( roundTrips.end(), result.RoundTrips.begin(), result.RoundTrips.end() );
+		begin = std::min( begin, result.Begin );
+		end = std::max( end, result.End );
+		bytesSent += result.BytesSent;
+		bytesReceived += result.BytesReceived;
+	}
+	if( !ok ) return 1;
+
+	std::sort( roundTrips.begin(), roundTrips.end() );
+	double seconds = std::chrono::duration<double>( end - begin ).count();
+	double mean = 0.0;
+	for( double roundTrip : roundTrips ) mean += roundTrip / roundTrips.size();
+
+	std::printf( "%zu connection(s), %zu messages in %.3f s: %.1f messages/s (%.1f per connection)\n", options.Actors.size(), roundTrips.size(), seconds,
+		roundTrips.size() / seconds, roundTrips.size() / seconds / options.Actors.size() );
+	std::printf( "round trip (us): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", mean, GetPercentile( roundTrips, 50.0 ),
+		GetPercentile( roundTrips, 90.0 ), GetPercentile( roundTrips, 99.0 ), GetPercentile( roundTrips, 99.9 ), GetPercentile( roundTrips, 100.0 ) );
+	std::printf( "per message: %.0f bytes sent, %.0f bytes received\n", double( bytesSent ) / roundTrips.size(), double( bytesReceived ) / roundTrips.size() );
+
+	return 0;
+}
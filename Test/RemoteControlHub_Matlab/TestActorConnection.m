@@ -11,6 +11,7 @@ outData = struct();
 outData.setActuators = zeros(22,3);
 outData.getSensors = '';
 outData.getActuators = '';
+outData.responseEncoding = 'base64';  % matrices of the response in base64 instead of text; needs the patched xml2mat in ThirdParty/xml4mat-2
 
 xmlDocument = simplify_mbml( mat2xml(outData,'RemoteCall') );
 
@@ -82,6 +82,13 @@ while do_i<=length(todo_list);
         n_unique=length(unique_names);
         n_certo=(n_fields/n_unique);
         w.size=[1 n_certo];
+    elseif isfield(w,'encoding')&&strcmp(w.encoding,'base64')
+        % RagdollController extension: base64 of the little-endian IEEE 754 values, in column-major order
+        tag_contents{i,4}=typecast(base64bytes(tag_contents{i,4}),w.class);
+        [~,~,endian]=computer;if endian=='B';tag_contents{i,4}=swapbytes(tag_contents{i,4});end
+        if ~isfield(w,'size');
+            w.size=size(tag_contents{i,4});
+        end
     else % it is a numeric type, say "double" or "single"
         tag_contents{i,4}=cast(str2num(tag_contents{i,4}),w.class);
         if ~isfield(w,'size');
@@ -123,4 +130,17 @@ else
     MAT=XML;
     VARNAME=[];
     tag_contents=[];
-end
\ No newline at end of file
+end
+
+
+
+function bytes=base64bytes(text)
+% decodes base64 text to a uint8 row vector (RagdollController extension)
+text=text(~isspace(text));
+if isempty(text)
+    bytes=uint8([]);
+elseif exist('matlab.net.base64decode','file')
+    bytes=matlab.net.base64decode(text);
+else
+    bytes=typecast(org.apache.commons.codec.binary.Base64.decodeBase64(uint8(text))','uint8');
+end
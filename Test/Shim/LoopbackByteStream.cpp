@@ -0,0 +1,109 @@
+// In-memory ByteStream for headless tests and benchmarks of XmlFSocket.
+
+#include "LoopbackByteStream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+
+
+
+LoopbackByteStream::LoopbackByteStream( std::shared_ptr<Connection> shared, int side ) :
+	Shared( std::move( shared ) ),
+	In( Shared->Pipes[side] ),
+	Out( Shared->Pipes[1 - side] )
+{
+}
+
+
+
+
+std::pair<std::unique_ptr<LoopbackByteStream>, std::unique_ptr<LoopbackByteStream>> LoopbackByteStream::CreatePair()
+{
+	std::shared_ptr<Connection> shared = std::make_shared<Connection>();
+	return std::make_pair( std::unique_ptr<LoopbackByteStream>( new LoopbackByteStream( shared, 0 ) ),
+		std::unique_ptr<LoopbackByteStream>( new LoopbackByteStream( shared, 1 ) ) );
+}
+
+
+
+
+LoopbackByteStream::~LoopbackByteStream()
+{
+	this->Shared->Closed = true;
+
+	// wake up a reader that waits on the other end (under the lock, so that it cannot miss the notification between checking and waiting)
+	for( Pipe & pipe : this->Shared->Pipes )
+	{
+		std::lock_guard<std::mutex> lock( pipe.Mutex );
+		pipe.DataWritten.notify_all();
+	}
+}
+
+
+
+
+bool LoopbackByteStream::IsGood()
+{
+	return !this->Shared->Closed;
+}
+
+
+
+
+bool LoopbackByteStream::WaitForData( int timeoutMs )
+{
+	std::unique_lock<std::mutex> lock( this->In.Mutex );
+	return this->In.DataWritten.wait_for( lock, std::chrono::milliseconds( timeoutMs ),
+		[this]() { return this->In.ReadPosition < this->In.Data.size() || this->Shared->Closed; } ) && !this->Shared->Closed;
+}
+
+
+
+
+bool LoopbackByteStream::HasPendingData( std::size_t & bytesPending )
+{
+	std::lock_guard<std::mutex> lock( this->In.Mutex );
+	bytesPending = this->In.Data.size() - this->In.ReadPosition;
+	return bytesPending > 0;
+}
+
+
+
+
+bool LoopbackByteStream::Read( char * data, std::size_t size, std::size_t & bytesRead )
+{
+	std::lock_guard<std::mutex> lock( this->In.Mutex );
+	if( this->Shared->Closed )
+	{
+		bytesRead = 0;
+		return false;
+	}
+
+	bytesRead = std::min( size, this->In.Data.size() - this->In.ReadPosition );
+	std::memcpy( data, this->In.Data.data() + this->In.ReadPosition, bytesRead );
+	this->In.ReadPosition += bytesRead;
+
+	// all read: start over, keeping the capacity
+	if( this->In.ReadPosition == this->In.Data.size() )
+	{
+		this->In.Data.clear();
+		this->In.ReadPosition = 0;
+	}
+
+	return true;
+}
+
+
+
+
+bool LoopbackByteStream::Write( const char * data, std::size_t size )
+{
+	std::lock_guard<std::mutex> lock( this->Out.Mutex );
+	if( this->Shared->Closed ) return false;
+
+	this->Out.Data.append( data, size );
+	this->Out.DataWritten.notify_all();
+	return true;
+}
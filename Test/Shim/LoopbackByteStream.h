@@ -0,0 +1,63 @@
+// In-memory ByteStream for headless tests and benchmarks of XmlFSocket.
+
+#pragma once
+
+#include "ByteStream.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+
+
+
+/**
+ * One end of an in-memory, bidirectional connection: what is written to one end can be read from the other. Thread-safe, so that the two ends may be used
+ * from different threads. Steady-state traffic does not allocate, once the buffers have grown to the largest amount of unread data.
+ */
+class LoopbackByteStream : public ByteStream
+{
+	/** Data in one direction. */
+	struct Pipe
+	{
+		std::mutex Mutex;
+		std::condition_variable DataWritten;
+
+		/** Written data; everything before ReadPosition has been read already. */
+		std::string Data;
+		std::size_t ReadPosition = 0;
+	};
+
+	/** State shared by both ends. */
+	struct Connection
+	{
+		Pipe Pipes[2];
+		std::atomic<bool> Closed{ false };
+	};
+
+	std::shared_ptr<Connection> Shared;
+	Pipe & In;
+	Pipe & Out;
+
+
+	LoopbackByteStream( std::shared_ptr<Connection> shared, int side );
+
+
+public:
+
+	/** Create a connected pair of ends. */
+	static std::pair<std::unique_ptr<LoopbackByteStream>, std::unique_ptr<LoopbackByteStream>> CreatePair();
+
+	/** Closing either end closes the connection. */
+	virtual ~LoopbackByteStream();
+
+
+	virtual bool IsGood() override;
+	virtual bool WaitForData( int timeoutMs ) override;
+	virtual bool HasPendingData( std::size_t & bytesPending ) override;
+	virtual bool Read( char * data, std::size_t size, std::size_t & bytesRead ) override;
+	virtual bool Write( const char * data, std::size_t size ) override;
+};
@@ -0,0 +1,4 @@
+// Stand-in for the module's precompiled header, for compiling module sources that do not depend on the engine (e.g. XmlArena.cpp, MbmlWriter.cpp)
+// outside of the engine.
+
+#pragma once
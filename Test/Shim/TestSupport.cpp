@@ -0,0 +1,64 @@
+// Shared scaffolding of the headless tests. @see TestSupport.h
+
+#include "TestSupport.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+
+static int Failures = 0;
+
+static std::atomic<unsigned long long> OperatorNewCalls( 0 );
+
+
+
+
+bool TestCheck( bool passed, const char * expression, int line )
+{
+	if( !passed )
+	{
+		std::printf( "FAILED: %s (line %d)\n", expression, line );
+		++Failures;
+	}
+	return passed;
+}
+
+
+
+
+unsigned long long GetOperatorNewCallCount()
+{
+	return OperatorNewCalls.load( std::memory_order_relaxed );
+}
+
+
+
+
+int GetTestExitCode()
+{
+	std::printf( Failures == 0 ? "PASSED\n" : "%d check(s) FAILED\n", Failures );
+	return Failures == 0 ? 0 : 1;
+}
+
+
+
+
+/* global operator new/delete, counting the calls */
+
+void * operator new( std::size_t size )
+{
+	OperatorNewCalls.fetch_add( 1, std::memory_order_relaxed );
+	if( void * memory = std::malloc( size ? size : 1 ) ) return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete( void * memory ) noexcept
+{
+	if( memory ) OperatorNewCalls.fetch_add( 1, std::memory_order_relaxed );
+	std::free( memory );
+}
+
+void * operator new[]( std::size_t size ) { return operator new( size ); }
+void operator delete[]( void * memory ) noexcept { operator delete( memory ); }
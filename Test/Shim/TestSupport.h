@@ -0,0 +1,20 @@
+// Shared scaffolding of the headless tests: counting of failed checks, and a counter of the calls to the global operator new and delete. Tests add
+// TestSupport.cpp to their sources (RC_TEST_SUPPORT_SOURCES in Test/CMakeLists.txt).
+
+#pragma once
+
+
+/** Report and count a failed check. Evaluates to the outcome of the check, so that a test can also bail out: if( !TEST_CHECK( ... ) ) return false; */
+#define TEST_CHECK( condition ) TestCheck( (condition) ? true : false, #condition, __LINE__ )
+
+/** Report and count a failed check, and return false from the calling function. */
+#define TEST_REQUIRE( condition ) do { if( !TEST_CHECK( condition ) ) return false; } while( false )
+
+
+bool TestCheck( bool passed, const char * expression, int line );
+
+/** Number of calls to the global operator new and delete (including the array forms) so far, for verifying that a code path does not allocate. */
+unsigned long long GetOperatorNewCallCount();
+
+/** Print PASSED or the number of failed checks, and return the exit code of the test. */
+int GetTestExitCode();
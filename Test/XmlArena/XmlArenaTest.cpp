@@ -0,0 +1,234 @@
+// Headless test for XmlArena and XmlDelayQueue: runs the document traffic of a remote controller connection through two XmlFSockets over an in-memory
+// loopback, as AControlledRagdoll does it (in-situ parse of the inbound document, delay queue of the commands, response written from a template into the
+// outbound buffer), and checks that, once warmed up, it calls neither malloc/free through pugixml nor operator new/delete. Also checks how arenas grow and
+// settle, and the order in which the delay queue hands out the documents.
+
+#include "XmlArena.h"
+#include "XmlDelayQueue.h"
+#include "XmlFSocket.h"
+#include "MbmlWriter.h"
+#include "LoopbackByteStream.h"
+#include "TestSupport.h"
+
+#include <pugixml.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+
+// arena size, as in XmlFSocket and AControlledRagdoll
+#define PREALLOC_SIZE (64 * 1024)
+
+#define WARMUP_MESSAGES 100
+#define TEST_MESSAGES 10000
+#define NUM_JOINTS 22
+
+// ticks by which the commands are delayed (@see ARCLevelScriptActor::ActionDelayTicks)
+#define ACTION_DELAY_TICKS 2
+
+
+
+
+/** A remote controller connection: the remote controller's end and the ragdoll's end, with the ragdoll's delay queue and the templates of the documents. */
+struct Connection
+{
+	XmlFSocket Controller;
+	XmlFSocket Ragdoll;
+	XmlDelayQueue DelayedCommands;
+
+	MbmlTemplate Command;
+	MbmlTemplate::MatrixSlot CommandActuators;
+	MbmlTemplate Response;
+	MbmlTemplate::MatrixSlot ResponseAngles;
+
+	Connection() : Controller( nullptr ), Ragdoll( nullptr ), DelayedCommands( PREALLOC_SIZE )
+	{
+		auto streams = LoopbackByteStream::CreatePair();
+		this->Controller.Stream = std::move( streams.first );
+		this->Ragdoll.Stream = std::move( streams.second );
+
+		// the data is always there when read, as the exchange is lockstep on a single thread
+		MbmlWriter command( this->Command.Text );
+		command.BeginStruct( "RemoteCall" );
+		this->CommandActuators = command.AddMatrixSlot( "setActuators", NUM_JOINTS, 3 );
+		command.AddCharArray( "getSensors", "" );
+		command.EndStruct();
+
+		MbmlWriter response( this->Response.Text );
+		response.BeginStruct( "RemoteResponse" );
+		response.BeginStruct( "sensors" );
+		this->ResponseAngles = response.AddMatrixSlot( "jointAngles", NUM_JOINTS, 3 );
+		response.EndStruct();
+		response.EndStruct();
+	}
+};
+
+
+
+
+/** Count the values of a text matrix. */
+static int CountValues( const char * text )
+{
+	int numValues = 0;
+	for( char * end; ; text = end, ++numValues )
+	{
+		std::strtof( text, &end );
+		if( end == text ) return numValues;
+	}
+}
+
+
+
+
+/** One tick of the connection: the remote controller sends the commands, the ragdoll receives them, handles those that are due, and responds, and the
+ ** remote controller receives the response. Returns the number of the message whose commands were handled, or -1 if none were due. */
+static int ExchangeMessage( Connection & connection, int message )
+{
+	// the first motor command carries the message number
+	connection.Command.SetMatrix( connection.CommandActuators, [message]( int row, int col ) { return float( message ) + 0.25f * (row + col); } );
+	connection.Controller.BeginOutText() += connection.Command.Text;
+	TEST_CHECK( connection.Controller.PutOutText() );
+
+	int handledMessage = -1;
+	TEST_CHECK( connection.Ragdoll.GetXml() );
+	if( const pugi::xml_document * due = connection.DelayedCommands.Push( &connection.Ragdoll.InXml, ACTION_DELAY_TICKS ) )
+	{
+		const char * actuators = due->document_element().child_value( "setActuators" );
+		TEST_CHECK( CountValues( actuators ) == 3 * NUM_JOINTS );
+		handledMessage = int( std::strtof( actuators, nullptr ) );
+	}
+	connection.Response.SetMatrix( connection.ResponseAngles, [message]( int row, int col ) { return 0.001f * message - row * col; } );
+	connection.Ragdoll.BeginOutText() += connection.Response.Text;
+	TEST_CHECK( connection.Ragdoll.PutOutText() );
+
+	TEST_CHECK( connection.Controller.GetXml() );
+	TEST_CHECK( CountValues( connection.Controller.InXml.document_element().child( "sensors" ).child_value( "jointAngles" ) ) == 3 * NUM_JOINTS );
+
+	return handledMessage;
+}
+
+
+
+
+/** The exchange of XmlFSocket and AControlledRagdoll does not allocate in steady state. */
+static void TestExchange()
+{
+	Connection connection;
+
+	// warm up: the buffers and arenas grow to their steady-state size, and the delay queue fills up
+	for( int message = 0; message < WARMUP_MESSAGES; ++message )
+	{
+		TEST_CHECK( ExchangeMessage( connection, message ) == (message < ACTION_DELAY_TICKS ? -1 : message - ACTION_DELAY_TICKS) );
+	}
+
+	std::uint64_t heapCalls = XmlArena::GetHeapCallCount();
+	unsigned long long newCalls = GetOperatorNewCallCount();
+
+	int numDelayed = 0;
+	for( int message = WARMUP_MESSAGES; message < WARMUP_MESSAGES + TEST_MESSAGES; ++message )
+	{
+		numDelayed += ExchangeMessage( connection, message ) == message - ACTION_DELAY_TICKS;
+	}
+
+	heapCalls = XmlArena::GetHeapCallCount() - heapCalls;
+	newCalls = GetOperatorNewCallCount() - newCalls;
+	TEST_CHECK( numDelayed == TEST_MESSAGES );
+	TEST_CHECK( heapCalls == 0 );
+	TEST_CHECK( newCalls == 0 );
+
+	std::printf( "%d messages: %llu pugixml heap calls, %llu operator new/delete calls\n", TEST_MESSAGES, (unsigned long long)heapCalls, newCalls );
+}
+
+
+
+
+/** A document that does not fit into the arena's chunk: the arena grows during the message, and settles into one larger chunk after the reset. */
+static void TestGrowth()
+{
+	XmlArena arena( PREALLOC_SIZE );
+	pugi::xml_document document;
+	std::size_t capacity = arena.GetCapacity();
+
+	// sanity check of the counter: without an arena, pugixml allocates from the heap
+	{
+		std::uint64_t heapCalls = XmlArena::GetHeapCallCount();
+		pugi::xml_document heapDocument;
+		heapDocument.append_child( "RemoteCall" );
+		heapDocument.reset();
+		TEST_CHECK( XmlArena::GetHeapCallCount() > heapCalls );
+	}
+
+	for( int round = 0; round < 2; ++round )
+	{
+		std::uint64_t heapCalls = XmlArena::GetHeapCallCount();
+		{
+			XmlArena::Scope arenaScope( arena );
+			pugi::xml_node root = document.append_child( "RemoteCall" );
+			for( int node = 0; node < 20000; ++node )
+			{
+				root.append_child( "value" ).text().set( node );
+			}
+		}
+
+		if( round == 0 )
+		{
+			// first round: grows
+			TEST_CHECK( arena.GetCapacity() > capacity );
+			capacity = arena.GetCapacity();
+		}
+		else
+		{
+			// second round: fits into the consolidated chunk
+			TEST_CHECK( arena.GetCapacity() == capacity );
+			TEST_CHECK( XmlArena::GetHeapCallCount() == heapCalls );
+		}
+
+		document.reset();
+		arena.Reset();
+		TEST_CHECK( arena.GetCapacity() == capacity );
+	}
+}
+
+
+
+
+/** The delay queue hands out each document after the given number of pushes, also for pushes without a document, and starts over on a new delay. */
+static void TestDelayQueue()
+{
+	XmlDelayQueue queue( PREALLOC_SIZE );
+	pugi::xml_document a, b;
+	a.append_child( "a" );
+	b.append_child( "b" );
+
+	TEST_CHECK( !queue.Push( &a, 2 ) );
+	TEST_CHECK( !queue.Push( nullptr, 2 ) );
+	const pugi::xml_document * due = queue.Push( &b, 2 );
+	TEST_CHECK( due && std::strcmp( due->document_element().name(), "a" ) == 0 );
+	TEST_CHECK( !queue.Push( &a, 2 ) );
+	due = queue.Push( nullptr, 2 );
+	TEST_CHECK( due && std::strcmp( due->document_element().name(), "b" ) == 0 );
+
+	TEST_CHECK( !queue.Push( &b, 1 ) );
+	due = queue.Push( nullptr, 1 );
+	TEST_CHECK( due && std::strcmp( due->document_element().name(), "b" ) == 0 );
+
+	due = queue.Push( &a, 0 );
+	TEST_CHECK( due && std::strcmp( due->document_element().name(), "a" ) == 0 );
+
+	queue.Clear();
+	TEST_CHECK( !queue.Push( &a, 1 ) );
+}
+
+
+
+
+int main()
+{
+	TestExchange();
+	TestGrowth();
+	TestDelayQueue();
+
+	return GetTestExitCode();
+}
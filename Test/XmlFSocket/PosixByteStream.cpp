@@ -0,0 +1,195 @@
+// POSIX socket ByteStream for headless tests and benchmarks of XmlFSocket.
+
+#include "PosixByteStream.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+
+
+
+/** Disable Nagle's algorithm: the traffic is request/response, each message should leave right away. */
+static void SetNoDelay( int socket )
+{
+	int noDelay = 1;
+	setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof( noDelay ) );
+}
+
+
+
+
+PosixByteStream::~PosixByteStream()
+{
+	if( this->Socket >= 0 ) close( this->Socket );
+}
+
+
+
+
+std::unique_ptr<PosixByteStream> PosixByteStream::Connect( const char * host, const char * port )
+{
+	addrinfo hints;
+	std::memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo * addresses = nullptr;
+	if( getaddrinfo( host, port, &hints, &addresses ) != 0 ) return nullptr;
+
+	int connected = -1;
+	for( addrinfo * address = addresses; address && connected < 0; address = address->ai_next )
+	{
+		connected = socket( address->ai_family, address->ai_socktype, address->ai_protocol );
+		if( connected >= 0 && connect( connected, address->ai_addr, address->ai_addrlen ) != 0 )
+		{
+			close( connected );
+			connected = -1;
+		}
+	}
+	freeaddrinfo( addresses );
+	if( connected < 0 ) return nullptr;
+
+	SetNoDelay( connected );
+	return std::unique_ptr<PosixByteStream>( new PosixByteStream( connected ) );
+}
+
+
+
+
+std::pair<std::unique_ptr<PosixByteStream>, std::unique_ptr<PosixByteStream>> PosixByteStream::CreateTcpPair()
+{
+	std::pair<std::unique_ptr<PosixByteStream>, std::unique_ptr<PosixByteStream>> pair;
+
+	// listen on an ephemeral port of the loopback interface
+	int listener = socket( AF_INET, SOCK_STREAM, 0 );
+	if( listener < 0 ) return pair;
+
+	sockaddr_in address;
+	std::memset( &address, 0, sizeof( address ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	address.sin_port = 0;
+	socklen_t addressLength = sizeof( address );
+
+	int connected = -1;
+	if( bind( listener, (sockaddr *)&address, sizeof( address ) ) == 0 && listen( listener, 1 ) == 0 &&
+		getsockname( listener, (sockaddr *)&address, &addressLength ) == 0 )
+	{
+		connected = socket( AF_INET, SOCK_STREAM, 0 );
+		if( connected >= 0 && connect( connected, (sockaddr *)&address, sizeof( address ) ) == 0 )
+		{
+			int accepted = accept( listener, nullptr, nullptr );
+			if( accepted >= 0 )
+			{
+				SetNoDelay( connected );
+				SetNoDelay( accepted );
+				pair.first.reset( new PosixByteStream( connected ) );
+				pair.second.reset( new PosixByteStream( accepted ) );
+				connected = -1;
+			}
+		}
+	}
+
+	if( connected >= 0 ) close( connected );
+	close( listener );
+	return pair;
+}
+
+
+
+
+bool PosixByteStream::IsGood()
+{
+	return this->Socket >= 0 && !this->Failed;
+}
+
+
+
+
+bool PosixByteStream::WaitForData( int timeoutMs )
+{
+	if( !IsGood() ) return false;
+
+	pollfd descriptor = { this->Socket, POLLIN, 0 };
+	return poll( &descriptor, 1, timeoutMs ) > 0 && (descriptor.revents & POLLIN);
+}
+
+
+
+
+bool PosixByteStream::HasPendingData( std::size_t & bytesPending )
+{
+	bytesPending = 0;
+	if( !IsGood() ) return false;
+
+	int pending = 0;
+	if( ioctl( this->Socket, FIONREAD, &pending ) != 0 )
+	{
+		this->Failed = true;
+		return false;
+	}
+
+	// nothing to read although the socket is readable: the peer has closed the connection
+	if( pending == 0 )
+	{
+		pollfd descriptor = { this->Socket, POLLIN, 0 };
+		if( poll( &descriptor, 1, 0 ) > 0 ) this->Failed = true;
+		return false;
+	}
+
+	bytesPending = std::size_t( pending );
+	return true;
+}
+
+
+
+
+bool PosixByteStream::Read( char * data, std::size_t size, std::size_t & bytesRead )
+{
+	bytesRead = 0;
+	if( !IsGood() ) return false;
+
+	ssize_t received = recv( this->Socket, data, size, MSG_DONTWAIT );
+	if( received > 0 )
+	{
+		bytesRead = std::size_t( received );
+		return true;
+	}
+
+	// nothing to read is fine; the peer closing the connection or errors are not
+	if( received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ) return true;
+	this->Failed = true;
+	return false;
+}
+
+
+
+
+bool PosixByteStream::Write( const char * data, std::size_t size )
+{
+	if( !IsGood() ) return false;
+
+	for( std::size_t sent = 0; sent < size; )
+	{
+		ssize_t result = send( this->Socket, data + sent, size - sent, MSG_NOSIGNAL );
+		if( result < 0 && errno == EINTR ) continue;
+		if( result <= 0 )
+		{
+			this->Failed = true;
+			return false;
+		}
+		sent += std::size_t( result );
+	}
+
+	return true;
+}
@@ -0,0 +1,46 @@
+// POSIX socket ByteStream for headless tests and benchmarks of XmlFSocket.
+
+#pragma once
+
+#include "ByteStream.h"
+
+#include <memory>
+#include <utility>
+
+
+
+
+/**
+ * ByteStream over a connected POSIX stream socket, which it owns. Reads never block (except in WaitForData()), writes block until all data is sent.
+ */
+class PosixByteStream : public ByteStream
+{
+	int Socket;
+
+	/** Set once the connection has failed or has been closed by the peer. */
+	bool Failed = false;
+
+
+public:
+
+	explicit PosixByteStream( int socket ) : Socket( socket ) {}
+
+	virtual ~PosixByteStream();
+
+	PosixByteStream( const PosixByteStream & ) = delete;
+	PosixByteStream & operator=( const PosixByteStream & ) = delete;
+
+
+	/** Connect to a TCP server. Returns null on failure. */
+	static std::unique_ptr<PosixByteStream> Connect( const char * host, const char * port );
+
+	/** Create both ends of a TCP connection over the loopback interface (with TCP_NODELAY). Returns a pair of nulls on failure. */
+	static std::pair<std::unique_ptr<PosixByteStream>, std::unique_ptr<PosixByteStream>> CreateTcpPair();
+
+
+	virtual bool IsGood() override;
+	virtual bool WaitForData( int timeoutMs ) override;
+	virtual bool HasPendingData( std::size_t & bytesPending ) override;
+	virtual bool Read( char * data, std::size_t size, std::size_t & bytesRead ) override;
+	virtual bool Write( const char * data, std::size_t size ) override;
+};
@@ -0,0 +1,260 @@
+// Headless benchmark of XmlFSocket: runs the message exchanges of the remote control protocol (handshake lines, command and response documents) between
+// two XmlFSockets in lockstep, over an in-memory loopback and over a TCP connection on the loopback interface. Reports round trips per second and the heap
+// allocations per round trip, and checks the received content and that the steady state does not allocate, so that it doubles as a test (run with a
+// small --messages count by ctest; the exit code is non-zero on failure).
+//
+// Usage: XmlFSocketBenchmark [--messages <n>] [--transport loopback|tcp|all]
+
+#include "XmlFSocket.h"
+#include "XmlArena.h"
+#include "MbmlWriter.h"
+#include "LoopbackByteStream.h"
+#include "PosixByteStream.h"
+#include "TestSupport.h"
+
+#include <pugixml.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+
+
+#define NUM_JOINTS 22
+
+// initial size of the arenas of the outbound documents, as that of the inbound ones in XmlFSocket
+#define ARENA_SIZE (64 * 1024)
+
+// unmeasured round trips before each measurement, for the buffers and arenas to reach their steady-state size
+#define WARMUP_ROUND_TRIPS 100
+
+// timeout of the blocking reads; the data is always on its way, so hitting it means that something is broken
+#define READ_TIMEOUT_MS 5000
+
+#define HANDSHAKE_LINE "RagdollController RCH: CONNECT Owen"
+#define ACK_LINE "OK"
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+
+
+/** The two ends of a connection: the remote controller (client) and the server side (as held by the hub and the ragdolls). */
+struct Endpoints
+{
+	/** Memory for the OutXml documents of the sockets, so that building them does not allocate from the heap. Declared before the sockets, so that
+	 ** they outlive the documents. */
+	XmlArena ClientOutXmlArena;
+	XmlArena ServerOutXmlArena;
+
+	XmlFSocket Client;
+	XmlFSocket Server;
+
+	/** Templates and documents of the exchanged messages, built once. */
+	MbmlTemplate Response;
+	MbmlTemplate::MatrixSlot ResponseAngles;
+	MbmlTemplate Command;
+	MbmlTemplate::MatrixSlot CommandActuators;
+
+	/** Scratch buffer for the content of a matrix. */
+	std::string Values;
+
+	Endpoints( std::unique_ptr<ByteStream> client, std::unique_ptr<ByteStream> server )  :
+		ClientOutXmlArena( ARENA_SIZE ), ServerOutXmlArena( ARENA_SIZE ), Client( std::move( client ) ), Server( std::move( server ) )
+	{
+		this->Client.SetBlocking( true, READ_TIMEOUT_MS );
+		this->Server.SetBlocking( true, READ_TIMEOUT_MS );
+
+		// command and response documents as the remote controller and AControlledRagdoll write them
+		MbmlWriter command( this->Command.Text );
+		command.BeginStruct( "RemoteCall" );
+		this->CommandActuators = command.AddMatrixSlot( "setActuators", NUM_JOINTS, 3 );
+		command.AddCharArray( "getSensors", "" );
+		command.EndStruct();
+
+		MbmlWriter response( this->Response.Text );
+		response.BeginStruct( "RemoteResponse" );
+		response.BeginStruct( "sensors" );
+		this->ResponseAngles = response.AddMatrixSlot( "jointAngles", NUM_JOINTS, 3 );
+		response.EndStruct();
+		response.EndStruct();
+
+		this->Values.reserve( NUM_JOINTS * 3 * MbmlTemplate::FieldWidth );
+	}
+};
+
+
+
+
+/** Count the values of a text matrix. */
+static int CountValues( const char * text )
+{
+	int numValues = 0;
+	for( char * end; ; text = end, ++numValues )
+	{
+		std::strtof( text, &end );
+		if( end == text ) return numValues;
+	}
+}
+
+
+
+
+/** Handshake: a command line and its acknowledgement. */
+static bool ExchangeLines( Endpoints & endpoints, int )
+{
+	TEST_REQUIRE( endpoints.Client.PutLine( HANDSHAKE_LINE ) );
+	TEST_REQUIRE( endpoints.Server.GetLine() );
+	TEST_REQUIRE( endpoints.Server.Line == HANDSHAKE_LINE );
+
+	TEST_REQUIRE( endpoints.Server.PutLine( ACK_LINE ) );
+	TEST_REQUIRE( endpoints.Client.GetLine() );
+	TEST_REQUIRE( endpoints.Client.Line == ACK_LINE );
+	return true;
+}
+
+
+
+
+/** Documents built in pugixml and sent with PutXml(), as with Mbml and OutXml. */
+static bool ExchangeXml( Endpoints & endpoints, int message )
+{
+	// command: the motor commands as text
+	endpoints.Values.clear();
+	for( int value = 0; value < NUM_JOINTS * 3; ++value )
+	{
+		char buffer[FloatFormat::MaxLength];
+		endpoints.Values.append( buffer, FloatFormat::Write( buffer, 0.001f * (message + value) ) );
+		endpoints.Values += ' ';
+	}
+	// the document is rebuilt per message: updating it in place would keep allocating from its arena, which is only released in bulk
+	endpoints.Client.OutXml.reset();
+	endpoints.ClientOutXmlArena.Reset();
+	{
+		XmlArena::Scope arenaScope( endpoints.ClientOutXmlArena );
+		endpoints.Client.OutXml.load_string( endpoints.Command.Text.c_str() );
+		endpoints.Client.OutXml.child( "RemoteCall" ).child( "setActuators" ).text().set( endpoints.Values.c_str() );
+	}
+	TEST_REQUIRE( endpoints.Client.PutXml() );
+
+	// server: receive, read the motor commands, respond with a document
+	TEST_REQUIRE( endpoints.Server.GetXml() );
+	TEST_REQUIRE( CountValues( endpoints.Server.InXml.document_element().child_value( "setActuators" ) ) == NUM_JOINTS * 3 );
+	endpoints.Server.OutXml.reset();
+	endpoints.ServerOutXmlArena.Reset();
+	{
+		XmlArena::Scope arenaScope( endpoints.ServerOutXmlArena );
+		endpoints.Server.OutXml.load_string( endpoints.Response.Text.c_str() );
+	}
+	TEST_REQUIRE( endpoints.Server.PutXml() );
+
+	// client: receive the response
+	TEST_REQUIRE( endpoints.Client.GetXml() );
+	TEST_REQUIRE( CountValues( endpoints.Client.InXml.document_element().child( "sensors" ).child_value( "jointAngles" ) ) == NUM_JOINTS * 3 );
+	return true;
+}
+
+
+
+
+/** Documents written as text and sent with PutOutText(), as AControlledRagdoll does. */
+static bool ExchangeText( Endpoints & endpoints, int message )
+{
+	endpoints.Command.SetMatrix( endpoints.CommandActuators, [message]( int row, int col ) { return 0.001f * (message + row + col); } );
+	endpoints.Client.BeginOutText() += endpoints.Command.Text;
+	TEST_REQUIRE( endpoints.Client.PutOutText() );
+
+	TEST_REQUIRE( endpoints.Server.GetXml() );
+	TEST_REQUIRE( CountValues( endpoints.Server.InXml.document_element().child_value( "setActuators" ) ) == NUM_JOINTS * 3 );
+	endpoints.Response.SetMatrix( endpoints.ResponseAngles, [message]( int row, int col ) { return 0.01f * (message - row * col); } );
+	endpoints.Server.BeginOutText() += endpoints.Response.Text;
+	TEST_REQUIRE( endpoints.Server.PutOutText() );
+
+	TEST_REQUIRE( endpoints.Client.GetXml() );
+	TEST_REQUIRE( CountValues( endpoints.Client.InXml.document_element().child( "sensors" ).child_value( "jointAngles" ) ) == NUM_JOINTS * 3 );
+	return true;
+}
+
+
+
+
+/** Warm up, then measure the exchange. Fails the test if an exchange fails, or if the steady state calls operator new/delete or the pugixml heap. */
+static void Run( const char * transport, const char * name, Endpoints & endpoints, int messages, const std::function<bool( Endpoints &, int )> & exchange )
+{
+	for( int message = 0; message < WARMUP_ROUND_TRIPS; ++message )
+	{
+		if( !TEST_CHECK( exchange( endpoints, message ) ) ) return;
+	}
+
+	unsigned long long newCalls = GetOperatorNewCallCount();
+	std::uint64_t heapCalls = XmlArena::GetHeapCallCount();
+	Clock::time_point begin = Clock::now();
+
+	for( int message = 0; message < messages; ++message )
+	{
+		if( !TEST_CHECK( exchange( endpoints, message ) ) ) return;
+	}
+
+	double seconds = std::chrono::duration<double>( Clock::now() - begin ).count();
+	newCalls = GetOperatorNewCallCount() - newCalls;
+	heapCalls = XmlArena::GetHeapCallCount() - heapCalls;
+	std::printf( "%-9s %-6s %8d round trips in %6.3f s: %9.0f/s, %7.2f us each, %6.2f operator new and %6.2f pugixml heap calls each\n", transport, name,
+		messages, seconds, messages / seconds, 1e6 * seconds / messages, double( newCalls ) / messages, double( heapCalls ) / messages );
+
+	TEST_CHECK( newCalls == 0 );
+	TEST_CHECK( heapCalls == 0 );
+}
+
+
+
+
+static void RunAll( const char * transport, Endpoints & endpoints, int messages )
+{
+	Run( transport, "lines", endpoints, messages, ExchangeLines );
+	Run( transport, "xml", endpoints, messages, ExchangeXml );
+	Run( transport, "text", endpoints, messages, ExchangeText );
+}
+
+
+
+
+int main( int argc, char ** argv )
+{
+	int messages = 20000;
+	std::string transport = "all";
+	for( int arg = 1; arg + 1 < argc; arg += 2 )
+	{
+		if( std::strcmp( argv[arg], "--messages" ) == 0 ) messages = std::atoi( argv[arg + 1] );
+		else if( std::strcmp( argv[arg], "--transport" ) == 0 ) transport = argv[arg + 1];
+	}
+	if( messages <= 0 || (transport != "all" && transport != "loopback" && transport != "tcp") )
+	{
+		std::printf( "Usage: XmlFSocketBenchmark [--messages <n>] [--transport loopback|tcp|all]\n" );
+		return 2;
+	}
+
+	if( transport != "tcp" )
+	{
+		auto streams = LoopbackByteStream::CreatePair();
+		Endpoints endpoints( std::move( streams.first ), std::move( streams.second ) );
+		RunAll( "loopback", endpoints, messages );
+	}
+
+	if( transport != "loopback" )
+	{
+		auto streams = PosixByteStream::CreateTcpPair();
+		if( !streams.first )
+		{
+			std::printf( "FAILED: could not create a TCP connection on the loopback interface\n" );
+			return 1;
+		}
+		Endpoints endpoints( std::move( streams.first ), std::move( streams.second ) );
+		RunAll( "tcp", endpoints, messages );
+	}
+
+	return GetTestExitCode();
+}